@@ -0,0 +1,82 @@
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include "CameraPath.h"
+
+CameraPath CameraPath::orbit(const Vec3f& eye, const Vec3f& center, const Vec3f& up) {
+    CameraPath path;
+    path.is_orbit = true;
+    path.orbit_eye = eye;
+    path.orbit_center = center;
+    path.orbit_up = up;
+    return path;
+}
+
+bool CameraPath::load_keyframes(const char* filename) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "Cannot open keyframe file: " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream iss(line);
+        Keyframe k;
+        iss >> k.t
+            >> k.eye.x >> k.eye.y >> k.eye.z
+            >> k.center.x >> k.center.y >> k.center.z
+            >> k.up.x >> k.up.y >> k.up.z;
+        if (iss.fail()) {
+            std::cerr << "bad keyframe line: " << line << "\n";
+            continue;
+        }
+        add_keyframe(k.t, k.eye, k.center, k.up);
+    }
+    return !keys.empty();
+}
+
+void CameraPath::add_keyframe(float t, const Vec3f& eye, const Vec3f& center, const Vec3f& up) {
+    Keyframe k = { t, eye, center, up };
+    auto it = std::upper_bound(keys.begin(), keys.end(), t,
+        [](float v, const Keyframe& a) { return v < a.t; });
+    keys.insert(it, k);
+}
+
+Camera CameraPath::at(float t) const {
+    if (is_orbit) {
+        Vec3f axis = orbit_up;
+        axis.normalize();
+        Vec3f r = orbit_eye - orbit_center;
+        float angle = 2.f * 3.14159265f * t;
+        float c = std::cos(angle), s = std::sin(angle);
+        Vec3f rot = r * c + cross(axis, r) * s + axis * ((axis * r) * (1.f - c));
+        return Camera(orbit_center + rot, orbit_center, orbit_up);
+    }
+    if (keys.empty()) {
+        return Camera(Vec3f(0.f, 0.f, 1.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f));
+    }
+
+    float t0 = keys.front().t, t1 = keys.back().t;
+    float kt = t0 + (t1 - t0) * t;
+    if (kt <= t0) return Camera(keys.front().eye, keys.front().center, keys.front().up);
+    if (kt >= t1) return Camera(keys.back().eye, keys.back().center, keys.back().up);
+
+    size_t i = 1;
+    while (i < keys.size() && keys[i].t < kt) i++;
+    const Keyframe& a = keys[i - 1];
+    const Keyframe& b = keys[i];
+    float u = (b.t > a.t) ? (kt - a.t) / (b.t - a.t) : 0.f;
+    return Camera(a.eye + (b.eye - a.eye) * u,
+        a.center + (b.center - a.center) * u,
+        a.up + (b.up - a.up) * u);
+}
+
+Camera CameraPath::frame(int i, int nframes) const {
+    if (nframes <= 1) return at(0.f);
+
+    float t = is_orbit ? float(i) / nframes : float(i) / (nframes - 1);
+    return at(t);
+}
@@ -0,0 +1,42 @@
+#ifndef __CAMERA_PATH_H__
+#define __CAMERA_PATH_H__
+
+#include <vector>
+#include "geometry.h"
+#include "Camera.h"
+
+// Camera trajectory for sequence rendering: either a turntable orbit around
+// a center point or a list of keyframes interpolated linearly in time.
+class CameraPath {
+public:
+    struct Keyframe {
+        float t;
+        Vec3f eye;
+        Vec3f center;
+        Vec3f up;
+    };
+
+    // Full turn around `center` starting at `eye`, keeping the height of the eye.
+    static CameraPath orbit(const Vec3f& eye, const Vec3f& center, const Vec3f& up);
+
+    // Text file, one keyframe per line: "t ex ey ez cx cy cz ux uy uz".
+    bool load_keyframes(const char* filename);
+    void add_keyframe(float t, const Vec3f& eye, const Vec3f& center, const Vec3f& up);
+
+    // t in [0, 1] over the whole path.
+    Camera at(float t) const;
+    // Camera of frame i out of nframes; an orbit never repeats its first frame.
+    Camera frame(int i, int nframes) const;
+
+    bool empty() const { return !is_orbit && keys.empty(); }
+
+private:
+    bool  is_orbit = false;
+    Vec3f orbit_eye;
+    Vec3f orbit_center;
+    Vec3f orbit_up;
+
+    std::vector<Keyframe> keys;
+};
+
+#endif // __CAMERA_PATH_H__
@@ -0,0 +1,166 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "ao_bake.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Face covering a texel center and the barycentrics of that point.
+struct TexelRef {
+    int   face;
+    float b1;
+    float b2;
+};
+
+unsigned hash(unsigned x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+float radical_inverse(unsigned i) {
+    i = (i << 16) | (i >> 16);
+    i = ((i & 0x55555555U) << 1) | ((i & 0xAAAAAAAAU) >> 1);
+    i = ((i & 0x33333333U) << 2) | ((i & 0xCCCCCCCCU) >> 2);
+    i = ((i & 0x0F0F0F0FU) << 4) | ((i & 0xF0F0F0F0U) >> 4);
+    i = ((i & 0x00FF00FFU) << 8) | ((i & 0xFF00FF00U) >> 8);
+    return i * 2.3283064365386963e-10f;
+}
+
+void basis(const Vec3f& n, Vec3f& t, Vec3f& b) {
+    float s = n.z >= 0.f ? 1.f : -1.f;
+    float a = -1.f / (s + n.z);
+    float c = n.x * n.y * a;
+    t = Vec3f(1.f + s * n.x * n.x * a, s * c, -s * n.x);
+    b = Vec3f(c, s + n.y * n.y * a, -n.y);
+}
+
+// Scan-converts every face in uv space and records which one covers each
+// texel center.
+void map_texels(Model& model, int size, std::vector<TexelRef>& texels) {
+    texels.assign((size_t)size * size, TexelRef{ -1, 0.f, 0.f });
+    for (int f = 0; f < model.nfaces(); f++) {
+        Vec2f t[3];
+        for (int j = 0; j < 3; j++) t[j] = model.uv(f, j) * (float)size;
+        float area = (t[1].x - t[0].x) * (t[2].y - t[0].y) - (t[2].x - t[0].x) * (t[1].y - t[0].y);
+        if (std::abs(area) < 1e-8f) continue;
+
+        int x0 = std::max(0, (int)std::floor(std::min(t[0].x, std::min(t[1].x, t[2].x))));
+        int x1 = std::min(size - 1, (int)std::ceil(std::max(t[0].x, std::max(t[1].x, t[2].x))));
+        int y0 = std::max(0, (int)std::floor(std::min(t[0].y, std::min(t[1].y, t[2].y))));
+        int y1 = std::min(size - 1, (int)std::ceil(std::max(t[0].y, std::max(t[1].y, t[2].y))));
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                float px = x + 0.5f - t[0].x, py = y + 0.5f - t[0].y;
+                float b1 = (px * (t[2].y - t[0].y) - (t[2].x - t[0].x) * py) / area;
+                float b2 = ((t[1].x - t[0].x) * py - px * (t[1].y - t[0].y)) / area;
+                if (b1 < 0.f || b2 < 0.f || b1 + b2 > 1.f) continue;
+                TexelRef& r = texels[(size_t)y * size + x];
+                r.face = f;
+                r.b1 = b1;
+                r.b2 = b2;
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+void bake_ao(Model& model, const BVH& bvh, const AOBakeParams& params, TGAImage& out) {
+    const int size = params.size;
+    std::vector<TexelRef> texels;
+    map_texels(model, size, texels);
+
+    Vec3f lo = model.vert(0), hi = lo;
+    for (int i = 1; i < model.nverts(); i++) {
+        Vec3f v = model.vert(i);
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], v[k]);
+            hi[k] = std::max(hi[k], v[k]);
+        }
+    }
+    float diag = (hi - lo).norm();
+    float range = params.max_distance * diag;
+    float eps = 1e-4f * diag;
+
+    // -1 marks texels no face covers.
+    std::vector<float> ao((size_t)size * size, -1.f);
+    parallel_for(0, size, 4, [&](int ylo, int yhi) {
+        for (int y = ylo; y < yhi; y++) {
+            for (int x = 0; x < size; x++) {
+                size_t idx = (size_t)y * size + x;
+                const TexelRef& r = texels[idx];
+                if (r.face < 0) continue;
+
+                float b0 = 1.f - r.b1 - r.b2;
+                Vec3f p = model.vert(r.face, 0) * b0 + model.vert(r.face, 1) * r.b1 + model.vert(r.face, 2) * r.b2;
+                Vec3f n = model.normal(r.face, 0) * b0 + model.normal(r.face, 1) * r.b1 + model.normal(r.face, 2) * r.b2;
+                if (n.norm() < 1e-6f) continue;
+                n.normalize();
+                Vec3f t, b;
+                basis(n, t, b);
+                Vec3f org = p + n * eps;
+
+                // Hammersley points, randomly shifted per texel.
+                unsigned seed = hash((unsigned)idx);
+                float shift_u = (seed & 0xffff) / 65536.f;
+                float shift_v = (seed >> 16) / 65536.f;
+                int open = 0;
+                for (int s = 0; s < params.samples; s++) {
+                    float u = (s + 0.5f) / params.samples + shift_u;
+                    float v = radical_inverse((unsigned)s) + shift_v;
+                    u -= std::floor(u);
+                    v -= std::floor(v);
+                    float rad = std::sqrt(u);
+                    float phi = 6.2831853f * v;
+                    Vec3f dir = t * (rad * std::cos(phi)) + b * (rad * std::sin(phi)) + n * std::sqrt(std::max(0.f, 1.f - u));
+                    if (!bvh.occluded(Ray(org, dir, eps, range))) open++;
+                }
+                ao[idx] = (float)open / params.samples;
+            }
+        }
+    });
+
+    // Grow the charts outwards a few texels.
+    for (int pass = 0; pass < 4; pass++) {
+        std::vector<float> next = ao;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                if (ao[(size_t)y * size + x] >= 0.f) continue;
+                float sum = 0.f;
+                int n = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int sx = x + dx, sy = y + dy;
+                        if (sx < 0 || sy < 0 || sx >= size || sy >= size) continue;
+                        float v = ao[(size_t)sy * size + sx];
+                        if (v < 0.f) continue;
+                        sum += v;
+                        n++;
+                    }
+                }
+                if (n) next[(size_t)y * size + x] = sum / n;
+            }
+        }
+        ao.swap(next);
+    }
+
+    out = TGAImage(size, size, TGAImage::GRAYSCALE);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            float v = ao[(size_t)y * size + x];
+            if (v < 0.f) v = 1.f;
+            out.set(x, y, TGAColor((unsigned char)(v * 255.f + 0.5f)));
+        }
+    }
+}
+
+std::string ao_map_path(const std::string& obj_path) {
+    size_t dot = obj_path.find_last_of(".");
+    return obj_path.substr(0, dot) + "_ao.tga";
+}
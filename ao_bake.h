@@ -0,0 +1,25 @@
+#ifndef __AO_BAKE_H__
+#define __AO_BAKE_H__
+
+#include <string>
+#include "model.h"
+#include "bvh.h"
+#include "tgaimage.h"
+
+struct AOBakeParams {
+    int   size = 512;           // AO map is size x size texels
+    int   samples = 64;         // hemisphere rays per texel
+    float max_distance = 0.2f;  // occluder range, fraction of the bbox diagonal
+};
+
+// Bakes ambient occlusion over the model's uv layout into a GRAYSCALE map
+// (255 = fully open). Each covered texel casts cosine-weighted hemisphere
+// rays from the surface point around the interpolated vertex normal; rows
+// are spread over the thread pool. Texels outside the uv charts are filled
+// from their neighbours so sampling at chart seams stays clean.
+void bake_ao(Model& model, const BVH& bvh, const AOBakeParams& params, TGAImage& out);
+
+// "obj/head.obj" -> "obj/head_ao.tga", the name Model looks for.
+std::string ao_map_path(const std::string& obj_path);
+
+#endif // __AO_BAKE_H__
@@ -0,0 +1,98 @@
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include "arena.h"
+
+Arena::Arena(size_t block_size_)
+    : blocks(), block_size(block_size_), current(0), offset(0), bytes_(0), allocs_(0) {
+}
+
+Arena::~Arena() {
+    for (size_t i = 0; i < blocks.size(); i++) ::operator delete(blocks[i].data);
+}
+
+void Arena::add_block(size_t min_size) {
+    Block b;
+    b.size = std::max(block_size, min_size);
+    b.data = static_cast<char*>(::operator new(b.size));
+    blocks.push_back(b);
+}
+
+void* Arena::alloc(size_t bytes, size_t align) {
+    allocs_++;
+    bytes_ += bytes;
+    for (;;) {
+        if (current < blocks.size()) {
+            Block& b = blocks[current];
+            size_t p = (reinterpret_cast<size_t>(b.data) + offset + align - 1) & ~(align - 1);
+            size_t start = p - reinterpret_cast<size_t>(b.data);
+            if (start + bytes <= b.size) {
+                offset = start + bytes;
+                return b.data + start;
+            }
+            if (current + 1 < blocks.size()) {
+                current++;
+                offset = 0;
+                continue;
+            }
+        }
+        add_block(bytes + align);
+        current = blocks.size() - 1;
+        offset = 0;
+    }
+}
+
+void Arena::reset() {
+    if (blocks.size() > 1) {
+        size_t total = capacity();
+        for (size_t i = 0; i < blocks.size(); i++) ::operator delete(blocks[i].data);
+        blocks.clear();
+        add_block(total);
+    }
+    current = 0;
+    offset = 0;
+    bytes_ = 0;
+    allocs_ = 0;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++) total += blocks[i].size;
+    return total;
+}
+
+
+static std::mutex registry_mtx;
+static std::vector<std::shared_ptr<Arena>> registry;
+
+Arena& frame_arena() {
+    static thread_local std::shared_ptr<Arena> local;
+    if (!local) {
+        local = std::make_shared<Arena>(256 << 10);
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        registry.push_back(local);
+    }
+    return *local;
+}
+
+ArenaStats reset_frame_arenas() {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    ArenaStats st;
+    for (size_t i = 0; i < registry.size(); i++) {
+        Arena& a = *registry[i];
+        st.bytes += a.bytes();
+        st.allocations += a.allocations();
+        if (a.allocations()) st.threads++;
+        a.reset();
+    }
+    // Arenas of threads that have exited (std::async helpers) are dropped.
+    registry.erase(std::remove_if(registry.begin(), registry.end(),
+        [](const std::shared_ptr<Arena>& a) { return a.use_count() == 1; }), registry.end());
+    for (size_t i = 0; i < registry.size(); i++) st.capacity += registry[i]->capacity();
+    return st;
+}
+
+void ArenaStats::print(std::ostream& out) const {
+    out << "frame arenas   " << allocations << " allocations, " << bytes << " bytes on "
+        << threads << " threads (" << (capacity >> 10) << " KB reserved)\n";
+}
@@ -0,0 +1,79 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <vector>
+#include <new>
+#include <iostream>
+
+// Bump allocator. Allocations are carved out of large blocks and never
+// freed one by one; reset() rewinds the arena (keeping its memory) and the
+// destructor releases it. Objects placed in an arena must not need their
+// destructors run, or the owner runs them before reset.
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 << 10);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* alloc(size_t bytes, size_t align = sizeof(void*) * 2);
+
+    // Uninitialized storage for n objects of T.
+    template <typename T>
+    T* alloc_array(size_t n) { return static_cast<T*>(alloc(n * sizeof(T), alignof(T))); }
+
+    // Default-constructed (zeroed for scalars) array of n objects of T.
+    // Their destructors are never run, so T's destructor must do nothing
+    // (no owned memory or handles); an empty virtual one, as the shaders
+    // have, is fine.
+    template <typename T>
+    T* make_array(size_t n) {
+        T* p = alloc_array<T>(n);
+        for (size_t i = 0; i < n; i++) new (p + i) T();
+        return p;
+    }
+
+    // Rewinds to empty. If the arena had to grow, its blocks are merged into
+    // one so the next round of the same size fits without new blocks.
+    void reset();
+
+    size_t bytes() const { return bytes_; }            // requested since reset
+    size_t allocations() const { return allocs_; }     // alloc() calls since reset
+    size_t capacity() const;
+
+private:
+    struct Block {
+        char*  data;
+        size_t size;
+    };
+
+    void add_block(size_t min_size);
+
+    std::vector<Block> blocks;
+    size_t block_size;
+    size_t current;     // block being bumped
+    size_t offset;      // into blocks[current]
+    size_t bytes_;
+    size_t allocs_;
+};
+
+// Transient per-frame memory of the calling thread (bins, offsets, shader
+// scratch, varyings). Valid until the frame loop calls reset_frame_arenas().
+Arena& frame_arena();
+
+struct ArenaStats {
+    size_t bytes = 0;
+    size_t allocations = 0;
+    size_t capacity = 0;    // reserved by all frame arenas
+    int    threads = 0;     // arenas that were used this frame
+
+    void print(std::ostream& out) const;
+};
+
+// Sums and rewinds the frame arenas of every thread. Call it at the end of
+// a frame, when no thread is using its arena.
+ArenaStats reset_frame_arenas();
+
+#endif // __ARENA_H__
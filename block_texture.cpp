@@ -0,0 +1,246 @@
+#include <cmath>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include "block_texture.h"
+#include "thread_pool.h"
+
+namespace {
+
+const int BLOCK_BYTES = 8;
+
+std::atomic<unsigned> next_id(1);
+
+// Direct-mapped cache of decoded blocks, one per thread: 128 blocks cover
+// a 512-texel-wide band of a scanline and the row of blocks after it.
+const int CACHE_BITS = 7;
+const int CACHE_SLOTS = 1 << CACHE_BITS;
+
+struct CachedBlock {
+    unsigned      tex;
+    int           block;
+    unsigned char px[16 * 4];
+};
+
+struct BlockCache {
+    CachedBlock     slots[CACHE_SLOTS];
+    BlockCacheStats stats;
+
+    BlockCache() {
+        for (int i = 0; i < CACHE_SLOTS; i++) slots[i].tex = 0;
+        stats.hits = stats.misses = 0;
+    }
+};
+
+BlockCache& thread_cache() {
+    static thread_local BlockCache cache;
+    return cache;
+}
+
+unsigned short pack565(const float* bgr) {
+    int b = std::max(0, std::min(31, (int)(bgr[0] * 31.f / 255.f + 0.5f)));
+    int g = std::max(0, std::min(63, (int)(bgr[1] * 63.f / 255.f + 0.5f)));
+    int r = std::max(0, std::min(31, (int)(bgr[2] * 31.f / 255.f + 0.5f)));
+    return (unsigned short)(r << 11 | g << 5 | b);
+}
+
+void unpack565(unsigned short c, int* bgr) {
+    int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    bgr[0] = b << 3 | b >> 2;
+    bgr[1] = g << 2 | g >> 4;
+    bgr[2] = r << 3 | r >> 2;
+}
+
+void bc1_palette(unsigned short c0, unsigned short c1, int pal[4][3]) {
+    unpack565(c0, pal[0]);
+    unpack565(c1, pal[1]);
+    for (int k = 0; k < 3; k++) {
+        if (c0 > c1) {
+            pal[2][k] = (2 * pal[0][k] + pal[1][k]) / 3;
+            pal[3][k] = (pal[0][k] + 2 * pal[1][k]) / 3;
+        }
+        else {
+            pal[2][k] = (pal[0][k] + pal[1][k]) / 2;
+            pal[3][k] = 0;
+        }
+    }
+}
+
+// Endpoints at the extremes of the colors projected on their principal
+// axis, indices to the nearest of the four palette entries.
+void encode_bc1(const unsigned char px[16][4], unsigned char* out) {
+    float mean[3] = { 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; i++)
+        for (int k = 0; k < 3; k++) mean[k] += px[i][k] / 16.f;
+    float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; i++) {
+        float d[3] = { px[i][0] - mean[0], px[i][1] - mean[1], px[i][2] - mean[2] };
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    float axis[3] = { 1.f, 1.f, 1.f };
+    for (int it = 0; it < 8; it++) {
+        float a[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+        float len = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+        if (len < 1e-6f) break;
+        for (int k = 0; k < 3; k++) axis[k] = a[k] / len;
+    }
+    float tmin = 1e30f, tmax = -1e30f;
+    for (int i = 0; i < 16; i++) {
+        float t = 0.f;
+        for (int k = 0; k < 3; k++) t += (px[i][k] - mean[k]) * axis[k];
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
+    }
+    float e0[3], e1[3];
+    for (int k = 0; k < 3; k++) {
+        e0[k] = mean[k] + axis[k] * tmax;
+        e1[k] = mean[k] + axis[k] * tmin;
+    }
+    unsigned short c0 = pack565(e0), c1 = pack565(e1);
+    if (c0 < c1) std::swap(c0, c1);
+
+    unsigned indices = 0;
+    if (c0 != c1) {
+        int pal[4][3];
+        bc1_palette(c0, c1, pal);
+        for (int i = 0; i < 16; i++) {
+            int best = 0, best_d = 1 << 30;
+            for (int j = 0; j < 4; j++) {
+                int d = 0;
+                for (int k = 0; k < 3; k++) d += (px[i][k] - pal[j][k]) * (px[i][k] - pal[j][k]);
+                if (d < best_d) {
+                    best_d = d;
+                    best = j;
+                }
+            }
+            indices |= (unsigned)best << (2 * i);
+        }
+    }
+    out[0] = (unsigned char)c0;
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)c1;
+    out[3] = (unsigned char)(c1 >> 8);
+    for (int k = 0; k < 4; k++) out[4 + k] = (unsigned char)(indices >> (8 * k));
+}
+
+void decode_bc1(const unsigned char* in, unsigned char* out) {
+    unsigned short c0 = (unsigned short)(in[0] | in[1] << 8);
+    unsigned short c1 = (unsigned short)(in[2] | in[3] << 8);
+    unsigned indices = in[4] | in[5] << 8 | in[6] << 16 | (unsigned)in[7] << 24;
+    int pal[4][3];
+    bc1_palette(c0, c1, pal);
+    for (int i = 0; i < 16; i++, out += 4) {
+        const int* c = pal[(indices >> (2 * i)) & 3];
+        out[0] = (unsigned char)c[0];
+        out[1] = (unsigned char)c[1];
+        out[2] = (unsigned char)c[2];
+        out[3] = 255;
+    }
+}
+
+void bc4_palette(int a0, int a1, int* pal) {
+    pal[0] = a0;
+    pal[1] = a1;
+    for (int k = 1; k < 7; k++) pal[1 + k] = ((7 - k) * a0 + k * a1 + 3) / 7;
+}
+
+void encode_bc4(const unsigned char px[16][4], unsigned char* out) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, (int)px[i][0]);
+        a1 = std::min(a1, (int)px[i][0]);
+    }
+    unsigned long long indices = 0;
+    if (a0 != a1) {
+        int pal[8];
+        bc4_palette(a0, a1, pal);
+        for (int i = 0; i < 16; i++) {
+            int best = 0, best_d = 1 << 30;
+            for (int j = 0; j < 8; j++) {
+                int d = std::abs(px[i][0] - pal[j]);
+                if (d < best_d) {
+                    best_d = d;
+                    best = j;
+                }
+            }
+            indices |= (unsigned long long)best << (3 * i);
+        }
+    }
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+    for (int k = 0; k < 6; k++) out[2 + k] = (unsigned char)(indices >> (8 * k));
+}
+
+void decode_bc4(const unsigned char* in, unsigned char* out) {
+    int pal[8];
+    bc4_palette(in[0], in[1], pal);
+    unsigned long long indices = 0;
+    for (int k = 0; k < 6; k++) indices |= (unsigned long long)in[2 + k] << (8 * k);
+    for (int i = 0; i < 16; i++, out += 4) out[0] = (unsigned char)pal[(indices >> (3 * i)) & 7];
+}
+
+} // namespace
+
+
+BlockTexture::BlockTexture() : format_(BC1), width_(0), height_(0), bw(0), id(0) {
+}
+
+void BlockTexture::compress(TGAImage& img) {
+    int bpp = img.get_bytespp();
+    format_ = bpp == TGAImage::GRAYSCALE ? BC4 : BC1;
+    width_ = img.get_width();
+    height_ = img.get_height();
+    bw = (width_ + 3) / 4;
+    int bh = (height_ + 3) / 4;
+    blocks.assign((size_t)bw * bh * BLOCK_BYTES, 0);
+    id = next_id++;
+
+    const unsigned char* src = img.buffer();
+    parallel_for(0, bh, 4, [&](int lo, int hi) {
+        unsigned char px[16][4];
+        for (int by = lo; by < hi; by++) {
+            for (int bx = 0; bx < bw; bx++) {
+                // Edge blocks repeat the last row / column.
+                for (int i = 0; i < 16; i++) {
+                    int x = std::min(width_ - 1, bx * 4 + (i & 3));
+                    int y = std::min(height_ - 1, by * 4 + (i >> 2));
+                    const unsigned char* p = src + ((size_t)y * width_ + x) * bpp;
+                    for (int k = 0; k < 4; k++) px[i][k] = k < bpp ? p[k] : 255;
+                }
+                unsigned char* out = &blocks[((size_t)by * bw + bx) * BLOCK_BYTES];
+                if (format_ == BC4) encode_bc4(px, out);
+                else encode_bc1(px, out);
+            }
+        }
+    });
+}
+
+void BlockTexture::decode(int block, unsigned char* out) const {
+    const unsigned char* in = &blocks[(size_t)block * BLOCK_BYTES];
+    if (format_ == BC4) decode_bc4(in, out);
+    else decode_bc1(in, out);
+}
+
+const unsigned char* BlockTexture::texel(int x, int y) const {
+    int block = (y >> 2) * bw + (x >> 2);
+    BlockCache& cache = thread_cache();
+    CachedBlock& slot = cache.slots[(unsigned)(block * 2654435761U) >> (32 - CACHE_BITS)];
+    if (slot.tex != id || slot.block != block) {
+        decode(block, slot.px);
+        slot.tex = id;
+        slot.block = block;
+        cache.stats.misses++;
+    }
+    else {
+        cache.stats.hits++;
+    }
+    return slot.px + 4 * ((y & 3) * 4 + (x & 3));
+}
+
+BlockCacheStats& block_cache_stats() {
+    return thread_cache().stats;
+}
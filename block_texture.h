@@ -0,0 +1,54 @@
+#ifndef __BLOCK_TEXTURE_H__
+#define __BLOCK_TEXTURE_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+// Texture held in 4x4 blocks of 8 bytes: BC1 (two 5:6:5 endpoints and
+// 2-bit indices) for color, BC4 (two 8-bit endpoints and 3-bit indices)
+// for one channel. That is 4 bits per texel against 32 for the RGBA maps
+// and 8 for the grayscale ones.
+//
+// Texels are decoded a block at a time into a small per-thread cache, so
+// neighbouring lookups, the common case when rasterizing, decode once.
+class BlockTexture {
+public:
+    enum Format { BC1, BC4 };
+
+    BlockTexture();
+
+    // RGBA images compress to BC1 (alpha dropped), GRAYSCALE to BC4. Block
+    // rows are encoded in parallel.
+    void compress(TGAImage& img);
+
+    bool   empty() const { return blocks.empty(); }
+    int    width() const { return width_; }
+    int    height() const { return height_; }
+    Format format() const { return format_; }
+    size_t bytes() const { return blocks.size(); }
+
+    // Texel (x, y) as B G R A (BC1) or in the first byte (BC4). The
+    // pointer is into the calling thread's cache and stays valid until
+    // that thread's next texel() call.
+    const unsigned char* texel(int x, int y) const;
+
+private:
+    void decode(int block, unsigned char* out) const;
+
+    Format                     format_;
+    int                        width_;
+    int                        height_;
+    int                        bw;        // blocks per row
+    unsigned                   id;        // cache key, unique per compress()
+    std::vector<unsigned char> blocks;
+};
+
+// Hit and miss counts of the calling thread's block cache.
+struct BlockCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+};
+
+BlockCacheStats& block_cache_stats();
+
+#endif // __BLOCK_TEXTURE_H__
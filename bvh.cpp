@@ -0,0 +1,531 @@
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include "bvh.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace {
+
+const int   MAX_LEAF = 8;
+const int   NBINS = 16;
+const int   STACK_SIZE = 128;
+const float BIG = std::numeric_limits<float>::max();
+
+struct Aabb {
+    Vec3f lo;
+    Vec3f hi;
+
+    Aabb() : lo(BIG, BIG, BIG), hi(-BIG, -BIG, -BIG) {}
+
+    void grow(const Vec3f& p) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], p[k]);
+            hi[k] = std::max(hi[k], p[k]);
+        }
+    }
+    void grow(const Aabb& b) {
+        grow(b.lo);
+        grow(b.hi);
+    }
+    float area() const {
+        Vec3f d = hi - lo;
+        if (d.x < 0.f) return 0.f;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+struct BuildRef {
+    Aabb  box;
+    Vec3f c;
+    int   face;
+};
+
+// Binary node; left < 0 marks a leaf over refs [first, first + count).
+struct BuildNode {
+    Aabb box;
+    int  left;
+    int  right;
+    int  first;
+    int  count;
+};
+
+// Subtree left for the parallel phase.
+struct Pending {
+    int node;
+    int first;
+    int count;
+};
+
+// Binned SAH split of refs [first, first + count). Returns false if a leaf
+// is cheaper; otherwise partitions the range and sets mid.
+bool split(std::vector<BuildRef>& refs, int first, int count, const Aabb& box, int& mid) {
+    if (count <= 2) return false;
+
+    Aabb cbox;
+    for (int i = first; i < first + count; i++) cbox.grow(refs[i].c);
+    int axis = 0;
+    Vec3f ext = cbox.hi - cbox.lo;
+    if (ext.y > ext[axis]) axis = 1;
+    if (ext.z > ext[axis]) axis = 2;
+
+    if (ext[axis] <= 0.f) {
+        if (count <= MAX_LEAF) return false;
+        mid = first + count / 2;
+        return true;
+    }
+
+    Aabb bins[NBINS];
+    int  counts[NBINS] = { 0 };
+    float k = NBINS * 0.999f / ext[axis];
+    for (int i = first; i < first + count; i++) {
+        int b = (int)((refs[i].c[axis] - cbox.lo[axis]) * k);
+        bins[b].grow(refs[i].box);
+        counts[b]++;
+    }
+
+    float right_area[NBINS];
+    int   right_count[NBINS];
+    Aabb acc;
+    int n = 0;
+    for (int b = NBINS - 1; b > 0; b--) {
+        acc.grow(bins[b]);
+        n += counts[b];
+        right_area[b] = acc.area();
+        right_count[b] = n;
+    }
+
+    float best_cost = BIG;
+    int best = -1;
+    acc = Aabb();
+    n = 0;
+    for (int b = 0; b < NBINS - 1; b++) {
+        acc.grow(bins[b]);
+        n += counts[b];
+        if (n == 0 || right_count[b + 1] == 0) continue;
+        float cost = acc.area() * n + right_area[b + 1] * right_count[b + 1];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = b;
+        }
+    }
+
+    // Traversal step costs about as much as one triangle test.
+    float area = box.area();
+    float leaf_cost = (float)count;
+    float split_cost = area > 0.f ? 1.f + best_cost / area : BIG;
+    if (best < 0 || (split_cost >= leaf_cost && count <= MAX_LEAF)) {
+        if (count <= MAX_LEAF) return false;
+        BuildRef* p = &refs[first];
+        std::nth_element(p, p + count / 2, p + count, [axis](const BuildRef& a, const BuildRef& b) {
+            return a.c[axis] < b.c[axis];
+        });
+        mid = first + count / 2;
+        return true;
+    }
+
+    float lo = cbox.lo[axis];
+    BuildRef* it = std::partition(&refs[first], &refs[first] + count, [=](const BuildRef& r) {
+        return (int)((r.c[axis] - lo) * k) <= best;
+    });
+    mid = (int)(it - &refs[0]);
+    return true;
+}
+
+// Builds the subtree over refs [first, first + count) into out and returns
+// its root. With pending set, ranges of at most cutoff refs are not built
+// but queued for the parallel phase.
+int build_node(std::vector<BuildRef>& refs, std::vector<BuildNode>& out, int first, int count,
+    std::vector<Pending>* pending, int cutoff) {
+    int index = (int)out.size();
+    out.push_back(BuildNode());
+
+    Aabb box;
+    for (int i = first; i < first + count; i++) box.grow(refs[i].box);
+    out[index].box = box;
+    out[index].left = -1;
+    out[index].right = -1;
+    out[index].first = first;
+    out[index].count = count;
+
+    if (pending && count <= cutoff) {
+        Pending p = { index, first, count };
+        pending->push_back(p);
+        return index;
+    }
+
+    int mid;
+    if (!split(refs, first, count, box, mid)) return index;
+
+    int l = build_node(refs, out, first, mid - first, pending, cutoff);
+    int r = build_node(refs, out, mid, first + count - mid, pending, cutoff);
+    out[index].left = l;
+    out[index].right = r;
+    return index;
+}
+
+int collapse(const std::vector<BuildNode>& bin, int b, std::vector<BVHNode>& out) {
+    int index = (int)out.size();
+    out.push_back(BVHNode());
+
+    int kids[4];
+    int n = 0;
+    if (bin[b].left < 0) {
+        kids[n++] = b;
+    }
+    else {
+        kids[n++] = bin[b].left;
+        kids[n++] = bin[b].right;
+        // Pull up grandchildren, largest box first, until the node is full.
+        while (n < 4) {
+            int pick = -1;
+            float best = -1.f;
+            for (int i = 0; i < n; i++) {
+                if (bin[kids[i]].left < 0) continue;
+                float a = bin[kids[i]].box.area();
+                if (a > best) {
+                    best = a;
+                    pick = i;
+                }
+            }
+            if (pick < 0) break;
+            int c = kids[pick];
+            kids[pick] = bin[c].left;
+            kids[n++] = bin[c].right;
+        }
+    }
+
+    BVHNode node;
+    for (int i = 0; i < 4; i++) {
+        for (int k = 0; k < 3; k++) {
+            node.bmin[k][i] = BIG;
+            node.bmax[k][i] = -BIG;
+        }
+        node.child[i] = 0;
+        node.count[i] = -1;
+    }
+    for (int i = 0; i < n; i++) {
+        const BuildNode& c = bin[kids[i]];
+        for (int k = 0; k < 3; k++) {
+            node.bmin[k][i] = c.box.lo[k];
+            node.bmax[k][i] = c.box.hi[k];
+        }
+        if (c.left < 0) {
+            node.child[i] = c.first;
+            node.count[i] = c.count;
+        }
+        else {
+            node.child[i] = collapse(bin, kids[i], out);
+            node.count[i] = 0;
+        }
+    }
+    out[index] = node;
+    return index;
+}
+
+struct RayData {
+    Vec3f org;
+    Vec3f dir;
+    Vec3f inv;
+    float tmin;
+};
+
+RayData prepare(const Ray& r) {
+    RayData d;
+    d.org = r.org;
+    d.dir = r.dir;
+    for (int k = 0; k < 3; k++) d.inv[k] = 1.f / r.dir[k];
+    d.tmin = r.tmin;
+    return d;
+}
+
+// Tests the ray against the four child boxes; returns the hit mask and
+// the entry distances.
+inline int hit_boxes(const BVHNode& n, const RayData& r, float tmax, float* tnear) {
+#if MY_GL_SSE2
+    __m128 t0 = _mm_set1_ps(r.tmin);
+    __m128 t1 = _mm_set1_ps(tmax);
+    for (int k = 0; k < 3; k++) {
+        __m128 o = _mm_set1_ps(r.org[k]);
+        __m128 inv = _mm_set1_ps(r.inv[k]);
+        __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.bmin[k]), o), inv);
+        __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.bmax[k]), o), inv);
+        t0 = _mm_max_ps(t0, _mm_min_ps(a, b));
+        t1 = _mm_min_ps(t1, _mm_max_ps(a, b));
+    }
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        float t0 = r.tmin, t1 = tmax;
+        for (int k = 0; k < 3; k++) {
+            float a = (n.bmin[k][i] - r.org[k]) * r.inv[k];
+            float b = (n.bmax[k][i] - r.org[k]) * r.inv[k];
+            t0 = std::max(t0, std::min(a, b));
+            t1 = std::min(t1, std::max(a, b));
+        }
+        tnear[i] = t0;
+        if (t0 <= t1) mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+// The fixed stack covers any reasonable tree; a degenerate, deeper one
+// gets a heap stack sized from its depth instead of dropping nodes.
+inline int* traversal_stack(int* local, std::vector<int>& heap, int size) {
+    if (size <= STACK_SIZE) return local;
+    heap.resize(size);
+    return heap.data();
+}
+
+// Orders up to four child slots by decreasing distance.
+inline void sort_far_first(int* slot, int n, const float* dist) {
+    for (int i = 1; i < n; i++) {
+        int s = slot[i];
+        int j = i;
+        for (; j > 0 && dist[slot[j - 1]] < dist[s]; j--) slot[j] = slot[j - 1];
+        slot[j] = s;
+    }
+}
+
+} // namespace
+
+
+BVH::BVH(Model& model) : build_time_ms(0.0), stack_size(0) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    int n = model.nfaces();
+    std::vector<BuildRef> refs(n);
+    parallel_for(0, n, 4096, [&](int lo, int hi) {
+        for (int i = lo; i < hi; i++) {
+            BuildRef& r = refs[i];
+            r.box = Aabb();
+            for (int j = 0; j < 3; j++) r.box.grow(model.vert(i, j));
+            r.c = (r.box.lo + r.box.hi) * 0.5f;
+            r.face = i;
+        }
+    });
+
+    std::vector<BuildNode> bin;
+    if (n > 0) {
+        int nthreads = ThreadPool::global().size();
+        if (nthreads > 1 && n >= 8192) {
+            std::vector<Pending> pending;
+            build_node(refs, bin, 0, n, &pending, std::max(1024, n / (nthreads * 4)));
+
+            std::vector<std::vector<BuildNode>> sub(pending.size());
+            parallel_for(0, (int)pending.size(), 1, [&](int lo, int hi) {
+                for (int i = lo; i < hi; i++) {
+                    build_node(refs, sub[i], pending[i].first, pending[i].count, NULL, 0);
+                }
+            });
+
+            // Splice each subtree in place of its placeholder node.
+            for (size_t i = 0; i < pending.size(); i++) {
+                int base = (int)bin.size() - 1;
+                for (size_t j = 0; j < sub[i].size(); j++) {
+                    BuildNode b = sub[i][j];
+                    if (b.left >= 0) {
+                        b.left += base;
+                        b.right += base;
+                    }
+                    if (j == 0) bin[pending[i].node] = b;
+                    else bin.push_back(b);
+                }
+            }
+        }
+        else {
+            build_node(refs, bin, 0, n, NULL, 0);
+        }
+        nodes.reserve(bin.size() / 2 + 1);
+        collapse(bin, 0, nodes);
+    }
+
+    // Nodes are flattened depth-first, so parents come before children.
+    std::vector<int> depth(nodes.size(), 0);
+    int max_depth = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        max_depth = std::max(max_depth, depth[i]);
+        for (int k = 0; k < 4; k++) {
+            if (nodes[i].count[k] == 0) depth[nodes[i].child[k]] = depth[i] + 1;
+        }
+    }
+    stack_size = 3 * max_depth + 4;
+
+    tris.resize(n);
+    faces.resize(n);
+    parallel_for(0, n, 4096, [&](int lo, int hi) {
+        for (int i = lo; i < hi; i++) {
+            int f = refs[i].face;
+            Vec3f a = model.vert(f, 0);
+            tris[i].v0 = a;
+            tris[i].e1 = model.vert(f, 1) - a;
+            tris[i].e2 = model.vert(f, 2) - a;
+            faces[i] = f;
+        }
+    });
+
+    build_time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+// Moller-Trumbore.
+static inline bool hit_triangle(const Vec3f& v0, const Vec3f& e1, const Vec3f& e2,
+    const Vec3f& org, const Vec3f& dir, float tmin, float tmax, float& t, float& u, float& v) {
+    Vec3f p = cross(dir, e2);
+    float det = e1 * p;
+    if (std::abs(det) < 1e-12f) return false;
+    float inv = 1.f / det;
+    Vec3f s = org - v0;
+    u = (s * p) * inv;
+    if (u < 0.f || u > 1.f) return false;
+    Vec3f q = cross(s, e1);
+    v = (dir * q) * inv;
+    if (v < 0.f || u + v > 1.f) return false;
+    t = (e2 * q) * inv;
+    return t > tmin && t < tmax;
+}
+
+bool BVH::intersect(const Ray& ray, Hit& hit) const {
+    hit = Hit();
+    hit.t = ray.tmax;
+    if (nodes.empty()) return false;
+
+    RayData r = prepare(ray);
+    int local[STACK_SIZE];
+    std::vector<int> heap;
+    int* stack = traversal_stack(local, heap, stack_size);
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const BVHNode& node = nodes[stack[--sp]];
+        float tnear[4];
+        int mask = hit_boxes(node, r, hit.t, tnear);
+
+        int inner[4];
+        int ninner = 0;
+        for (int i = 0; i < 4; i++) {
+            if (!(mask & (1 << i)) || node.count[i] < 0) continue;
+            if (node.count[i] == 0) {
+                inner[ninner++] = i;
+                continue;
+            }
+            for (int j = node.child[i]; j < node.child[i] + node.count[i]; j++) {
+                float t, u, v;
+                if (hit_triangle(tris[j].v0, tris[j].e1, tris[j].e2, r.org, r.dir, r.tmin, hit.t, t, u, v)) {
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.face = faces[j];
+                }
+            }
+        }
+        // Push far children first so the nearest one is popped next.
+        sort_far_first(inner, ninner, tnear);
+        for (int i = 0; i < ninner; i++) stack[sp++] = node.child[inner[i]];
+    }
+    return hit.face >= 0;
+}
+
+void BVH::intersect(const Ray* rays, Hit* hits) const {
+    RayData r[PACKET_SIZE];
+    for (int k = 0; k < PACKET_SIZE; k++) {
+        hits[k] = Hit();
+        hits[k].t = rays[k].tmax;
+        r[k] = prepare(rays[k]);
+    }
+    if (nodes.empty()) return;
+
+    // Stack entries carry the mask of rays that entered the node.
+    int local_stack[STACK_SIZE];
+    int local_active[STACK_SIZE];
+    std::vector<int> heap_stack, heap_active;
+    int* stack = traversal_stack(local_stack, heap_stack, stack_size);
+    int* active = traversal_stack(local_active, heap_active, stack_size);
+    int sp = 0;
+    stack[sp] = 0;
+    active[sp++] = (1 << PACKET_SIZE) - 1;
+    while (sp > 0) {
+        --sp;
+        const BVHNode& node = nodes[stack[sp]];
+        int rays_in = active[sp];
+
+        int child_rays[4] = { 0, 0, 0, 0 };
+        float nearest[4] = { BIG, BIG, BIG, BIG };
+        for (int k = 0; k < PACKET_SIZE; k++) {
+            if (!(rays_in & (1 << k))) continue;
+            float tnear[4];
+            int mask = hit_boxes(node, r[k], hits[k].t, tnear);
+            for (int i = 0; i < 4; i++) {
+                if (!(mask & (1 << i))) continue;
+                child_rays[i] |= 1 << k;
+                nearest[i] = std::min(nearest[i], tnear[i]);
+            }
+        }
+
+        int inner[4];
+        int ninner = 0;
+        for (int i = 0; i < 4; i++) {
+            if (!child_rays[i] || node.count[i] < 0) continue;
+            if (node.count[i] == 0) {
+                inner[ninner++] = i;
+                continue;
+            }
+            for (int j = node.child[i]; j < node.child[i] + node.count[i]; j++) {
+                for (int k = 0; k < PACKET_SIZE; k++) {
+                    if (!(child_rays[i] & (1 << k))) continue;
+                    float t, u, v;
+                    if (hit_triangle(tris[j].v0, tris[j].e1, tris[j].e2, r[k].org, r[k].dir, r[k].tmin, hits[k].t, t, u, v)) {
+                        hits[k].t = t;
+                        hits[k].u = u;
+                        hits[k].v = v;
+                        hits[k].face = faces[j];
+                    }
+                }
+            }
+        }
+        sort_far_first(inner, ninner, nearest);
+        for (int i = 0; i < ninner; i++) {
+            stack[sp] = node.child[inner[i]];
+            active[sp++] = child_rays[inner[i]];
+        }
+    }
+}
+
+bool BVH::occluded(const Ray& ray) const {
+    if (nodes.empty()) return false;
+
+    RayData r = prepare(ray);
+    int local[STACK_SIZE];
+    std::vector<int> heap;
+    int* stack = traversal_stack(local, heap, stack_size);
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const BVHNode& node = nodes[stack[--sp]];
+        float tnear[4];
+        int mask = hit_boxes(node, r, ray.tmax, tnear);
+        for (int i = 0; i < 4; i++) {
+            if (!(mask & (1 << i)) || node.count[i] < 0) continue;
+            if (node.count[i] == 0) {
+                stack[sp++] = node.child[i];
+                continue;
+            }
+            for (int j = node.child[i]; j < node.child[i] + node.count[i]; j++) {
+                float t, u, v;
+                if (hit_triangle(tris[j].v0, tris[j].e1, tris[j].e2, r.org, r.dir, r.tmin, ray.tmax, t, u, v))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+void BVH::print_stats(std::ostream& out) const {
+    out << "bvh: " << tris.size() << " triangles, " << nodes.size() << " nodes ("
+        << (nodes.size() * sizeof(BVHNode) + tris.size() * (sizeof(Triangle) + sizeof(int))) / 1024
+        << " KB), built in " << build_time_ms << " ms\n";
+}
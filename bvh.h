@@ -0,0 +1,82 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include <iostream>
+#include "geometry.h"
+#include "model.h"
+
+struct Ray {
+    Vec3f org;
+    Vec3f dir;
+    float tmin;
+    float tmax;
+
+    Ray() : org(), dir(0.f, 0.f, 1.f), tmin(0.f), tmax(1e30f) {}
+    Ray(const Vec3f& o, const Vec3f& d, float t0 = 0.f, float t1 = 1e30f)
+        : org(o), dir(d), tmin(t0), tmax(t1) {}
+};
+
+// face is the Model face index, -1 on a miss. u, v weight vertices 1 and 2
+// of the face (vertex 0 gets 1 - u - v).
+struct Hit {
+    float t;
+    int   face;
+    float u;
+    float v;
+
+    Hit() : t(1e30f), face(-1), u(0.f), v(0.f) {}
+};
+
+// 4-wide node. Child bounds are stored SoA so one SSE op tests a ray
+// against all four boxes. count > 0 marks a leaf slot holding triangles
+// [child, child + count), 0 an inner node, -1 an unused slot.
+struct BVHNode {
+    float bmin[3][4];
+    float bmax[3][4];
+    int   child[4];
+    int   count[4];
+};
+
+// Bounding volume hierarchy over the triangles of a Model, in model space.
+// Built with binned SAH into a binary tree (the top levels split
+// sequentially, the subtrees below in parallel), then collapsed into
+// 4-wide nodes flattened depth-first, with triangles reordered to match
+// the leaves. The triangles are copied, the model is not referenced after
+// construction.
+class BVH {
+public:
+    static const int PACKET_SIZE = 4;
+
+    explicit BVH(Model& model);
+
+    // Closest hit within [ray.tmin, ray.tmax].
+    bool intersect(const Ray& ray, Hit& hit) const;
+    // Closest hits of PACKET_SIZE rays traversed together. Works for any
+    // rays but pays off when they are coherent (neighbouring pixels).
+    void intersect(const Ray* rays, Hit* hits) const;
+    // True as soon as anything blocks the ray (shadow / occlusion rays).
+    bool occluded(const Ray& ray) const;
+
+    int    nnodes() const { return (int)nodes.size(); }
+    int    ntriangles() const { return (int)faces.size(); }
+    double build_ms() const { return build_time_ms; }
+    void   print_stats(std::ostream& out) const;
+
+private:
+    struct Triangle {
+        Vec3f v0;
+        Vec3f e1;
+        Vec3f e2;
+    };
+
+    std::vector<BVHNode>  nodes;
+    std::vector<Triangle> tris;
+    std::vector<int>      faces;    // triangle -> Model face
+    double                build_time_ms;
+    // Entries a traversal can have pending at once: up to three siblings
+    // per level above the node being visited, plus its own four children.
+    int                   stack_size;
+};
+
+#endif // __BVH_H__
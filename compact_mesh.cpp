@@ -0,0 +1,164 @@
+#include <cmath>
+#include <algorithm>
+#include "compact_mesh.h"
+
+namespace {
+
+uint16_t quantize_unorm16(float v, float lo, float scale) {
+    if (scale == 0.f) return 0;
+    float q = (v - lo) / scale + 0.5f;
+    return (uint16_t)std::max(0.f, std::min(65535.f, q));
+}
+
+int16_t quantize_snorm16(float v) {
+    float q = std::max(-1.f, std::min(1.f, v)) * 32767.f;
+    return (int16_t)(q < 0.f ? q - 0.5f : q + 0.5f);
+}
+
+// Octahedral mapping: the unit sphere projected onto |x| + |y| + |z| = 1,
+// the lower half folded over the diagonals into the square.
+void encode_oct(Vec3f n, int16_t* out) {
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0.f) {
+        n = Vec3f(0.f, 0.f, 1.f);
+        l1 = 1.f;
+    }
+    float x = n.x / l1, y = n.y / l1;
+    if (n.z < 0.f) {
+        float fx = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+    out[0] = quantize_snorm16(x);
+    out[1] = quantize_snorm16(y);
+}
+
+// Not unit length: the point on the octahedron.
+Vec3f decode_oct(const int16_t* in) {
+    float x = in[0] * (1.f / 32767.f), y = in[1] * (1.f / 32767.f);
+    float z = 1.f - std::abs(x) - std::abs(y);
+    float t = std::max(-z, 0.f);
+    x += x >= 0.f ? -t : t;
+    y += y >= 0.f ? -t : t;
+    return Vec3f(x, y, z);
+}
+
+struct CornerKey {
+    int v, t, n;
+    int corner;
+
+    bool operator<(const CornerKey& o) const {
+        if (v != o.v) return v < o.v;
+        if (t != o.t) return t < o.t;
+        return n < o.n;
+    }
+    bool same(const CornerKey& o) const { return v == o.v && t == o.t && n == o.n; }
+};
+
+} // namespace
+
+CompactMesh::CompactMesh()
+    : pos_lo(), pos_scale(), uv_lo(), uv_scale(), vertices(), corners(), error_() {
+}
+
+void CompactMesh::build(const std::vector<Vec3f>& verts, const std::vector<Vec3f>& norms,
+    const std::vector<Vec2f>& uvs, const std::vector<std::vector<int>>& faces,
+    const std::vector<std::vector<int>>& uv_idx, const std::vector<std::vector<int>>& norm_idx) {
+    vertices.clear();
+    corners.assign(faces.size() * 3, 0);
+    error_ = QuantizationError();
+
+    // Welds the corners that share all three indices into one vertex.
+    std::vector<CornerKey> keys(faces.size() * 3);
+    for (size_t f = 0; f < faces.size(); f++) {
+        for (int j = 0; j < 3; j++) {
+            CornerKey& k = keys[f * 3 + j];
+            k.v = faces[f][j];
+            k.t = uv_idx[f][j] >= 0 && uv_idx[f][j] < (int)uvs.size() ? uv_idx[f][j] : -1;
+            k.n = norm_idx[f][j] >= 0 && norm_idx[f][j] < (int)norms.size() ? norm_idx[f][j] : -1;
+            k.corner = (int)(f * 3 + j);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    Vec3f plo(0.f, 0.f, 0.f), phi(0.f, 0.f, 0.f);
+    for (size_t i = 0; i < verts.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            plo[k] = i ? std::min(plo[k], verts[i][k]) : verts[i][k];
+            phi[k] = i ? std::max(phi[k], verts[i][k]) : verts[i][k];
+        }
+    }
+    Vec2f tlo(0.f, 0.f), thi(0.f, 0.f);
+    for (size_t i = 0; i < uvs.size(); i++) {
+        for (int k = 0; k < 2; k++) {
+            tlo[k] = i ? std::min(tlo[k], uvs[i][k]) : uvs[i][k];
+            thi[k] = i ? std::max(thi[k], uvs[i][k]) : uvs[i][k];
+        }
+    }
+    pos_lo = plo;
+    uv_lo = tlo;
+    for (int k = 0; k < 3; k++) pos_scale[k] = (phi[k] - plo[k]) / 65535.f;
+    for (int k = 0; k < 2; k++) uv_scale[k] = (thi[k] - tlo[k]) / 65535.f;
+    error_.bbox_diag = (phi - plo).norm();
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        const CornerKey& k = keys[i];
+        if (i == 0 || !k.same(keys[i - 1])) {
+            Vec3f p = verts[k.v];
+            Vec3f n = k.n >= 0 ? norms[k.n] : Vec3f(0.f, 0.f, 1.f);
+            Vec2f t = k.t >= 0 ? uvs[k.t] : Vec2f(0.f, 0.f);
+            PackedVertex pv;
+            for (int c = 0; c < 3; c++) pv.pos[c] = quantize_unorm16(p[c], pos_lo[c], pos_scale[c]);
+            for (int c = 0; c < 2; c++) pv.uv[c] = quantize_unorm16(t[c], uv_lo[c], uv_scale[c]);
+            encode_oct(n, pv.oct);
+            vertices.push_back(pv);
+
+            int v = (int)vertices.size() - 1;
+            error_.position = std::max(error_.position, (position(v) - p).norm());
+            Vec2f du = uv(v) - t;
+            error_.uv = std::max(error_.uv, std::max(std::abs(du.x), std::abs(du.y)));
+            if (n.norm() > 0.f) {
+                // atan2 keeps small angles that acos of a float would lose.
+                Vec3f u = Vec3f(n).normalize(), d = normal(v);
+                float a = std::atan2(cross(u, d).norm(), u * d);
+                error_.normal_deg = std::max(error_.normal_deg, a * 57.29578f);
+            }
+        }
+        corners[k.corner] = (uint32_t)(vertices.size() - 1);
+    }
+    // bytes() reports capacity, so drop the growth slack.
+    vertices.shrink_to_fit();
+}
+
+size_t CompactMesh::bytes() const {
+    return vertices.capacity() * sizeof(PackedVertex) + corners.capacity() * sizeof(uint32_t);
+}
+
+Vec3f CompactMesh::position(int v) const {
+    const uint16_t* q = vertices[v].pos;
+    return Vec3f(pos_lo.x + q[0] * pos_scale.x, pos_lo.y + q[1] * pos_scale.y, pos_lo.z + q[2] * pos_scale.z);
+}
+
+Vec3f CompactMesh::normal(int v) const {
+    return decode_oct(vertices[v].oct).normalize();
+}
+
+Vec2f CompactMesh::uv(int v) const {
+    const uint16_t* q = vertices[v].uv;
+    return Vec2f(uv_lo.x + q[0] * uv_scale.x, uv_lo.y + q[1] * uv_scale.y);
+}
+
+void CompactMesh::decode_faces(const int* faces, int n, Vec3f* pos, Vec3f* nrm, Vec2f* uvs) const {
+    for (int i = 0; i < n; i++) {
+        const uint32_t* c = &corners[(size_t)faces[i] * 3];
+        for (int j = 0; j < 3; j++) {
+            const PackedVertex& pv = vertices[c[j]];
+            int k = i * 3 + j;
+            pos[k] = Vec3f(pos_lo.x + pv.pos[0] * pos_scale.x, pos_lo.y + pv.pos[1] * pos_scale.y,
+                pos_lo.z + pv.pos[2] * pos_scale.z);
+            nrm[k] = decode_oct(pv.oct);
+            uvs[k] = Vec2f(uv_lo.x + pv.uv[0] * uv_scale.x, uv_lo.y + pv.uv[1] * uv_scale.y);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef __COMPACT_MESH_H__
+#define __COMPACT_MESH_H__
+
+#include <stdint.h>
+#include <vector>
+#include "geometry.h"
+
+// Quantized face corners, 14 bytes per unique (position, uv, normal)
+// triple against 32 as floats:
+//   position  3 x 16 bits over the mesh bounding box
+//   normal    octahedral, 2 x 16-bit snorm
+//   uv        2 x 16 bits over the uv bounding box
+// plus one 32-bit index per face corner instead of the three index
+// vectors of each face.
+struct PackedVertex {
+    uint16_t pos[3];
+    int16_t  oct[2];
+    uint16_t uv[2];
+};
+
+// Largest decoding error over the mesh, measured when it is built.
+struct QuantizationError {
+    float position;    // model units
+    float bbox_diag;   // for scale
+    float normal_deg;
+    float uv;          // uv units
+};
+
+class CompactMesh {
+public:
+    CompactMesh();
+
+    // Faces are triangles of indices into verts, uvs and norms; negative or
+    // out-of-range uv and normal indices get (0, 0) and (0, 0, 1).
+    void build(const std::vector<Vec3f>& verts, const std::vector<Vec3f>& norms,
+        const std::vector<Vec2f>& uvs, const std::vector<std::vector<int>>& faces,
+        const std::vector<std::vector<int>>& uv_idx, const std::vector<std::vector<int>>& norm_idx);
+
+    bool   empty() const { return vertices.empty(); }
+    int    nverts() const { return (int)vertices.size(); }
+    int    nfaces() const { return (int)(corners.size() / 3); }
+    size_t bytes() const;
+    const QuantizationError& error() const { return error_; }
+
+    int   corner(int iface, int nthvert) const { return (int)corners[iface * 3 + nthvert]; }
+    Vec3f position(int v) const;
+    Vec3f normal(int v) const;
+    Vec2f uv(int v) const;
+
+    // The three corners of each of n faces into pos, nrm and uv (3n
+    // entries each), in one pass. The normals are left unnormalized for
+    // the vertex shader, which normalizes after transforming them.
+    void decode_faces(const int* faces, int n, Vec3f* pos, Vec3f* nrm, Vec2f* uv) const;
+
+private:
+    Vec3f                     pos_lo;
+    Vec3f                     pos_scale;
+    Vec2f                     uv_lo;
+    Vec2f                     uv_scale;
+    std::vector<PackedVertex> vertices;
+    std::vector<uint32_t>     corners;
+    QuantizationError         error_;
+};
+
+#endif // __COMPACT_MESH_H__
@@ -0,0 +1,289 @@
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include "frame_stream.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <stdio.h>
+#else
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+PipeStream::PipeStream(Format format_, int w, int h, int fps_)
+    : format(format_), width(w), height(h), fps(fps_), out(NULL) {
+}
+
+bool PipeStream::open(const std::string& path) {
+#ifndef _WIN32
+    // A reader closing the pipe fails the write instead.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        out = &std::cout;
+    }
+    else {
+        file.open(path.c_str(), std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "can't open " << path << "\n";
+            return false;
+        }
+        out = &file;
+    }
+    if (format == Y4M) {
+        *out << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+    }
+    return out->good();
+}
+
+// BT.601 limited range in 8-bit fixed point; chroma is the average of
+// each 2x2 block (or the part of it inside the frame).
+static void to_y4m(const Framebuffer& frame, std::vector<unsigned char>& out) {
+    int w = frame.width(), h = frame.height();
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    static const char tag[] = "FRAME\n";
+    out.resize(6 + (size_t)w * h + (size_t)cw * ch * 2);
+    memcpy(out.data(), tag, 6);
+    unsigned char* Y = out.data() + 6;
+    unsigned char* U = Y + (size_t)w * h;
+    unsigned char* V = U + (size_t)cw * ch;
+
+    for (int cy = 0; cy < ch; cy++) {
+        for (int cx = 0; cx < cw; cx++) {
+            int su = 0, sv = 0, n = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                int ty = cy * 2 + dy;    // top-down row
+                if (ty >= h) break;
+                const uint32_t* src = frame.row(frame.y0() + h - 1 - ty);
+                for (int dx = 0; dx < 2; dx++) {
+                    int x = cx * 2 + dx;
+                    if (x >= w) break;
+                    int b = src[x] & 0xff, g = (src[x] >> 8) & 0xff, r = (src[x] >> 16) & 0xff;
+                    Y[(size_t)ty * w + x] = (unsigned char)((66 * r + 129 * g + 25 * b + 128 + (16 << 8)) >> 8);
+                    su += -38 * r - 74 * g + 112 * b;
+                    sv += 112 * r - 94 * g - 18 * b;
+                    n++;
+                }
+            }
+            U[(size_t)cy * cw + cx] = (unsigned char)(((su / n) + 128 + (128 << 8)) >> 8);
+            V[(size_t)cy * cw + cx] = (unsigned char)(((sv / n) + 128 + (128 << 8)) >> 8);
+        }
+    }
+}
+
+static void to_rgb24(const Framebuffer& frame, std::vector<unsigned char>& out) {
+    int w = frame.width(), h = frame.height();
+    out.resize((size_t)w * h * 3);
+    unsigned char* dst = out.data();
+    for (int y = h - 1; y >= 0; y--) {
+        const uint32_t* src = frame.row(frame.y0() + y);
+        for (int x = 0; x < w; x++, dst += 3) {
+            dst[0] = (unsigned char)(src[x] >> 16);
+            dst[1] = (unsigned char)(src[x] >> 8);
+            dst[2] = (unsigned char)src[x];
+        }
+    }
+}
+
+bool PipeStream::write(const Framebuffer& frame) {
+    TRACE_SCOPE("stream_frame", format == Y4M ? "y4m" : "rgb");
+    // Once the reader is gone every later frame fails quietly.
+    if (!out || !out->good() || frame.width() != width || frame.height() != height) return false;
+    if (format == Y4M) to_y4m(frame, bytes);
+    else to_rgb24(frame, bytes);
+    out->write((const char*)bytes.data(), (std::streamsize)bytes.size());
+    out->flush();
+    if (!out->good()) {
+        std::cerr << "frame stream closed\n";
+        return false;
+    }
+    return true;
+}
+
+
+#ifndef _WIN32
+
+static size_t ring_header_bytes(int nslots) {
+    size_t n = sizeof(ShmRingHeader) + (size_t)(nslots - 1) * sizeof(std::atomic<uint64_t>);
+    return (n + 63) / 64 * 64;
+}
+
+ShmRingStream::ShmRingStream()
+    : mapping(NULL), mapping_bytes(0), header(NULL), frames(0) {
+}
+
+ShmRingStream::~ShmRingStream() {
+    if (mapping) {
+        munmap(mapping, mapping_bytes);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool ShmRingStream::open(const std::string& name_, int w, int h, int nslots) {
+    name = name_;
+    uint64_t slot_bytes = ((uint64_t)w * h * 4 + 63) / 64 * 64;
+    size_t offset = ring_header_bytes(nslots);
+    mapping_bytes = offset + (size_t)(slot_bytes * nslots);
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        std::cerr << "can't create shared memory " << name << "\n";
+        return false;
+    }
+    if (ftruncate(fd, (off_t)mapping_bytes) < 0) {
+        std::cerr << "can't size shared memory " << name << "\n";
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    mapping = mmap(NULL, mapping_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        std::cerr << "can't map shared memory " << name << "\n";
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // The object is zero-filled, so every seq and latest start at 0; the
+    // magic goes in last so a reader never sees a half-written header.
+    header = (ShmRingHeader*)mapping;
+    header->version = ShmRingHeader::VERSION;
+    header->width = (uint32_t)w;
+    header->height = (uint32_t)h;
+    header->nslots = (uint32_t)nslots;
+    header->slot_bytes = slot_bytes;
+    header->slot_offset = offset;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ShmRingHeader::MAGIC;
+    return true;
+}
+
+bool ShmRingStream::write(const Framebuffer& frame) {
+    TRACE_SCOPE("stream_frame", "shm");
+    if (!header || frame.width() != (int)header->width || frame.height() != (int)header->height) {
+        return false;
+    }
+    int w = frame.width(), h = frame.height();
+
+    uint64_t n = ++frames;
+    uint32_t slot = (uint32_t)(n % header->nslots);
+    header->seq[slot].store(2 * n - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t* dst = (uint32_t*)((unsigned char*)mapping + header->slot_offset + slot * header->slot_bytes);
+    for (int y = 0; y < h; y++) {
+        memcpy(dst + (size_t)y * w, frame.row(frame.y0() + h - 1 - y), (size_t)w * 4);
+    }
+
+    header->seq[slot].store(2 * n, std::memory_order_release);
+    header->latest.store(n, std::memory_order_release);
+    return true;
+}
+
+
+ShmRingReader::ShmRingReader() : mapping(NULL), mapping_bytes(0), header(NULL) {
+}
+
+ShmRingReader::~ShmRingReader() {
+    if (mapping) munmap(mapping, mapping_bytes);
+}
+
+bool ShmRingReader::open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "no shared memory " << name << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+        std::cerr << "shared memory " << name << " is not a frame ring\n";
+        close(fd);
+        return false;
+    }
+    mapping_bytes = (size_t)st.st_size;
+    mapping = mmap(NULL, mapping_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        std::cerr << "can't map shared memory " << name << "\n";
+        return false;
+    }
+    const ShmRingHeader* hdr = (const ShmRingHeader*)mapping;
+    bool valid = hdr->magic == ShmRingHeader::MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!valid || hdr->version != ShmRingHeader::VERSION ||
+        mapping_bytes < hdr->slot_offset + hdr->slot_bytes * hdr->nslots) {
+        std::cerr << "shared memory " << name << " is not a frame ring\n";
+        return false;
+    }
+    header = (ShmRingHeader*)mapping;
+    return true;
+}
+
+uint64_t ShmRingReader::read(uint64_t after, std::vector<uint32_t>& pixels) const {
+    uint64_t n = header->latest.load(std::memory_order_acquire);
+    if (n <= after) return 0;
+    uint32_t slot = (uint32_t)(n % header->nslots);
+    uint64_t seq = header->seq[slot].load(std::memory_order_acquire);
+    if (seq != 2 * n) return 0;
+
+    size_t npixels = (size_t)header->width * header->height;
+    pixels.resize(npixels);
+    memcpy(pixels.data(), (const unsigned char*)mapping + header->slot_offset + slot * header->slot_bytes,
+        npixels * 4);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->seq[slot].load(std::memory_order_relaxed) == seq ? n : 0;
+}
+
+#else
+
+ShmRingStream::ShmRingStream()
+    : mapping(NULL), mapping_bytes(0), header(NULL), frames(0) {
+}
+
+ShmRingStream::~ShmRingStream() {
+}
+
+bool ShmRingStream::open(const std::string& name_, int w, int h, int nslots) {
+    std::cerr << "shared memory streams are not supported on this platform (" << name_ << ")\n";
+    return false;
+}
+
+bool ShmRingStream::write(const Framebuffer& frame) {
+    return false;
+}
+
+ShmRingReader::ShmRingReader() : mapping(NULL), mapping_bytes(0), header(NULL) {
+}
+
+ShmRingReader::~ShmRingReader() {
+}
+
+bool ShmRingReader::open(const std::string& name) {
+    std::cerr << "shared memory streams are not supported on this platform (" << name << ")\n";
+    return false;
+}
+
+uint64_t ShmRingReader::read(uint64_t after, std::vector<uint32_t>& pixels) const {
+    return 0;
+}
+
+#endif
+
+int ShmRingReader::width() const {
+    return header ? (int)header->width : 0;
+}
+
+int ShmRingReader::height() const {
+    return header ? (int)header->height : 0;
+}
@@ -0,0 +1,115 @@
+#ifndef __FRAME_STREAM_H__
+#define __FRAME_STREAM_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "framebuffer.h"
+
+// Destination for a sequence of same-size frames, for encoders and live
+// viewers that would otherwise read back one image file per frame. Frames
+// are passed as rendered (bottom-up); streams send them top row first.
+class FrameStream {
+public:
+    virtual ~FrameStream() {}
+    virtual bool write(const Framebuffer& frame) = 0;
+};
+
+// YUV4MPEG2 (4:2:0, BT.601 limited range, what ffmpeg and x264 read from
+// a pipe) or headerless RGB24 to a file, a named pipe or stdout ("-").
+// Opening a named pipe blocks until a reader opens it; a reader that goes
+// away makes write() fail instead of killing the process.
+class PipeStream : public FrameStream {
+public:
+    enum Format { Y4M, RGB24 };
+
+    PipeStream(Format format, int w, int h, int fps = 30);
+
+    bool open(const std::string& path);
+    virtual bool write(const Framebuffer& frame);
+
+private:
+    Format                     format;
+    int                        width;
+    int                        height;
+    int                        fps;
+    std::ofstream              file;
+    std::ostream*              out;
+    std::vector<unsigned char> bytes;
+};
+
+
+// Layout of the shared-memory ring. The header is followed by nslots
+// slots of slot_bytes, each a frame of width x height BGRA pixels, top row
+// first, rows packed.
+//
+// Frame n (from 1) goes to slot n % nslots. The writer sets the slot's seq
+// to 2n - 1 while copying and to 2n when done, then publishes n in latest;
+// it never waits for readers. A reader loads latest, checks that the slot
+// seq is 2 * latest, uses the pixels in place and checks the seq again:
+// if it changed, the writer lapped the reader and the frame is torn.
+// Readers that fall behind skip frames.
+struct ShmRingHeader {
+    static const uint32_t MAGIC = 0x3342414c;    // "LAB3" in memory
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t nslots;
+    uint32_t pad;
+    uint64_t slot_bytes;
+    uint64_t slot_offset;    // from the start of the mapping
+    std::atomic<uint64_t> latest;
+    std::atomic<uint64_t> seq[1];    // nslots entries
+};
+
+// Publishes frames to a POSIX shared-memory object (shm_open) named name,
+// e.g. "/lab3". The object is removed when the stream is destroyed.
+// Not available on Windows.
+class ShmRingStream : public FrameStream {
+public:
+    ShmRingStream();
+    ~ShmRingStream();
+
+    bool open(const std::string& name, int w, int h, int nslots = 4);
+    virtual bool write(const Framebuffer& frame);
+
+private:
+    ShmRingStream(const ShmRingStream&);
+    ShmRingStream& operator=(const ShmRingStream&);
+
+    std::string    name;
+    void*          mapping;
+    size_t         mapping_bytes;
+    ShmRingHeader* header;
+    uint64_t       frames;
+};
+
+// Consumer side of the ring, for viewers and for testing the protocol.
+class ShmRingReader {
+public:
+    ShmRingReader();
+    ~ShmRingReader();
+
+    bool open(const std::string& name);
+    int width() const;
+    int height() const;
+    // Copies the newest complete frame newer than after into pixels
+    // (width x height BGRA, top row first) and returns its number, or 0 if
+    // there is none yet or it was overwritten while being read.
+    uint64_t read(uint64_t after, std::vector<uint32_t>& pixels) const;
+
+private:
+    ShmRingReader(const ShmRingReader&);
+    ShmRingReader& operator=(const ShmRingReader&);
+
+    void*          mapping;
+    size_t         mapping_bytes;
+    ShmRingHeader* header;
+};
+
+#endif // __FRAME_STREAM_H__
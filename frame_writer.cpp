@@ -0,0 +1,69 @@
+#include <iostream>
+#include "frame_writer.h"
+#include "frame_stream.h"
+#include "image_sink.h"
+#include "trace.h"
+
+FrameWriter::FrameWriter(FrameStream* stream_) : stream(stream_), back(), image(), back_name() {
+    worker = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return !busy; });
+        stop = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void FrameWriter::submit(const Framebuffer& frame, const std::string& filename) {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return !busy; });
+    if (!back || back->width() != frame.width() || back->height() != frame.height()) {
+        back.reset(new Framebuffer(frame.width(), frame.height()));
+    }
+    back->copy_from(frame);
+    back_name = filename;
+    busy = true;
+    lock.unlock();
+    cv.notify_all();
+}
+
+void FrameWriter::flush() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return !busy; });
+}
+
+bool FrameWriter::good() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return !failed;
+}
+
+void FrameWriter::run() {
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;) {
+        cv.wait(lock, [this] { return busy || stop; });
+        if (!busy && stop) break;
+
+        lock.unlock();
+        TRACE_BEGIN(span, "write_frame");
+        bool ok;
+        if (stream) {
+            ok = stream->write(*back);
+        }
+        else {
+            back->to_tga(image);
+            ok = write_image(image, back_name, true);
+            if (!ok) std::cerr << "can't write frame " << back_name << "\n";
+        }
+        TRACE_END(span);
+        lock.lock();
+
+        failed = failed || !ok;
+
+        busy = false;
+        cv.notify_all();
+    }
+}
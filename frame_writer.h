@@ -0,0 +1,47 @@
+#ifndef __FRAME_WRITER_H__
+#define __FRAME_WRITER_H__
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "tgaimage.h"
+#include "framebuffer.h"
+
+class FrameStream;
+
+// Background frame writer. submit() copies the finished frame into a back
+// buffer and returns, so conversion, encoding and writing of frame N-1 overlap with
+// rendering of frame N. Only one frame is ever in flight. The output format
+// follows the file extension (see make_sink); frames are passed bottom-up
+// and the encoder handles the flip. Given a stream, frames go to it
+// instead and the filename is ignored.
+class FrameWriter {
+public:
+    explicit FrameWriter(FrameStream* stream = nullptr);
+    ~FrameWriter();
+
+    void submit(const Framebuffer& frame, const std::string& filename);
+    // Blocks until the frame in flight has been written.
+    void flush();
+    // False once a frame could not be written.
+    bool good();
+
+private:
+    void run();
+
+    std::thread             worker;
+    std::mutex              mtx;
+    std::condition_variable cv;
+
+    FrameStream*                 stream;
+    std::unique_ptr<Framebuffer> back;
+    TGAImage                     image;
+    std::string back_name;
+    bool        busy = false;
+    bool        stop = false;
+    bool        failed = false;
+};
+
+#endif // __FRAME_WRITER_H__
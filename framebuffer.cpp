@@ -0,0 +1,169 @@
+#include <string.h>
+#include <algorithm>
+#include "framebuffer.h"
+#include "simd.h"
+
+static const int kAlign = 64;
+
+HDRBuffer::HDRBuffer(int w, int h)
+    : width_(w), height_(h), stride_(0), storage_(NULL), data_(NULL) {
+    stride_ = (w * 4 + kAlign / 4 - 1) / (kAlign / 4) * (kAlign / 4);
+    storage_ = new float[(size_t)stride_ * h + kAlign / 4];
+    data_ = storage_ + (kAlign - (size_t)storage_ % kAlign) % kAlign / sizeof(float);
+    clear();
+}
+
+HDRBuffer::~HDRBuffer() {
+    delete[] storage_;
+}
+
+void HDRBuffer::clear(float b, float g, float r, float a) {
+    const float c[4] = { b, g, r, a };
+    for (int y = 0; y < height_; y++) {
+        float* p = row(y);
+        for (int x = 0; x < width_; x++, p += 4) memcpy(p, c, sizeof(c));
+    }
+}
+
+
+Framebuffer::Framebuffer(int w, int h, int y0)
+    : width_(w), height_(h), y0_(y0), stride_(0), dstride_(0), storage_(NULL), color_(NULL), depth_(NULL),
+    hdr_(NULL) {
+    stride_ = (w + kAlign / 4 - 1) / (kAlign / 4) * (kAlign / 4);
+    dstride_ = (w + kAlign - 1) / kAlign * kAlign;
+    size_t color_bytes = (size_t)stride_ * 4 * h;
+    size_t depth_bytes = (size_t)dstride_ * h;
+    storage_ = new unsigned char[color_bytes + depth_bytes + kAlign];
+    unsigned char* base = storage_ + (kAlign - (size_t)storage_ % kAlign) % kAlign;
+    color_ = (uint32_t*)base;
+    depth_ = base + color_bytes;
+    clear();
+}
+
+Framebuffer::Framebuffer(Framebuffer&& other)
+    : width_(other.width_), height_(other.height_), y0_(other.y0_), stride_(other.stride_), dstride_(other.dstride_),
+    storage_(other.storage_), color_(other.color_), depth_(other.depth_), hdr_(other.hdr_) {
+    other.storage_ = NULL;
+    other.color_ = NULL;
+    other.depth_ = NULL;
+    other.hdr_ = NULL;
+    other.width_ = other.height_ = 0;
+}
+
+Framebuffer& Framebuffer::operator=(Framebuffer&& other) {
+    if (this != &other) {
+        release();
+        width_ = other.width_;
+        height_ = other.height_;
+        y0_ = other.y0_;
+        stride_ = other.stride_;
+        dstride_ = other.dstride_;
+        storage_ = other.storage_;
+        color_ = other.color_;
+        depth_ = other.depth_;
+        hdr_ = other.hdr_;
+        other.storage_ = NULL;
+        other.color_ = NULL;
+        other.depth_ = NULL;
+        other.hdr_ = NULL;
+        other.width_ = other.height_ = 0;
+    }
+    return *this;
+}
+
+Framebuffer::~Framebuffer() {
+    release();
+}
+
+void Framebuffer::release() {
+    if (storage_) delete[] storage_;
+    storage_ = NULL;
+    delete hdr_;
+    hdr_ = NULL;
+}
+
+void Framebuffer::enable_hdr() {
+    if (hdr_) return;
+    hdr_ = new HDRBuffer(width_, height_);
+}
+
+void Framebuffer::clear(uint32_t color, unsigned char depth) {
+    if (!storage_) return;
+    size_t n = (size_t)stride_ * height_;
+#if MY_GL_SSE2
+    __m128i c = _mm_set1_epi32((int)color);
+    __m128i* p = (__m128i*)color_;
+    for (size_t i = 0; i < n / 4; i++) _mm_store_si128(p + i, c);
+    __m128i d = _mm_set1_epi8((char)depth);
+    __m128i* q = (__m128i*)depth_;
+    for (size_t i = 0; i < (size_t)dstride_ * height_ / 16; i++) _mm_store_si128(q + i, d);
+#else
+    std::fill(color_, color_ + n, color);
+    memset(depth_, depth, (size_t)dstride_ * height_);
+#endif
+    if (hdr_) {
+        TGAColor c = unpack_color(color);
+        hdr_->clear(c[0] / 255.f, c[1] / 255.f, c[2] / 255.f, c[3] / 255.f);
+    }
+}
+
+void Framebuffer::blend_span(int x, int y, const uint32_t* src, int n, float alpha) {
+    uint32_t a = (uint32_t)(std::max(0.f, std::min(1.f, alpha)) * 256.f + 0.5f);
+    uint32_t* dst = row(y) + x;
+    int i = 0;
+#if MY_GL_SSE2
+    __m128i va = _mm_set1_epi16((short)a);
+    __m128i via = _mm_set1_epi16((short)(256 - a));
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), via),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va));
+        __m128i hi = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), via),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va));
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; i++) dst[i] = blend_packed(dst[i], src[i], a);
+}
+
+void Framebuffer::copy_from(const Framebuffer& other) {
+    if (!storage_ || !other.storage_) return;
+    memcpy(color_, other.color_, (size_t)stride_ * 4 * height_);
+    memcpy(depth_, other.depth_, (size_t)dstride_ * height_);
+}
+
+void Framebuffer::to_tga(TGAImage& out, int bpp) const {
+    if (out.get_width() != width_ || out.get_height() != height_ || out.get_bytespp() != bpp) {
+        out = TGAImage(width_, height_, bpp);
+    }
+    unsigned char* dst = out.buffer();
+    for (int y = 0; y < height_; y++) {
+        const uint32_t* src = row(y0_ + y);
+        if (bpp == TGAImage::RGBA) {
+            memcpy(dst, src, (size_t)width_ * 4);
+            dst += (size_t)width_ * 4;
+            continue;
+        }
+        for (int x = 0; x < width_; x++, dst += 3) {
+            uint32_t p = src[x];
+            dst[0] = (unsigned char)p;
+            dst[1] = (unsigned char)(p >> 8);
+            dst[2] = (unsigned char)(p >> 16);
+        }
+    }
+}
+
+void Framebuffer::depth_to_tga(TGAImage& out) const {
+    if (out.get_width() != width_ || out.get_height() != height_ || out.get_bytespp() != TGAImage::GRAYSCALE) {
+        out = TGAImage(width_, height_, TGAImage::GRAYSCALE);
+    }
+    for (int y = 0; y < height_; y++) {
+        memcpy(out.buffer() + (size_t)y * width_, depth_row(y0_ + y), width_);
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#include <stdint.h>
+#include "tgaimage.h"
+
+// Packs a color into the framebuffer layout: B, G, R, A from the lowest
+// byte up, the same byte order TGAImage uses.
+inline uint32_t pack_color(const TGAColor& c) {
+    return (uint32_t)c.bgra[0] | (uint32_t)c.bgra[1] << 8 |
+        (uint32_t)c.bgra[2] << 16 | (uint32_t)c.bgra[3] << 24;
+}
+
+inline TGAColor unpack_color(uint32_t p) {
+    return TGAColor((unsigned char)(p >> 16), (unsigned char)(p >> 8),
+        (unsigned char)p, (unsigned char)(p >> 24));
+}
+
+// Blends src over dst with an 8-bit weight a in [0, 256], two channels per
+// multiply.
+inline uint32_t blend_packed(uint32_t dst, uint32_t src, uint32_t a) {
+    uint32_t ia = 256 - a;
+    uint32_t rb = ((dst & 0x00ff00ffu) * ia + (src & 0x00ff00ffu) * a) >> 8;
+    uint32_t ag = ((dst >> 8) & 0x00ff00ffu) * ia + ((src >> 8) & 0x00ff00ffu) * a;
+    return (rb & 0x00ff00ffu) | (ag & 0xff00ff00u);
+}
+
+// Linear float color, four floats per pixel in B, G, R, A order like the
+// packed framebuffer, rows 64-byte aligned. Values are not clamped; the
+// post-processing chain maps them down to 8 bits.
+class HDRBuffer {
+public:
+    HDRBuffer(int w, int h);
+    ~HDRBuffer();
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    float* row(int y) { return data_ + (size_t)y * stride_; }
+    const float* row(int y) const { return data_ + (size_t)y * stride_; }
+
+    void clear(float b = 0.f, float g = 0.f, float r = 0.f, float a = 0.f);
+
+private:
+    HDRBuffer(const HDRBuffer&);
+    HDRBuffer& operator=(const HDRBuffer&);
+
+    int    width_;
+    int    height_;
+    int    stride_;     // in floats
+    float* storage_;
+    float* data_;
+};
+
+
+// Render target: packed 32-bit color plus an 8-bit depth plane, both with
+// rows padded to 64 bytes and 64-byte aligned. Unlike TGAImage there is no
+// per-pixel bounds check or format branch; callers stay inside width x
+// height. Convert with to_tga() when the frame is written out.
+//
+// A band holds only rows y0 .. y0 + h - 1 of a taller frame; row() and
+// depth_row() still take frame rows, so the rasterizer draws into it with
+// the band as its clip rectangle and frame-space vertices.
+class Framebuffer {
+public:
+    Framebuffer(int w, int h, int y0 = 0);
+    Framebuffer(Framebuffer&& other);
+    Framebuffer& operator=(Framebuffer&& other);
+    ~Framebuffer();
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int y0() const { return y0_; }
+    // Moves a band to start at frame row y0; the contents stay.
+    void set_y0(int y0) { y0_ = y0; }
+
+    uint32_t* row(int y) { return color_ + (size_t)(y - y0_) * stride_; }
+    const uint32_t* row(int y) const { return color_ + (size_t)(y - y0_) * stride_; }
+    unsigned char* depth_row(int y) { return depth_ + (size_t)(y - y0_) * dstride_; }
+    const unsigned char* depth_row(int y) const { return depth_ + (size_t)(y - y0_) * dstride_; }
+
+    // Adds a float color plane (indexed by band row, y - y0()); from then
+    // on triangle() shades into it
+    // (IShader::fragment_hdr) instead of the packed colors, which are only
+    // written when the HDR image is post-processed back down to 8 bits.
+    void enable_hdr();
+    HDRBuffer* hdr() { return hdr_; }
+    const HDRBuffer* hdr() const { return hdr_; }
+
+    // Clears the HDR plane too, if there is one.
+    void clear(uint32_t color = 0, unsigned char depth = 0);
+    // Blends n packed colors over row y starting at x with constant alpha.
+    void blend_span(int x, int y, const uint32_t* src, int n, float alpha);
+    // Same-size copy of color and depth.
+    void copy_from(const Framebuffer& other);
+
+    // Explicit conversion to an RGB or RGBA image for output.
+    void to_tga(TGAImage& out, int bpp = TGAImage::RGB) const;
+    void depth_to_tga(TGAImage& out) const;
+
+private:
+    Framebuffer(const Framebuffer&);
+    Framebuffer& operator=(const Framebuffer&);
+
+    void release();
+
+    int            width_;
+    int            height_;
+    int            y0_;
+    int            stride_;     // in pixels
+    int            dstride_;    // in bytes
+    unsigned char* storage_;
+    uint32_t*      color_;
+    unsigned char* depth_;
+    HDRBuffer*     hdr_;
+};
+
+#endif // __FRAMEBUFFER_H__
@@ -0,0 +1,297 @@
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include "image_sink.h"
+#include "trace.h"
+
+bool write_file(const std::string& filename, const std::vector<unsigned char>& bytes) {
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write((const char*)bytes.data(), (std::streamsize)bytes.size());
+    if (!out.good()) {
+        std::cerr << "can't write " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+static const unsigned char* row_ptr(TGAImage& img, int y, bool bottom_up) {
+    int row = bottom_up ? img.get_height() - 1 - y : y;
+    return img.buffer() + (size_t)row * img.get_width() * img.get_bytespp();
+}
+
+
+bool TgaSink::write(TGAImage& img, const std::string& filename, bool bottom_up) {
+    return img.write_tga_file(filename.c_str(), true, bottom_up);
+}
+
+
+bool PnmSink::write(TGAImage& img, const std::string& filename, bool bottom_up) {
+    int w = img.get_width(), h = img.get_height(), bpp = img.get_bytespp();
+    if (!img.buffer()) return false;
+
+    char header[160];
+    if (pam) {
+        const char* tupl = bpp == TGAImage::GRAYSCALE ? "GRAYSCALE" : (bpp == TGAImage::RGBA ? "RGB_ALPHA" : "RGB");
+        snprintf(header, sizeof(header), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+            w, h, bpp, tupl);
+    }
+    else {
+        snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", bpp == TGAImage::GRAYSCALE ? '5' : '6', w, h);
+    }
+    int out_bpp = (pam || bpp == TGAImage::GRAYSCALE) ? bpp : 3;
+
+    size_t hlen = strlen(header);
+    std::vector<unsigned char> bytes(hlen + (size_t)w * h * out_bpp);
+    memcpy(bytes.data(), header, hlen);
+    unsigned char* dst = bytes.data() + hlen;
+    for (int y = 0; y < h; y++) {
+        const unsigned char* src = row_ptr(img, y, bottom_up);
+        if (bpp == TGAImage::GRAYSCALE) {
+            memcpy(dst, src, w);
+            dst += w;
+            continue;
+        }
+        for (int x = 0; x < w; x++, src += bpp, dst += out_bpp) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            if (out_bpp == 4) dst[3] = src[3];
+        }
+    }
+    return write_file(filename, bytes);
+}
+
+
+static void put_u32_be(std::vector<unsigned char>& out, unsigned v) {
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+void QoiSink::encode(TGAImage& img, bool bottom_up, std::vector<unsigned char>& out) {
+    const unsigned char OP_INDEX = 0x00, OP_DIFF = 0x40, OP_LUMA = 0x80, OP_RUN = 0xc0;
+    const unsigned char OP_RGB = 0xfe, OP_RGBA = 0xff;
+
+    int w = img.get_width(), h = img.get_height(), bpp = img.get_bytespp();
+    int channels = bpp == TGAImage::RGBA ? 4 : 3;
+
+    out.clear();
+    out.reserve(14 + (size_t)w * h * (channels + 1) + 8);
+    out.push_back('q'); out.push_back('o'); out.push_back('i'); out.push_back('f');
+    put_u32_be(out, (unsigned)w);
+    put_u32_be(out, (unsigned)h);
+    out.push_back((unsigned char)channels);
+    out.push_back(0);
+
+    unsigned char index[64][4];
+    memset(index, 0, sizeof(index));
+    unsigned char prev[4] = { 0, 0, 0, 255 };
+    int run = 0;
+
+    for (int y = 0; y < h; y++) {
+        const unsigned char* src = row_ptr(img, y, bottom_up);
+        for (int x = 0; x < w; x++, src += bpp) {
+            unsigned char px[4];
+            if (bpp == TGAImage::GRAYSCALE) {
+                px[0] = px[1] = px[2] = src[0];
+                px[3] = 255;
+            }
+            else {
+                px[0] = src[2];
+                px[1] = src[1];
+                px[2] = src[0];
+                px[3] = bpp == TGAImage::RGBA ? src[3] : 255;
+            }
+
+            if (!memcmp(px, prev, 4)) {
+                run++;
+                if (run == 62) {
+                    out.push_back((unsigned char)(OP_RUN | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back((unsigned char)(OP_RUN | (run - 1)));
+                run = 0;
+            }
+
+            int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+            if (!memcmp(index[hash], px, 4)) {
+                out.push_back((unsigned char)(OP_INDEX | hash));
+            }
+            else {
+                memcpy(index[hash], px, 4);
+                if (px[3] == prev[3]) {
+                    signed char vr = (signed char)(px[0] - prev[0]);
+                    signed char vg = (signed char)(px[1] - prev[1]);
+                    signed char vb = (signed char)(px[2] - prev[2]);
+                    signed char vg_r = (signed char)(vr - vg);
+                    signed char vg_b = (signed char)(vb - vg);
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        out.push_back((unsigned char)(OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                    }
+                    else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                        out.push_back((unsigned char)(OP_LUMA | (vg + 32)));
+                        out.push_back((unsigned char)((vg_r + 8) << 4 | (vg_b + 8)));
+                    }
+                    else {
+                        out.push_back(OP_RGB);
+                        out.push_back(px[0]);
+                        out.push_back(px[1]);
+                        out.push_back(px[2]);
+                    }
+                }
+                else {
+                    out.push_back(OP_RGBA);
+                    out.push_back(px[0]);
+                    out.push_back(px[1]);
+                    out.push_back(px[2]);
+                    out.push_back(px[3]);
+                }
+            }
+            memcpy(prev, px, 4);
+        }
+    }
+    if (run > 0) out.push_back((unsigned char)(OP_RUN | (run - 1)));
+
+    for (int i = 0; i < 7; i++) out.push_back(0);
+    out.push_back(1);
+}
+
+bool QoiSink::write(TGAImage& img, const std::string& filename, bool bottom_up) {
+    if (!img.buffer()) return false;
+    std::vector<unsigned char> bytes;
+    encode(img, bottom_up, bytes);
+    return write_file(filename, bytes);
+}
+
+
+static bool has_extension(const std::string& filename, const char* ext) {
+    size_t n = strlen(ext);
+    if (filename.size() < n) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (tolower((unsigned char)filename[filename.size() - n + i]) != ext[i]) return false;
+    }
+    return true;
+}
+
+ImageSink* make_sink(const std::string& filename) {
+    if (has_extension(filename, ".ppm") || has_extension(filename, ".pgm")) return new PnmSink(false);
+    if (has_extension(filename, ".pam")) return new PnmSink(true);
+    if (has_extension(filename, ".qoi")) return new QoiSink();
+    return new TgaSink();
+}
+
+bool write_image(TGAImage& img, const std::string& filename, bool bottom_up) {
+    TRACE_SCOPE("write_image");
+    std::unique_ptr<ImageSink> sink(make_sink(filename));
+    return sink->write(img, filename, bottom_up);
+}
+
+
+bool ScanlineWriter::open(const std::string& filename, int w, int h) {
+    name = filename;
+    width = w;
+    height = h;
+    rows = 0;
+    ppm = has_extension(filename, ".ppm");
+    if (!ppm && (w > 0xffff || h > 0xffff)) {
+        std::cerr << "tga images are limited to 65535x65535\n";
+        return false;
+    }
+    out.open(filename.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    if (ppm) {
+        out << "P6\n" << w << " " << h << "\n255\n";
+    }
+    else {
+        unsigned char header[18] = {};
+        header[2] = 10;     // RLE true color
+        header[12] = (unsigned char)w;
+        header[13] = (unsigned char)(w >> 8);
+        header[14] = (unsigned char)h;
+        header[15] = (unsigned char)(h >> 8);
+        header[16] = 24;
+        out.write((const char*)header, sizeof(header));
+    }
+    return out.good();
+}
+
+// Run packets for repeats of a pixel, raw packets in between, at most 128
+// pixels each, like TGAImage::unload_rle_data but never across rows.
+static void encode_tga_row(const uint32_t* row, int w, std::vector<unsigned char>& out) {
+    int x = 0;
+    while (x < w) {
+        int n = 1;
+        while (x + n < w && n < 128 && row[x + n] == row[x]) n++;
+        if (n > 1) {
+            out.push_back((unsigned char)(n + 127));
+            out.push_back((unsigned char)row[x]);
+            out.push_back((unsigned char)(row[x] >> 8));
+            out.push_back((unsigned char)(row[x] >> 16));
+            x += n;
+            continue;
+        }
+        n = 0;
+        while (x + n < w && n < 128 && (x + n + 1 >= w || row[x + n + 1] != row[x + n])) n++;
+        out.push_back((unsigned char)(n - 1));
+        for (int i = 0; i < n; i++) {
+            out.push_back((unsigned char)row[x + i]);
+            out.push_back((unsigned char)(row[x + i] >> 8));
+            out.push_back((unsigned char)(row[x + i] >> 16));
+        }
+        x += n;
+    }
+}
+
+bool ScanlineWriter::write_row(const uint32_t* row) {
+    bytes.clear();
+    if (ppm) {
+        bytes.resize((size_t)width * 3);
+        for (int x = 0; x < width; x++) {
+            bytes[x * 3] = (unsigned char)(row[x] >> 16);
+            bytes[x * 3 + 1] = (unsigned char)(row[x] >> 8);
+            bytes[x * 3 + 2] = (unsigned char)row[x];
+        }
+    }
+    else {
+        encode_tga_row(row, width, bytes);
+    }
+    out.write((const char*)bytes.data(), (std::streamsize)bytes.size());
+    rows++;
+    if (!out.good()) {
+        std::cerr << "can't write " << name << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool ScanlineWriter::close() {
+    if (!ppm) {
+        static const unsigned char footer[26] = { 0, 0, 0, 0, 0, 0, 0, 0,
+            'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+        out.write((const char*)footer, sizeof(footer));
+    }
+    out.close();
+    if (rows != height) {
+        std::cerr << name << ": " << rows << " of " << height << " rows written\n";
+        return false;
+    }
+    if (out.fail()) {
+        std::cerr << "can't write " << name << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef __IMAGE_SINK_H__
+#define __IMAGE_SINK_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "tgaimage.h"
+
+// Output encoders for finished frames. Rendered images are bottom-up (row 0
+// is the bottom of the screen); with bottom_up set a sink emits the rows in
+// reverse while encoding instead of flipping the image first.
+class ImageSink {
+public:
+    virtual ~ImageSink() {}
+    virtual bool write(TGAImage& img, const std::string& filename, bool bottom_up) = 0;
+};
+
+// TGA, RLE-compressed. Bottom-up images are written with a bottom-left
+// origin, so no rows are moved at all.
+class TgaSink : public ImageSink {
+public:
+    virtual bool write(TGAImage& img, const std::string& filename, bool bottom_up);
+};
+
+// Uncompressed netpbm: P6/P5 (.ppm/.pgm) or P7 (.pam, keeps alpha).
+class PnmSink : public ImageSink {
+public:
+    explicit PnmSink(bool pam_) : pam(pam_) {}
+    virtual bool write(TGAImage& img, const std::string& filename, bool bottom_up);
+private:
+    bool pam;
+};
+
+// QOI ("Quite OK Image") lossless encoder; grayscale is stored as RGB.
+class QoiSink : public ImageSink {
+public:
+    virtual bool write(TGAImage& img, const std::string& filename, bool bottom_up);
+
+    static void encode(TGAImage& img, bool bottom_up, std::vector<unsigned char>& out);
+};
+
+// Picks the sink from the file extension (.tga, .ppm, .pgm, .pam, .qoi);
+// unknown extensions get TGA.
+ImageSink* make_sink(const std::string& filename);
+
+bool write_image(TGAImage& img, const std::string& filename, bool bottom_up);
+
+// Writes an RGB image a scanline at a time, for frames too large to hold
+// in memory. Rows are packed framebuffer colors (see pack_color). TGA
+// (RLE, one packet run per row, bottom-left origin) takes the rows bottom
+// first; .ppm takes them top first, which top_down() reports. close()
+// fails unless exactly height rows were written.
+class ScanlineWriter {
+public:
+    ScanlineWriter() : width(0), height(0), rows(0), ppm(false) {}
+
+    bool open(const std::string& filename, int w, int h);
+    bool top_down() const { return ppm; }
+    bool write_row(const uint32_t* row);
+    bool close();
+
+private:
+    std::ofstream              out;
+    std::string                name;
+    int                        width;
+    int                        height;
+    int                        rows;
+    bool                       ppm;
+    std::vector<unsigned char> bytes;
+};
+
+// Writes the whole buffer with a single call.
+bool write_file(const std::string& filename, const std::vector<unsigned char>& bytes);
+
+#endif // __IMAGE_SINK_H__
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include "incremental.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Tiles a face's pixel bounds r overlap, with a pixel of slack against
+// the rasterizer rounding its own bounds.
+static ScreenRect tile_span(const ScreenRect& r, const ScreenRect& screen, int tile) {
+    return ScreenRect(std::max(0, r.x0 - 1) / tile, std::max(0, r.y0 - 1) / tile,
+        std::min(screen.x1, r.x1 + 1) / tile, std::min(screen.y1, r.y1 + 1) / tile);
+}
+
+IncrementalRenderer::IncrementalRenderer(const Camera& cam_, const Vec3f& light_dir, int w, int h,
+    const std::vector<DrawCall>& draws)
+    : cam(cam_), light(light_dir), draws_(draws), shaders(draws.size()),
+    frame_(w, h), gbuf(w, h),
+    tiles_x((w + TILE - 1) / TILE), tiles_y((h + TILE - 1) / TILE),
+    dirty((size_t)tiles_x * tiles_y, 0), bins((size_t)tiles_x * tiles_y),
+    layers((size_t)tiles_x * tiles_y), ndirty(0) {
+    for (size_t d = 0; d < draws_.size(); d++) {
+        shaders[d].uniform_model = draws_[d].model;
+        shaders[d].uniform_material = draws_[d].shading_material();
+        shaders[d].is_transparent = draws_[d].is_transparent;
+        shaders[d].alpha = draws_[d].alpha;
+    }
+}
+
+ScreenRect IncrementalRenderer::tile_rect(int t) const {
+    int x0 = (t % tiles_x) * TILE, y0 = (t / tiles_x) * TILE;
+    return ScreenRect(x0, y0, std::min(frame_.width(), x0 + TILE) - 1,
+        std::min(frame_.height(), y0 + TILE) - 1);
+}
+
+void IncrementalRenderer::mark_tiles(const DrawGeometry& g) {
+    ScreenRect screen(0, 0, frame_.width() - 1, frame_.height() - 1);
+    for (size_t i = 0; i < g.nfaces(); i++) {
+        ScreenRect r = triangle_bounds(g.face_pts(i), screen);
+        if (r.empty()) continue;
+        ScreenRect span = tile_span(r, screen, TILE);
+        for (int ty = span.y0; ty <= span.y1; ty++)
+            for (int tx = span.x0; tx <= span.x1; tx++) dirty[ty * tiles_x + tx] = 1;
+    }
+}
+
+void IncrementalRenderer::render() {
+    TRACE_SCOPE("incremental_render");
+    vertex_stage(cam, light, frame_.width(), frame_.height(), draws_, geo);
+    std::fill(dirty.begin(), dirty.end(), (unsigned char)1);
+    redraw(true);
+}
+
+void IncrementalRenderer::set_light(const Vec3f& light_dir) {
+    TRACE_SCOPE("incremental_relight");
+    light = light_dir;
+    vertex_stage(cam, light, frame_.width(), frame_.height(), draws_, geo);
+    std::fill(dirty.begin(), dirty.end(), (unsigned char)1);
+    redraw(false);
+}
+
+void IncrementalRenderer::set_transform(int draw, const Matrix& view_xform) {
+    TRACE_SCOPE("incremental_move", nullptr, draw);
+    std::fill(dirty.begin(), dirty.end(), (unsigned char)0);
+    mark_tiles(geo.draws[draw]);
+
+    draws_[draw].view_xform = view_xform;
+    FrameGeometry one;
+    vertex_stage(cam, light, frame_.width(), frame_.height(),
+        std::vector<DrawCall>(1, draws_[draw]), one);
+    std::swap(geo.draws[draw], one.draws[0]);
+    mark_tiles(geo.draws[draw]);
+    redraw(true);
+}
+
+void IncrementalRenderer::redraw(bool rasterize) {
+    ScreenRect screen(0, 0, frame_.width() - 1, frame_.height() - 1);
+    for (size_t t = 0; t < bins.size(); t++) bins[t].clear();
+    for (size_t d = 0; d < draws_.size(); d++) {
+        shaders[d].nvaryings = geo.draws[d].nvaryings;
+        if (!rasterize) continue;
+        const DrawGeometry& g = geo.draws[d];
+        for (size_t i = 0; i < g.nfaces(); i++) {
+            ScreenRect r = triangle_bounds(g.face_pts(i), screen);
+            if (r.empty()) continue;
+            ScreenRect span = tile_span(r, screen, TILE);
+            for (int ty = span.y0; ty <= span.y1; ty++) {
+                for (int tx = span.x0; tx <= span.x1; tx++) {
+                    int t = ty * tiles_x + tx;
+                    if (!dirty[t]) continue;
+                    FaceRef f = { (int)d, (int)i };
+                    bins[t].push_back(f);
+                }
+            }
+        }
+    }
+
+    std::vector<int> tiles;
+    for (size_t t = 0; t < dirty.size(); t++)
+        if (dirty[t]) tiles.push_back((int)t);
+    ndirty = rasterize ? (int)tiles.size() : 0;
+
+    // Tiles only touch their own pixels, so they are drawn in parallel.
+    parallel_for(0, (int)tiles.size(), 1, [&](int lo, int hi) {
+        for (int k = lo; k < hi; k++) {
+            TRACE_SCOPE("draw_tile", rasterize ? "raster" : "shade", tiles[k]);
+            ScreenRect r = tile_rect(tiles[k]);
+            if (rasterize) rasterize_tile(tiles[k], r);
+            shade_tile(tiles[k], r);
+        }
+    });
+}
+
+// Opaque faces into the G-buffer first, then the transparent fragments
+// that pass against their depth, in draw order.
+void IncrementalRenderer::rasterize_tile(int t, const ScreenRect& r) {
+    const std::vector<FaceRef>& bin = bins[t];
+    for (int y = r.y0; y <= r.y1; y++) {
+        std::fill(frame_.depth_row(y) + r.x0, frame_.depth_row(y) + r.x1 + 1, (unsigned char)0);
+    }
+    gbuf.clear(r);
+    for (size_t i = 0; i < bin.size(); i++) {
+        if (draws_[bin[i].draw].is_transparent) continue;
+        triangle_gbuffer(geo.draws[bin[i].draw].face_pts(bin[i].face), bin[i].draw,
+            bin[i].face, frame_, gbuf, r);
+    }
+    layers[t].clear();
+    for (size_t i = 0; i < bin.size(); i++) {
+        if (!draws_[bin[i].draw].is_transparent) continue;
+        triangle_fragments(geo.draws[bin[i].draw].face_pts(bin[i].face), bin[i].draw,
+            bin[i].face, frame_, r, layers[t]);
+    }
+}
+
+// The varyings at a pixel are its face's vertex varyings weighted by the
+// stored barycentrics.
+bool IncrementalRenderer::shade(int object, int face, const float* bar, int x, int y,
+    TGAColor& color) const {
+    float vary[MAX_VARYINGS];
+    const DrawGeometry& g = geo.draws[object];
+    const float* v = g.face_varyings(face);
+    int nv = g.nvaryings;
+    for (int k = 0; k < nv; k++) vary[k] = bar[0] * v[k] + bar[1] * v[nv + k] + bar[2] * v[2 * nv + k];
+    return !shaders[object].fragment(Vec2i(x, y), Vec3f(bar[0], bar[1], bar[2]), vary, color);
+}
+
+// Pixels no opaque face covers get the clear color; the transparent
+// fragments are blended over the result like triangle() blends them.
+void IncrementalRenderer::shade_tile(int t, const ScreenRect& r) {
+    TGAColor color;
+    for (int y = r.y0; y <= r.y1; y++) {
+        uint32_t* crow = frame_.row(y);
+        for (int x = r.x0; x <= r.x1; x++) {
+            size_t i = (size_t)y * gbuf.width + x;
+            int o = gbuf.object[i];
+            crow[x] = 0;
+            if (o != GBuffer::NONE && shade(o, gbuf.face[i], &gbuf.bar[i * 3], x, y, color))
+                crow[x] = pack_color(color) | 0xff000000u;
+        }
+    }
+
+    const std::vector<GFragment>& frags = layers[t];
+    int w = frame_.width();
+    for (size_t k = 0; k < frags.size(); k++) {
+        const GFragment& f = frags[k];
+        int x = f.pixel % w, y = f.pixel / w;
+        if (!shade(f.object, f.face, f.bar, x, y, color)) continue;
+        float alpha = std::max(0.f, std::min(1.f, shaders[f.object].alpha));
+        uint32_t* dst = frame_.row(y) + x;
+        *dst = blend_packed(*dst, pack_color(color), (uint32_t)(alpha * 256.f + 0.5f));
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef __INCREMENTAL_H__
+#define __INCREMENTAL_H__
+
+#include <vector>
+#include "renderer.h"
+
+// Keeps a frame, its vertex stage output and a G-buffer of the opaque
+// draws between updates, so that small edits only redo what they change:
+//
+//   set_light()     re-runs the vertex stage (the sun is lit per vertex)
+//                   and re-shades every pixel from the G-buffer and the
+//                   stored transparent fragments; nothing is rasterized.
+//   set_transform() re-runs the vertex stage of that draw and redraws the
+//                   screen tiles its faces covered before or cover now.
+//
+// Opaque draws are shaded from the G-buffer after all of them are
+// rasterized, then the transparent fragments are blended on top in the
+// order they were rasterized.
+// Every tile is drawn with the same clip rectangle whether the whole frame
+// or only that tile is redrawn, so an update gives the same pixels as
+// rendering the new state from scratch. Only the sun is supported; no
+// local lights, HDR or MSAA.
+class IncrementalRenderer {
+public:
+    static const int TILE = 32;
+
+    IncrementalRenderer(const Camera& cam, const Vec3f& light_dir, int w, int h,
+        const std::vector<DrawCall>& draws);
+
+    // Renders every tile from scratch.
+    void render();
+    void set_light(const Vec3f& light_dir);
+    void set_transform(int draw, const Matrix& view_xform);
+
+    const Framebuffer& frame() const { return frame_; }
+    const std::vector<DrawCall>& draws() const { return draws_; }
+
+    // Tiles rasterized by the last update, out of ntiles().
+    int dirty_tiles() const { return ndirty; }
+    int ntiles() const { return tiles_x * tiles_y; }
+
+private:
+    struct FaceRef {
+        int draw;
+        int face;
+    };
+
+    ScreenRect tile_rect(int t) const;
+    // Flags the tiles the faces of g overlap.
+    void mark_tiles(const DrawGeometry& g);
+    // Bins the faces of every draw into the flagged tiles and redraws
+    // them; with rasterize false the tiles are only re-shaded.
+    void redraw(bool rasterize);
+    void rasterize_tile(int t, const ScreenRect& r);
+    void shade_tile(int t, const ScreenRect& r);
+    // Runs the draw's fragment shader; false if it discarded.
+    bool shade(int object, int face, const float* bar, int x, int y, TGAColor& color) const;
+
+    Camera                            cam;
+    Vec3f                             light;
+    std::vector<DrawCall>             draws_;
+    FrameGeometry                     geo;
+    std::vector<GouraudPhongShader>   shaders;
+    Framebuffer                       frame_;
+    GBuffer                           gbuf;
+    int                               tiles_x;
+    int                               tiles_y;
+    std::vector<unsigned char>        dirty;
+    std::vector<std::vector<FaceRef>> bins;
+    std::vector<std::vector<GFragment>> layers;    // transparent, per tile
+    int                               ndirty;
+};
+
+#endif // __INCREMENTAL_H__
@@ -0,0 +1,232 @@
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include "lights.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "trace.h"
+
+namespace {
+
+const float PI = 3.14159265f;
+
+// xorshift32, good enough to scatter a light rig.
+float next_float(unsigned& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) / 16777216.f;
+}
+
+// Fully saturated color of hue h in [0, 1).
+Vec3f hue(float h) {
+    float r = std::fabs(h * 6.f - 3.f) - 1.f;
+    float g = 2.f - std::fabs(h * 6.f - 2.f);
+    float b = 2.f - std::fabs(h * 6.f - 4.f);
+    return Vec3f(std::max(0.f, std::min(1.f, r)), std::max(0.f, std::min(1.f, g)),
+        std::max(0.f, std::min(1.f, b)));
+}
+
+struct TilePlane {
+    float p[4];
+
+    // sa * a + sb * b, normalized so distances are in view-space units.
+    void set(float sa, const float* a, float sb, const float* b) {
+        for (int i = 0; i < 4; i++) p[i] = sa * a[i] + sb * b[i];
+        float len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        if (len > 0.f)
+            for (int i = 0; i < 4; i++) p[i] /= len;
+    }
+    void negate() {
+        for (int i = 0; i < 4; i++) p[i] = -p[i];
+    }
+    float distance(const Vec3f& v) const { return p[0] * v.x + p[1] * v.y + p[2] * v.z + p[3]; }
+};
+
+bool sphere_inside(const TilePlane* planes, int n, const Vec3f& c, float r) {
+    for (int i = 0; i < n; i++)
+        if (planes[i].distance(c) < -r) return false;
+    return true;
+}
+
+} // namespace
+
+
+std::vector<Light> make_light_rig(int n, unsigned seed) {
+    unsigned state = seed * 2654435761U + 1;
+    std::vector<Light> lights(n);
+    for (int i = 0; i < n; i++) {
+        Light& l = lights[i];
+        float z = next_float(state) * 2.f - 1.f;
+        float phi = next_float(state) * 2.f * PI;
+        float s = std::sqrt(1.f - z * z);
+        float radius = 1.1f + 0.3f * next_float(state);
+        Vec3f dir(s * std::cos(phi), z, s * std::sin(phi));
+        l.position = dir * radius;
+        l.direction = dir * -1.f;
+        l.color = hue(next_float(state)) * 0.6f;
+        if (i % 4 == 3) {
+            l.type = Light::SPOT;
+            l.range = 2.5f;
+            l.cos_inner = std::cos(12.f * PI / 180.f);
+            l.cos_outer = std::cos(20.f * PI / 180.f);
+        }
+        else {
+            l.type = Light::POINT;
+            l.range = 0.5f + 0.4f * next_float(state);
+            l.cos_inner = -1.f;
+            l.cos_outer = -1.f;
+        }
+    }
+    return lights;
+}
+
+bool load_lights(const char* filename, std::vector<Light>& out) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "Cannot open light file: " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream iss(line);
+        std::string type;
+        Light l;
+        iss >> type >> l.position.x >> l.position.y >> l.position.z;
+        if (type == "point") {
+            l.type = Light::POINT;
+            l.direction = Vec3f(0.f, 0.f, -1.f);
+            iss >> l.color.x >> l.color.y >> l.color.z >> l.range;
+            l.cos_inner = -1.f;
+            l.cos_outer = -1.f;
+        }
+        else if (type == "spot") {
+            float inner, outer;
+            l.type = Light::SPOT;
+            iss >> l.direction.x >> l.direction.y >> l.direction.z
+                >> l.color.x >> l.color.y >> l.color.z >> l.range >> inner >> outer;
+            l.direction.normalize();
+            l.cos_inner = std::cos(inner * PI / 180.f);
+            l.cos_outer = std::cos(outer * PI / 180.f);
+        }
+        else {
+            iss.setstate(std::ios::failbit);
+        }
+        if (iss.fail() || l.range <= 0.f) {
+            std::cerr << "bad light line: " << line << "\n";
+            continue;
+        }
+        out.push_back(l);
+    }
+    return !out.empty();
+}
+
+void lights_to_view(const std::vector<Light>& lights, const Matrix& ModelView,
+    std::vector<ViewLight>& out) {
+    out.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); i++) {
+        const Light& l = lights[i];
+        ViewLight& v = out[i];
+        v.position = proj<3>(ModelView * embed<4>(l.position, 1.f));
+        v.direction = proj<3>(ModelView * embed<4>(l.direction, 0.f)).normalize();
+        v.color = l.color;
+        v.range = l.range;
+        v.cos_inner = l.cos_inner;
+        v.cos_outer = l.cos_outer;
+        v.spot = l.type == Light::SPOT;
+    }
+}
+
+
+TileLightGrid::TileLightGrid()
+    : tiles_x(0), tiles_y(0), nlights(0), count(NULL), lists(NULL) {
+}
+
+void TileLightGrid::build(const std::vector<ViewLight>& lights, const Matrix& F,
+    int width, int height, const Framebuffer* depth, bool cull) {
+    TRACE_SCOPE("light_tiles");
+    tiles_x = (width + TILE - 1) / TILE;
+    tiles_y = (height + TILE - 1) / TILE;
+    nlights = (int)lights.size();
+    Arena& arena = frame_arena();
+    count = arena.alloc_array<int>((size_t)2 * ntiles());
+    lists = arena.alloc_array<int>((size_t)2 * ntiles() * nlights);
+
+    float rows[4][4];
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) rows[i][j] = F[i][j];
+
+    parallel_for(0, tiles_y, 1, [&](int lo, int hi) {
+        TRACE_SCOPE("cull_tile_row", nullptr, lo);
+        for (int ty = lo; ty < hi; ty++) {
+            for (int tx = 0; tx < tiles_x; tx++) {
+                int t = ty * tiles_x + tx;
+                int* opaque = lists + (size_t)(2 * t) * nlights;
+                int* transparent = opaque + nlights;
+                if (!cull) {
+                    for (int i = 0; i < nlights; i++) opaque[i] = transparent[i] = i;
+                    count[2 * t] = count[2 * t + 1] = nlights;
+                    continue;
+                }
+
+                int x0 = tx * TILE, x1 = std::min(width, x0 + TILE) - 1;
+                int y0 = ty * TILE, y1 = std::min(height, y0 + TILE) - 1;
+
+                // Sides with a pixel of slack, then w >= 0, then the depth
+                // bounds. Geometry is not clipped, so fragments can also
+                // come from behind the eye, where the tile's region is the
+                // mirrored frustum.
+                TilePlane front[7], back[5];
+                front[0].set(1.f, rows[0], 1.f - x0, rows[3]);
+                front[1].set(-1.f, rows[0], x1 + 1.f, rows[3]);
+                front[2].set(1.f, rows[1], 1.f - y0, rows[3]);
+                front[3].set(-1.f, rows[1], y1 + 1.f, rows[3]);
+                front[4].set(0.f, rows[0], 1.f, rows[3]);
+                for (int i = 0; i < 5; i++) {
+                    back[i] = front[i];
+                    back[i].negate();
+                }
+                int nfront = 5;
+                if (depth) {
+                    int zmin = 255, zmax = 0;
+                    for (int y = y0; y <= y1; y++) {
+                        const unsigned char* zrow = depth->depth_row(y);
+                        for (int x = x0; x <= x1; x++) {
+                            zmin = std::min(zmin, (int)zrow[x]);
+                            zmax = std::max(zmax, (int)zrow[x]);
+                        }
+                    }
+                    // Stored depth is rounded; one unit of slack each way.
+                    front[5].set(1.f, rows[2], 1.f - zmin, rows[3]);
+                    front[6].set(-1.f, rows[2], zmax + 1.f, rows[3]);
+                    nfront = 7;
+                }
+
+                int nopaque = 0, ntransparent = 0;
+                for (int i = 0; i < nlights; i++) {
+                    const Vec3f& c = lights[i].position;
+                    float r = lights[i].range;
+                    if (sphere_inside(back, 5, c, r)) {
+                        opaque[nopaque++] = i;
+                        transparent[ntransparent++] = i;
+                        continue;
+                    }
+                    if (!sphere_inside(front, std::min(nfront, 6), c, r)) continue;
+                    transparent[ntransparent++] = i;
+                    if (nfront < 7 || front[6].distance(c) >= -r) opaque[nopaque++] = i;
+                }
+                count[2 * t] = nopaque;
+                count[2 * t + 1] = ntransparent;
+            }
+        }
+    });
+}
+
+long long TileLightGrid::opaque_refs() const {
+    long long n = 0;
+    for (int t = 0; t < ntiles(); t++) n += count[2 * t];
+    return n;
+}
@@ -0,0 +1,86 @@
+#ifndef __LIGHTS_H__
+#define __LIGHTS_H__
+
+#include <vector>
+#include "geometry.h"
+#include "framebuffer.h"
+
+// Local light in world space. The contribution falls off smoothly to zero
+// at range; spot lights additionally fade from cos_inner to cos_outer
+// around direction. color is linear RGB, 1 = the strength of the sun term.
+struct Light {
+    enum Type { POINT, SPOT };
+
+    Type  type;
+    Vec3f position;
+    Vec3f direction;
+    Vec3f color;
+    float range;
+    float cos_inner;
+    float cos_outer;
+};
+
+// n lights on a shell around the origin, every fourth a spot aimed at the
+// center. Same seed, same rig.
+std::vector<Light> make_light_rig(int n, unsigned seed = 1);
+
+// Text file, one light per line:
+//   point px py pz  r g b  range
+//   spot  px py pz  dx dy dz  r g b  range inner_deg outer_deg
+bool load_lights(const char* filename, std::vector<Light>& out);
+
+
+// A light moved into view space for shading.
+struct ViewLight {
+    Vec3f position;
+    Vec3f direction;
+    Vec3f color;
+    float range;
+    float cos_inner;
+    float cos_outer;
+    bool  spot;
+};
+
+void lights_to_view(const std::vector<Light>& lights, const Matrix& ModelView,
+    std::vector<ViewLight>& out);
+
+
+// Forward+ light culling: the screen is split into TILE x TILE tiles and
+// every light's sphere is tested against each tile's sub-frustum, bounded
+// in depth by the opaque depth of the tile when a depth buffer is given.
+// Opaque fragments use the list bounded on both sides; transparent ones
+// lie in front of the opaque surface, so their list is only bounded from
+// behind. Lists live in the calling thread's frame arena and stay valid
+// until it is reset.
+class TileLightGrid {
+public:
+    static const int TILE = 16;
+
+    TileLightGrid();
+
+    // view_to_screen maps view space to viewport space (Viewport *
+    // Projection). depth is the opaque depth prepass, or null when none is
+    // available (MSAA), in which case the tiles are only bounded on the
+    // sides. With cull false every tile gets every light.
+    void build(const std::vector<ViewLight>& lights, const Matrix& view_to_screen,
+        int width, int height, const Framebuffer* depth, bool cull = true);
+
+    const int* lights_at(int x, int y, bool transparent, int& n) const {
+        int t = (y / TILE) * tiles_x + x / TILE;
+        n = transparent ? count[2 * t + 1] : count[2 * t];
+        return lists + (size_t)(2 * t + (transparent ? 1 : 0)) * nlights;
+    }
+
+    int ntiles() const { return tiles_x * tiles_y; }
+    // Sum of the opaque list lengths over all tiles.
+    long long opaque_refs() const;
+
+private:
+    int  tiles_x;
+    int  tiles_y;
+    int  nlights;
+    int* count;     // opaque, transparent per tile
+    int* lists;     // nlights slots per list
+};
+
+#endif // __LIGHTS_H__
@@ -2,18 +2,41 @@
 #include <limits>
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <memory>
 
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
 #include "my_gl.h"
+#include "renderer.h"
 #include "Camera.h"
+#include "CameraPath.h"
+#include "frame_writer.h"
+#include "frame_stream.h"
+#include "thread_pool.h"
+#include "render_server.h"
+#include "pipeline_stats.h"
+#include "image_sink.h"
+#include "bvh.h"
+#include "ao_bake.h"
+#include "arena.h"
+#include "lights.h"
+#include "post.h"
+#include "incremental.h"
+#include "scene.h"
+#include "poster.h"
+#include "trace.h"
 
 const int width = 800;
 const int height = 800;
 
-Model* model = nullptr;
-
 Vec3f light_dir(1.0f, 2.0f, 1.0f);
 
 
@@ -25,151 +48,752 @@ Camera camera(
 
 
 
-struct GouraudPhongShader : public IShader {
-    mat<2, 3, float> varying_uv;      
-    Vec3f            varying_intensity; 
+// The head with the transparent cube attached to the camera around it, or
+// with ninstances > 0 a grid of that many heads sharing one Model.
+static void build_scene(Scene& scene, Model& head, Model& cube, int ninstances) {
+    if (ninstances > 0) {
+        int k = (int)std::ceil(std::sqrt((float)ninstances));
+        float spacing = 3.f / k;
+        Matrix s = Matrix::identity();
+        for (int i = 0; i < 3; i++) s[i][i] = 0.45f * spacing;
+        int grid = scene.add_node(Scene::ROOT, s);
+        for (int i = 0; i < ninstances; i++) {
+            Matrix t = Matrix::identity();
+            t[0][3] = (i % k - (k - 1) * 0.5f) / 0.45f;
+            t[1][3] = (i / k - (k - 1) * 0.5f) / 0.45f;
+            scene.add_node(grid, t, &head);
+        }
+        return;
+    }
+
+    scene.add_node(Scene::ROOT, Matrix::identity(), &head);
+
+    Matrix Scale = Matrix::identity();
+    float s = 1.85f;
+    Scale[0][0] = s;
+    Scale[1][1] = s;
+    Scale[2][2] = s;
+
+
+    Scale[1][3] -= 0.05f;
+
+    scene.add_node(Scene::VIEW, Scale, &cube, true, 0.35f);
+}
+
 
-    Matrix uniform_M;      
-    Matrix uniform_MIT;    
-    Matrix uniform_P;      
-    Vec3f  uniform_light_dir;
+// Renders nframes along the path into <prefix>NNNN.tga, or into stream
+// when one is given. The vertex stage of frame N+1 runs on its own thread
+// while frame N is rasterized, and the FrameWriter encodes frame N-1 in the
+// background. Framebuffers and the per-frame geometry are allocated once
+// and reused.
+static int render_sequence(const CameraPath& path, int nframes,
+    const std::vector<DrawCall>& draws, const std::string& prefix, FrameStream* stream) {
+    Framebuffer frame(width, height);
+    FrameGeometry geo[2];
+    FrameWriter writer(stream);
+
+    ArenaStats arena;
+
+    auto t0 = std::chrono::steady_clock::now();
+    vertex_stage(path.frame(0, nframes), light_dir, width, height, draws, geo[0]);
+
+    for (int f = 0; f < nframes; f++) {
+        TRACE_SCOPE("frame", nullptr, f);
+        std::future<void> next;
+        if (f + 1 < nframes) {
+            Camera cam = path.frame(f + 1, nframes);
+            FrameGeometry* dst = &geo[(f + 1) & 1];
+            next = std::async(std::launch::async,
+                [cam, dst, &draws] { vertex_stage(cam, light_dir, width, height, draws, *dst); });
+        }
 
-    virtual Vec4f vertex(int iface, int nthvert) {
-        Vec3f v_obj = model->vert(iface, nthvert);   
-        Vec3f n_obj = model->normal(iface, nthvert); 
-        Vec2f uv = model->uv(iface, nthvert);     
+        frame.clear();
+        raster_stage(geo[f & 1], draws, frame);
+
+        if (next.valid()) next.get();
+        ArenaStats a = reset_frame_arenas();
+        arena.bytes += a.bytes;
+        arena.allocations += a.allocations;
+        arena.capacity = std::max(arena.capacity, a.capacity);
+        arena.threads = std::max(arena.threads, a.threads);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%04d.tga", f);
+        writer.submit(frame, prefix + name);
+        if (!writer.good()) {
+            nframes = f + 1;
+            break;
+        }
+    }
+    writer.flush();
+
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t0).count();
+    std::cerr << nframes << " frames in " << ms << " ms ("
+        << ms / nframes << " ms/frame)\n";
+    collect_stats().print(std::cerr);
+    arena.bytes /= nframes;
+    arena.allocations /= nframes;
+    std::cerr << "per frame:\n";
+    arena.print(std::cerr);
+    return 0;
+}
 
-        
-        varying_uv.set_col(nthvert, uv);
 
-       
-        Vec4f v_cam4 = uniform_M * embed<4>(v_obj, 1.f);
-        Vec3f v_cam = proj<3>(v_cam4);
+static int render_thumbnails(int nviews, int size,
+    const std::vector<DrawCall>& draws, const std::string& prefix) {
+    CameraPath path = CameraPath::orbit(camera.getEye(), camera.getCenter(), camera.getUp());
+    std::vector<Camera> cams;
+    std::vector<Framebuffer> frames;
+    for (int v = 0; v < nviews; v++) {
+        cams.push_back(path.frame(v, nviews));
+        frames.push_back(Framebuffer(size, size));
+    }
 
-        
-        Vec3f n = proj<3>(uniform_MIT * embed<4>(n_obj, 0.f)).normalize();
+    auto t0 = std::chrono::steady_clock::now();
+    render_multiview(cams, light_dir, draws, frames);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t0).count();
+    std::cerr << nviews << " views in " << ms << " ms\n";
+    reset_frame_arenas().print(std::cerr);
+
+    parallel_for(0, nviews, 1, [&](int lo, int hi) {
+        for (int v = lo; v < hi; v++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%04d.tga", v);
+            TGAImage image;
+            frames[v].to_tga(image);
+            write_image(image, prefix + name, true);
+        }
+    });
+    return 0;
+}
 
-        
-        Vec3f l = uniform_light_dir;
-        Vec3f v = (v_cam * -1.0f).normalize();
 
-        
-        float diff = std::max(0.0f, n * l);
 
-       
-        Vec3f r = (n * (2.0f * (n * l)) - l).normalize();
-        float spec_pow = model->specular(uv);
-        float spec = std::pow(std::max(0.0f, r * v), spec_pow);
+// Primary rays for a size x size image of the camera view (framed like the
+// rasterizer's viewport), traced singly and as 2x2 packets, then shadow
+// rays toward the light from every hit. Writes the result to bvh.tga.
+static int bvh_bench(Model& model, int size) {
+    BVH bvh(model);
+    bvh.print_stats(std::cerr);
+
+    Vec3f eye = camera.getEye();
+    Vec3f center = camera.getCenter();
+    Vec3f z = (eye - center).normalize();
+    Vec3f x = cross(camera.getUp(), z).normalize();
+    Vec3f y = cross(z, x).normalize();
+    std::vector<Ray> rays((size_t)size * size);
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            float u = ((i + 0.5f) / size * 2.f - 1.f) / 0.75f;
+            float v = ((j + 0.5f) / size * 2.f - 1.f) / 0.75f;
+            Vec3f dir = (center + x * u + y * v - eye).normalize();
+            rays[(size_t)j * size + i] = Ray(eye, dir);
+        }
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    auto mrays = [](size_t n, Clock::time_point t0) {
+        double s = std::chrono::duration<double>(Clock::now() - t0).count();
+        return n / s * 1e-6;
+    };
+
+    std::vector<Hit> hits(rays.size());
+    Clock::time_point t0 = Clock::now();
+    parallel_for(0, size, 8, [&](int lo, int hi) {
+        for (size_t k = (size_t)lo * size; k < (size_t)hi * size; k++) bvh.intersect(rays[k], hits[k]);
+    });
+    std::cerr << "single  " << mrays(rays.size(), t0) << " Mrays/s\n";
+
+    std::vector<Hit> packet_hits(rays.size());
+    int mismatches = 0;
+    t0 = Clock::now();
+    parallel_for(0, size / 2, 4, [&](int lo, int hi) {
+        for (int j = lo * 2; j < hi * 2; j += 2) {
+            for (int i = 0; i + 1 < size; i += 2) {
+                size_t a = (size_t)j * size + i, b = a + size;
+                Ray quad[BVH::PACKET_SIZE] = { rays[a], rays[a + 1], rays[b], rays[b + 1] };
+                Hit out[BVH::PACKET_SIZE];
+                bvh.intersect(quad, out);
+                packet_hits[a] = out[0];
+                packet_hits[a + 1] = out[1];
+                packet_hits[b] = out[2];
+                packet_hits[b + 1] = out[3];
+            }
+        }
+    });
+    std::cerr << "packet  " << mrays((size_t)(size / 2) * (size / 2) * 4, t0) << " Mrays/s\n";
+    for (int j = 0; j < size / 2 * 2; j++)
+        for (int i = 0; i < size / 2 * 2; i++)
+            if (packet_hits[(size_t)j * size + i].face != hits[(size_t)j * size + i].face) mismatches++;
+    if (mismatches) std::cerr << "packet/single mismatches: " << mismatches << "\n";
+
+    Vec3f l = light_dir;
+    l.normalize();
+    std::vector<char> lit(rays.size(), 0);
+    size_t nshadow = 0;
+    for (size_t k = 0; k < hits.size(); k++) nshadow += hits[k].face >= 0;
+    t0 = Clock::now();
+    parallel_for(0, size, 8, [&](int lo, int hi) {
+        for (size_t k = (size_t)lo * size; k < (size_t)hi * size; k++) {
+            if (hits[k].face < 0) continue;
+            Vec3f p = rays[k].org + rays[k].dir * hits[k].t;
+            lit[k] = !bvh.occluded(Ray(p, l, 1e-3f));
+        }
+    });
+    std::cerr << "any-hit " << mrays(nshadow, t0) << " Mrays/s\n";
+
+    TGAImage image(size, size, TGAImage::RGB);
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            const Hit& h = hits[(size_t)j * size + i];
+            if (h.face < 0) continue;
+            Vec3f a = model.vert(h.face, 0), b = model.vert(h.face, 1), c = model.vert(h.face, 2);
+            Vec3f n = cross(b - a, c - a).normalize();
+            float I = 0.1f + (lit[(size_t)j * size + i] ? 0.9f * std::max(0.f, n * l) : 0.f);
+            unsigned char g = (unsigned char)(255 * std::min(1.f, I));
+            image.set(i, j, TGAColor(g, g, g, 255));
+        }
+    }
+    write_image(image, "bvh.tga", true);
+    return 0;
+}
+
+// Diffuse lookups on the plain and the block-compressed copy of a model's
+// textures: memory, error against the plain texels, and throughput for
+// random uvs and for uvs walked in scanline order (what rasterizing a
+// textured triangle does), single-threaded so the block cache is the only
+// variable.
+static int texture_bench(Model& plain, const char* obj_path, int nsamples) {
+    Model packed(obj_path, true);
+    std::cerr << "model memory   " << (plain.memory_bytes() >> 10) << " KB plain, "
+        << (packed.memory_bytes() >> 10) << " KB compressed\n";
+
+    const int grid = 512;
+    double err = 0.0, sq = 0.0;
+    for (int j = 0; j < grid; j++) {
+        for (int i = 0; i < grid; i++) {
+            Vec2f uv((i + 0.5f) / grid, (j + 0.5f) / grid);
+            TGAColor a = plain.diffuse(uv), b = packed.diffuse(uv);
+            for (int k = 0; k < 3; k++) {
+                int d = a[k] - b[k];
+                err += std::abs(d);
+                sq += d * d;
+            }
+        }
+    }
+    double n = 3.0 * grid * grid;
+    std::cerr << "diffuse error  " << err / n << " mean abs, PSNR "
+        << 10.0 * std::log10(255.0 * 255.0 / std::max(sq / n, 1e-9)) << " dB\n";
+
+    std::vector<Vec2f> random_uv(nsamples), scan_uv(nsamples);
+    unsigned state = 12345;
+    for (int k = 0; k < nsamples; k++) {
+        state = state * 1664525u + 1013904223u;
+        float u = (state >> 8) / 16777216.f;
+        state = state * 1664525u + 1013904223u;
+        float v = (state >> 8) / 16777216.f;
+        random_uv[k] = Vec2f(u, v);
+        // A 256-texel-wide strip, one texel per step.
+        scan_uv[k] = Vec2f((k % 256) / 1024.f, (k / 256 % 1024) / 1024.f);
+    }
 
-        
-        float ambient = 0.1f;
-        float kd = 0.9f;
-        float ks = 0.5f;
+    typedef std::chrono::steady_clock Clock;
+    const char* names[2] = { "random", "scanline" };
+    const std::vector<Vec2f>* uvs[2] = { &random_uv, &scan_uv };
+    for (int p = 0; p < 2; p++) {
+        for (int m = 0; m < 2; m++) {
+            Model& model = m ? packed : plain;
+            BlockCacheStats before = block_cache_stats();
+            unsigned sum = 0;
+            Clock::time_point t0 = Clock::now();
+            for (int k = 0; k < nsamples; k++) sum += model.diffuse((*uvs[p])[k])[1];
+            double s = std::chrono::duration<double>(Clock::now() - t0).count();
+            std::cerr << names[p] << (m ? " compressed " : " plain      ") << nsamples / s * 1e-6
+                << " Msamples/s";
+            if (m) {
+                BlockCacheStats after = block_cache_stats();
+                unsigned long long hits = after.hits - before.hits, misses = after.misses - before.misses;
+                std::cerr << ", block cache hit rate " << 100.0 * hits / std::max(1ULL, hits + misses) << "%";
+            }
+            std::cerr << " (checksum " << sum << ")\n";
+        }
+    }
+    return 0;
+}
 
-        float I = ambient + kd * diff + ks * spec;
-        varying_intensity[nthvert] = I; 
+// Largest per-channel difference between two frames of the same size.
+static int max_difference(const Framebuffer& a, const Framebuffer& b) {
+    int maxd = 0;
+    for (int y = 0; y < a.height(); y++) {
+        const uint32_t* ra = a.row(y);
+        const uint32_t* rb = b.row(y);
+        for (int x = 0; x < a.width(); x++) {
+            for (int k = 0; k < 24; k += 8) {
+                int d = (int)((ra[x] >> k) & 0xff) - (int)((rb[x] >> k) & 0xff);
+                maxd = std::max(maxd, std::abs(d));
+            }
+        }
+    }
+    return maxd;
+}
 
-        
-        return uniform_P * v_cam4;
+// A tweaking session on the kept frame: each step swings the sun round the
+// head and slides the head sideways. The edits are timed against full
+// frames, and the last frame is compared with the same state rendered from
+// scratch.
+static int edit_session(const std::vector<DrawCall>& draws, int steps) {
+    typedef std::chrono::steady_clock Clock;
+    auto ms_since = [](Clock::time_point t0) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    };
+
+    Clock::time_point t0 = Clock::now();
+    Framebuffer forward(width, height);
+    FrameGeometry geo;
+    vertex_stage(camera, light_dir, width, height, draws, geo);
+    raster_stage(geo, draws, forward);
+    double forward_ms = ms_since(t0);
+    reset_frame_arenas();
+
+    IncrementalRenderer inc(camera, light_dir, width, height, draws);
+    t0 = Clock::now();
+    inc.render();
+    double full_ms = ms_since(t0);
+    reset_frame_arenas();
+    int forward_diff = max_difference(inc.frame(), forward);
+
+    double relight_ms = 0.0, move_ms = 0.0;
+    long long dirty = 0;
+    Vec3f light = light_dir;
+    for (int s = 1; s <= steps; s++) {
+        float a = 0.2f * s;
+        light = Vec3f(light_dir.x * std::cos(a) + light_dir.z * std::sin(a), light_dir.y,
+            light_dir.z * std::cos(a) - light_dir.x * std::sin(a));
+        t0 = Clock::now();
+        inc.set_light(light);
+        relight_ms += ms_since(t0);
+
+        Matrix slide = Matrix::identity();
+        slide[0][3] = 0.02f * s;
+        t0 = Clock::now();
+        inc.set_transform(0, slide);
+        move_ms += ms_since(t0);
+        dirty += inc.dirty_tiles();
+        reset_frame_arenas();
     }
 
-   
-    virtual bool fragment(Vec3f bar, TGAColor& color) {
-        
-        Vec2f uv = varying_uv * bar;
-        float I = varying_intensity * bar;
+    IncrementalRenderer ref(camera, light, width, height, inc.draws());
+    ref.render();
+    reset_frame_arenas();
 
-        TGAColor c = model->diffuse(uv);
+    std::cerr << "forward frame  " << forward_ms << " ms\n"
+        << "deferred frame " << full_ms << " ms (max difference " << forward_diff << ")\n";
+    if (steps) {
+        std::cerr << "relight        " << relight_ms / steps << " ms\n"
+            << "move head      " << move_ms / steps << " ms, " << (double)dirty / steps << " of "
+            << inc.ntiles() << " tiles\n";
+    }
+    int diff = max_difference(inc.frame(), ref.frame());
+    std::cerr << "after " << steps << " edits: max difference from a full render " << diff << "\n";
+
+    TGAImage image;
+    inc.frame().to_tga(image);
+    write_image(image, "incremental.tga", true);
+    return diff == 0 ? 0 : 1;
+}
 
-        for (int i = 0; i < 3; i++) {
-            float v = c[i] * I;
-            c[i] = (unsigned char)std::min(255.f, v);
+// Follows a ShmRingStream the way a viewer would, until nframes new
+// frames arrived or none came for five seconds, and saves the last one.
+static int shm_watch(const std::string& name, int nframes) {
+    ShmRingReader reader;
+    if (!reader.open(name)) return 1;
+    std::vector<uint32_t> pixels;
+    uint64_t last = 0, first = 0;
+    int seen = 0;
+    auto idle = std::chrono::steady_clock::now();
+    while (seen < nframes) {
+        uint64_t n = reader.read(last, pixels);
+        if (!n) {
+            if (std::chrono::steady_clock::now() - idle > std::chrono::seconds(5)) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
         }
-        color = c;
-        return false;
+        if (!first) first = n;
+        last = n;
+        seen++;
+        idle = std::chrono::steady_clock::now();
     }
-};
+    if (!seen) {
+        std::cerr << "no frames on " << name << "\n";
+        return 1;
+    }
+    std::cerr << seen << " frames read from " << name << ", " << first << " to " << last << " ("
+        << (last - first + 1 - seen) << " skipped)\n";
 
+    int w = reader.width(), h = reader.height();
+    TGAImage image(w, h, TGAImage::RGB);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) image.set(x, y, unpack_color(pixels[(size_t)y * w + x]));
+    }
+    return write_image(image, "shm_frame.tga", false) ? 0 : 1;
+}
 
+static int poster(const std::vector<DrawCall>& draws, int w, int h, int band_rows,
+    const std::string& path) {
+    auto t0 = std::chrono::steady_clock::now();
+    PosterInfo info;
+    if (!render_poster(camera, light_dir, draws, w, h, band_rows, path, &info)) return 1;
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    reset_frame_arenas();
+
+    std::cerr << "poster " << path << " " << w << "x" << h << " in " << info.bands << " bands, "
+        << s << " s\n"
+        << "band buffer    " << (info.band_bytes >> 10) << " KB, bins " << (info.bin_bytes >> 10)
+        << " KB (whole frame " << (info.frame_bytes >> 20) << " MB)\n";
+    return 0;
+}
 
-int main() {
-    TGAImage frame(width, height, TGAImage::RGB);
-    TGAImage zbuffer(width, height, TGAImage::GRAYSCALE);
+static int bake_ao_map(Model& model, const std::string& obj_path, const AOBakeParams& params) {
+    BVH bvh(model);
+    bvh.print_stats(std::cerr);
 
-    
-    Matrix ModelView = camera.getModelView();
-    Matrix Projection = camera.getProjection();
-    Matrix Viewport = camera.getViewport(width / 8, height / 8,
-        width * 3 / 4, height * 3 / 4);
-    Matrix MIT = ModelView.invert_transpose();
+    auto t0 = std::chrono::steady_clock::now();
+    TGAImage ao;
+    bake_ao(model, bvh, params, ao);
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
 
-   
-    light_dir.normalize();
-    Vec3f L_cam = proj<3>(ModelView * embed<4>(light_dir, 0.f)).normalize();
+    std::string path = ao_map_path(obj_path);
+    if (!write_image(ao, path, true)) return 1;
+    std::cerr << "baked " << path << " (" << params.size << "x" << params.size << ", "
+        << params.samples << " rays/texel) in " << s << " s\n";
+    return 0;
+}
 
-    GouraudPhongShader shader;
-    shader.uniform_P = Projection;
-    shader.uniform_light_dir = L_cam;
+static void usage() {
+    std::cerr << "usage: Lab3 [--msaa 4|8] [--stats] [--heatmap] [--out file.tga|.ppm|.pam|.qoi]\n"
+                 "            [--lights N|file] [--no-tiles]\n"
+                 "            [--hdr [--exposure E] [--bloom S] [--blur sigma]]\n"
+                 "            [--ssaa N [--filter box|bilinear|mitchell|lanczos]] [--bc]\n"
+                 "            [--compact]                      quantized vertices\n"
+                 "            [--instances N]                  N instanced heads instead of the scene\n"
+                 "            [--head file.obj]                another model in the head's place, e.g.\n"
+                 "                                             obj/head_materials.obj (two materials)\n"
+                 "                                             render one frame (output.tga)\n"
+                 "       Lab3 --orbit N [prefix]               N-frame turntable\n"
+                 "       Lab3 --keyframes file N [prefix]      N frames along keyframes\n"
+                 "            [--y4m path|-] [--rgb path|-] [--shm name]\n"
+                 "                                             stream the frames instead of writing files\n"
+                 "       Lab3 --shm-read name [N]              follow a --shm stream, save shm_frame.tga\n"
+                 "       Lab3 --views N [size] [prefix]        N turntable thumbnails in one pass\n"
+                 "       Lab3 --bvh [size]                     BVH build and ray casting benchmark\n"
+                 "       Lab3 --bake-ao [size] [samples]       bake obj/head_ao.tga\n"
+                 "       Lab3 --bc-bench [samples]             compressed texture sampling benchmark\n"
+                 "       Lab3 --edit [steps]                   incremental relight / move session\n"
+                 "       Lab3 --poster W H [band] [file]       W x H image rendered and written a band of\n"
+                 "                                             rows at a time (poster.tga or .ppm)\n"
+                 "       Lab3 --serve [--socket path] [--cache-mb N] [--workers N] [--bc] [--compact]\n"
+                 "                                             render jobs from stdin or a socket\n"
+                 "Any mode also takes --trace file.json to record a Chrome trace-event timeline.\n";
+}
 
-    
+static int serve(int argc, char** argv) {
+    const char* socket_path = NULL;
+    size_t cache_mb = 256;
+    int nworkers = 0;
+    bool compress = false;
+    bool compact = false;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--bc")) compress = true;
+        else if (!strcmp(argv[i], "--compact")) compact = true;
+        else if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        else if (!strcmp(argv[i], "--socket")) socket_path = argv[++i];
+        else if (!strcmp(argv[i], "--cache-mb")) cache_mb = (size_t)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--workers")) nworkers = atoi(argv[++i]);
+        else {
+            usage();
+            return 1;
+        }
+    }
 
-    Model head("obj/head.obj");
-    model = &head;
+    RenderServer server(cache_mb << 20, nworkers, compress, compact);
+    if (socket_path) return server.serve_socket(socket_path) ? 0 : 1;
+    server.serve_stream(std::cin, std::cout);
+    return 0;
+}
 
-    shader.is_transparent = false;
-    shader.alpha = 1.0f;
-    shader.uniform_M = ModelView;
-    shader.uniform_MIT = MIT;
+static int run(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "--serve")) {
+        return serve(argc, argv);
+    }
 
-    for (int i = 0; i < head.nfaces(); i++) {
-        Vec4f clip_verts[3];
-        for (int j = 0; j < 3; j++) {
-            clip_verts[j] = shader.vertex(i, j);
-            clip_verts[j] = Viewport * clip_verts[j];
+    if (argc > 2 && !strcmp(argv[1], "--shm-read")) {
+        int nframes = argc > 3 ? atoi(argv[3]) : 1;
+        if (nframes <= 0) {
+            usage();
+            return 1;
         }
-        triangle(clip_verts, shader, frame, zbuffer);
+        return shm_watch(argv[2], nframes);
+    }
+
+    // --bc, --compact, --instances and --head apply to every mode, so
+    // they are picked out before loading.
+    bool compress = false;
+    bool compact = false;
+    int ninstances = 0;
+    const char* head_path = "obj/head.obj";
+    for (int i = 1; i < argc; i++) {
+        compress = compress || !strcmp(argv[i], "--bc");
+        compact = compact || !strcmp(argv[i], "--compact");
+        if (!strcmp(argv[i], "--instances") && i + 1 < argc) ninstances = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "--head") && i + 1 < argc) head_path = argv[i + 1];
     }
 
-    
+    Model head(head_path, compress, compact);
+    Model cube("obj/Cube.obj", compress, compact);
+    Scene scene;
+    build_scene(scene, head, cube, ninstances);
+    std::vector<DrawCall> draws;
+    scene.build_draws(draws);
+    if (ninstances > 0) {
+        std::cerr << ninstances << " instances sharing " << (head.memory_bytes() >> 10)
+            << " KB of model data\n";
+    }
 
-    Model cube("obj/Cube.obj");
-    model = &cube;
+    if (argc > 2 && !strcmp(argv[1], "--views")) {
+        int nviews = atoi(argv[2]);
+        int size = argc > 3 ? atoi(argv[3]) : 128;
+        if (nviews <= 0 || size <= 0) {
+            usage();
+            return 1;
+        }
+        return render_thumbnails(nviews, size, draws, argc > 4 ? argv[4] : "view_");
+    }
 
-    shader.is_transparent = true;
-    shader.alpha = 0.35f;   
+    if (argc > 1 && !strcmp(argv[1], "--bvh")) {
+        int size = argc > 2 ? atoi(argv[2]) : 512;
+        if (size <= 0) {
+            usage();
+            return 1;
+        }
+        return bvh_bench(head, size);
+    }
 
-   
-    Matrix CubeModelView = ModelView;
+    if (argc > 1 && !strcmp(argv[1], "--bc-bench")) {
+        int nsamples = argc > 2 ? atoi(argv[2]) : 1 << 22;
+        if (nsamples <= 0) {
+            usage();
+            return 1;
+        }
+        return texture_bench(head, head_path, nsamples);
+    }
 
-    
-    Matrix Scale = Matrix::identity();
-    float s = 1.85f;                  
-    Scale[0][0] = s;
-    Scale[1][1] = s;
-    Scale[2][2] = s;
+    if (argc > 1 && !strcmp(argv[1], "--edit")) {
+        int steps = argc > 2 ? atoi(argv[2]) : 10;
+        if (steps < 0) {
+            usage();
+            return 1;
+        }
+        return edit_session(draws, steps);
+    }
 
-    CubeModelView = Scale * CubeModelView;
+    if (argc > 3 && !strcmp(argv[1], "--poster")) {
+        int w = atoi(argv[2]), h = atoi(argv[3]);
+        int band_rows = argc > 4 ? atoi(argv[4]) : 256;
+        if (w <= 0 || h <= 0 || band_rows <= 0) {
+            usage();
+            return 1;
+        }
+        return poster(draws, w, h, band_rows, argc > 5 ? argv[5] : "poster.tga");
+    }
 
-   
-    CubeModelView[1][3] -= 0.05f;    
+    if (argc > 1 && !strcmp(argv[1], "--bake-ao")) {
+        AOBakeParams params;
+        if (argc > 2) params.size = atoi(argv[2]);
+        if (argc > 3) params.samples = atoi(argv[3]);
+        if (params.size <= 0 || params.samples <= 0) {
+            usage();
+            return 1;
+        }
+        return bake_ao_map(head, head_path, params);
+    }
 
-    shader.uniform_M = CubeModelView;
-    shader.uniform_MIT = CubeModelView.invert_transpose();
+    if (argc > 1 && (!strcmp(argv[1], "--orbit") || !strcmp(argv[1], "--keyframes"))) {
+        // The stream options may come anywhere after the mode.
+        std::vector<char*> pos;
+        std::unique_ptr<FrameStream> stream;
+        for (int i = 0; i < argc; i++) {
+            bool y4m = !strcmp(argv[i], "--y4m"), rgb = !strcmp(argv[i], "--rgb");
+            if ((y4m || rgb) && i + 1 < argc) {
+                PipeStream* s = new PipeStream(y4m ? PipeStream::Y4M : PipeStream::RGB24, width, height);
+                stream.reset(s);
+                if (!s->open(argv[++i])) return 1;
+            }
+            else if (!strcmp(argv[i], "--shm") && i + 1 < argc) {
+                ShmRingStream* s = new ShmRingStream();
+                stream.reset(s);
+                if (!s->open(argv[++i], width, height)) return 1;
+            }
+            else pos.push_back(argv[i]);
+        }
+        int npos = (int)pos.size();
+
+        CameraPath path;
+        int nframes = 0;
+        std::string prefix = "frame_";
+        if (!strcmp(pos[1], "--orbit") && npos > 2) {
+            path = CameraPath::orbit(camera.getEye(), camera.getCenter(), camera.getUp());
+            nframes = atoi(pos[2]);
+            if (npos > 3) prefix = pos[3];
+        }
+        else if (!strcmp(pos[1], "--keyframes") && npos > 3) {
+            if (!path.load_keyframes(pos[2])) return 1;
+            nframes = atoi(pos[3]);
+            if (npos > 4) prefix = pos[4];
+        }
+        if (path.empty() || nframes <= 0) {
+            usage();
+            return 1;
+        }
+        return render_sequence(path, nframes, draws, prefix, stream.get());
+    }
 
-    for (int i = 0; i < cube.nfaces(); i++) {
-        Vec4f clip_verts[3];
-        for (int j = 0; j < 3; j++) {
-            clip_verts[j] = shader.vertex(i, j);
-            clip_verts[j] = Viewport * clip_verts[j];
+    int msaa = 0;
+    bool stats = false;
+    bool heatmap = false;
+    std::string out_path = "output.tga";
+    std::vector<Light> lights;
+    bool tile_culling = true;
+    bool hdr = false;
+    float exposure = 1.f;
+    float bloom = 0.3f;
+    float blur = 0.f;
+    int ssaa = 1;
+    ResampleFilter filter = RESAMPLE_LANCZOS3;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--msaa") && i + 1 < argc) {
+            msaa = atoi(argv[++i]);
+            if (msaa != 4 && msaa != 8) {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--stats")) stats = true;
+        else if (!strcmp(argv[i], "--heatmap")) heatmap = true;
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc) out_path = argv[++i];
+        else if (!strcmp(argv[i], "--lights") && i + 1 < argc) {
+            const char* arg = argv[++i];
+            char* end;
+            long n = strtol(arg, &end, 10);
+            if (*end == '\0' && n > 0) lights = make_light_rig((int)n);
+            else if (!load_lights(arg, lights)) return 1;
         }
-        triangle(clip_verts, shader, frame, zbuffer);
+        else if (!strcmp(argv[i], "--no-tiles")) tile_culling = false;
+        else if (!strcmp(argv[i], "--bc") || !strcmp(argv[i], "--compact")) continue;
+        else if ((!strcmp(argv[i], "--instances") || !strcmp(argv[i], "--head")) && i + 1 < argc) i++;
+        else if (!strcmp(argv[i], "--hdr")) hdr = true;
+        else if (!strcmp(argv[i], "--exposure") && i + 1 < argc) exposure = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--bloom") && i + 1 < argc) bloom = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--blur") && i + 1 < argc) blur = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--ssaa") && i + 1 < argc) ssaa = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            if (!parse_resample_filter(argv[++i], filter)) {
+                usage();
+                return 1;
+            }
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (hdr && msaa) {
+        std::cerr << "--hdr does not support --msaa\n";
+        return 1;
+    }
+
+    // Supersampling renders at ssaa times the size and filters down.
+    int rw = width * ssaa;
+    int rh = height * ssaa;
+    Framebuffer frame(rw, rh);
+    if (hdr) frame.enable_hdr();
+
+    OverdrawMap overdraw(heatmap ? rw : 0, heatmap ? rh : 0);
+    if (heatmap) set_overdraw_map(&overdraw);
+
+    FrameGeometry geo;
+    vertex_stage(camera, light_dir, rw, rh, draws, geo, lights.empty() ? nullptr : &lights);
+    geo.tile_culling = tile_culling;
+    if (msaa) {
+        MSAATarget target(rw, rh, msaa);
+        raster_stage(geo, draws, target);
+        target.resolve(frame);
+    }
+    else {
+        raster_stage(geo, draws, frame);
     }
 
-   
+    set_overdraw_map(nullptr);
 
-    frame.flip_vertically();
-    frame.write_tga_file("output.tga");
+    PostChain post;
+    if (hdr) {
+        if (blur > 0.f) post.add(std::unique_ptr<PostPass>(new BlurPass(blur)));
+        if (bloom > 0.f) post.add(std::unique_ptr<PostPass>(new BloomPass(1.f, bloom, 4.f)));
+        post.add(std::unique_ptr<PostPass>(new ToneMapPass(ToneMapPass::ACES, exposure)));
+        post.run(*frame.hdr(), frame);
+    }
+
+    ArenaStats arena = reset_frame_arenas();
+    if (stats) {
+        collect_stats().print(std::cerr);
+        arena.print(std::cerr);
+        if (hdr) post.print_timings(std::cerr);
+    }
+    if (heatmap) {
+        overdraw.write_heatmap("overdraw.tga", true);
+        overdraw.write_heatmap("depth_complexity.tga", false);
+    }
+
+    TGAImage image;
+    frame.to_tga(image);
+    if (ssaa > 1) {
+        auto t0 = std::chrono::steady_clock::now();
+        image.scale(width, height, filter);
+        if (stats) {
+            std::cerr << "resample " << rw << "x" << rh << " -> " << width << "x" << height << " "
+                << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count()
+                << " ms\n";
+        }
+    }
+    write_image(image, out_path, true);
 
     std::cout << "DONE!\n";
     return 0;
 }
+
+
+// --trace is taken out of the arguments before the modes parse them, so
+// it can follow positional arguments too.
+int main(int argc, char** argv) {
+    std::vector<char*> args;
+    const char* trace_path = NULL;
+    for (int i = 0; i < argc; i++) {
+        if (i > 0 && !strcmp(argv[i], "--trace") && i + 1 < argc) trace_path = argv[++i];
+        else args.push_back(argv[i]);
+    }
+#if !MY_GL_TRACE
+    if (trace_path) {
+        std::cerr << "--trace ignored: built with MY_GL_TRACE=0\n";
+        trace_path = NULL;
+    }
+#endif
+    if (trace_path) trace_start();
+    int status = run((int)args.size(), args.data());
+    if (trace_path && !trace_dump(trace_path)) status = 1;
+    return status;
+}
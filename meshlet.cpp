@@ -0,0 +1,199 @@
+#include <cmath>
+#include <algorithm>
+#include "meshlet.h"
+#include "trace.h"
+
+static void meshlet_bounds(const std::vector<Vec3f>& verts, const std::vector<std::vector<int>>& faces,
+    const int* ids, int n, Meshlet& m) {
+    Vec3f lo = verts[faces[ids[0]][0]], hi = lo;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            const Vec3f& v = verts[faces[ids[i]][j]];
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], v[k]);
+                hi[k] = std::max(hi[k], v[k]);
+            }
+        }
+    }
+    m.center = (lo + hi) * 0.5f;
+    float r2 = 0.f;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            Vec3f d = verts[faces[ids[i]][j]] - m.center;
+            r2 = std::max(r2, d * d);
+        }
+    }
+    m.radius = std::sqrt(r2);
+
+
+    std::vector<Vec3f> normals;
+    Vec3f sum(0.f, 0.f, 0.f);
+    for (int i = 0; i < n; i++) {
+        const std::vector<int>& f = faces[ids[i]];
+        Vec3f nrm = cross(verts[f[1]] - verts[f[0]], verts[f[2]] - verts[f[0]]);
+        float len = nrm.norm();
+        if (len <= 0.f) continue;
+        nrm = nrm / len;
+        normals.push_back(nrm);
+        sum = sum + nrm;
+    }
+    m.cone_axis = Vec3f(0.f, 0.f, 1.f);
+    m.cone_cutoff = 1.f;
+    float len = sum.norm();
+    if (normals.empty() || len < 1e-6f) return;
+
+    m.cone_axis = sum / len;
+    float mindp = 1.f;
+    for (size_t i = 0; i < normals.size(); i++) mindp = std::min(mindp, normals[i] * m.cone_axis);
+    // Past ~85 degrees the cone is too wide to be worth testing.
+    if (mindp > 0.1f) m.cone_cutoff = std::sqrt(1.f - mindp * mindp);
+}
+
+void build_meshlets(const std::vector<Vec3f>& verts, const std::vector<std::vector<int>>& faces,
+    std::vector<Meshlet>& meshlets, std::vector<int>& order) {
+    TRACE_SCOPE("build_meshlets");
+    int nfaces = (int)faces.size();
+    int nverts = (int)verts.size();
+    meshlets.clear();
+    order.clear();
+    order.reserve(nfaces);
+
+    // vertex -> faces adjacency
+    std::vector<int> start(nverts + 1, 0);
+    for (int i = 0; i < nfaces; i++)
+        for (int j = 0; j < 3; j++) start[faces[i][j] + 1]++;
+    for (int v = 0; v < nverts; v++) start[v + 1] += start[v];
+    std::vector<int> adj(start[nverts]);
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    for (int i = 0; i < nfaces; i++)
+        for (int j = 0; j < 3; j++) adj[fill[faces[i][j]]++] = i;
+
+    std::vector<Vec3f> normal(nfaces);
+    std::vector<Vec3f> centroid(nfaces);
+    float area = 0.f;
+    for (int i = 0; i < nfaces; i++) {
+        const std::vector<int>& f = faces[i];
+        Vec3f n = cross(verts[f[1]] - verts[f[0]], verts[f[2]] - verts[f[0]]);
+        float len = n.norm();
+        normal[i] = len > 0.f ? n / len : Vec3f(0.f, 0.f, 0.f);
+        centroid[i] = (verts[f[0]] + verts[f[1]] + verts[f[2]]) / 3.f;
+        area += len * 0.5f;
+    }
+    // Radius of a disc holding MESHLET_MIN_TRIANGLES average faces.
+    float expected_radius = std::sqrt(MESHLET_MIN_TRIANGLES * area / std::max(1, nfaces) / 3.14159265f);
+    if (expected_radius <= 0.f) expected_radius = 1.f;
+
+    // Grow each cluster from the lowest unassigned face, always taking the
+    // frontier face that is best aligned with the cluster's mean normal and
+    // closest to its centroid. Past MESHLET_MIN_TRIANGLES the cluster stops
+    // as soon as that face would widen the normal cone too much.
+    const float min_alignment = 0.7f;
+    std::vector<char> taken(nfaces, 0);
+    std::vector<int> stamp(nfaces, -1);
+    std::vector<int> frontier;
+    int seed = 0;
+    while (seed < nfaces) {
+        if (taken[seed]) {
+            seed++;
+            continue;
+        }
+
+        int id = (int)meshlets.size();
+        Meshlet m;
+        m.first = (int)order.size();
+        m.count = 0;
+        Vec3f axis(0.f, 0.f, 0.f);
+        Vec3f sum(0.f, 0.f, 0.f);
+
+        frontier.clear();
+        frontier.push_back(seed);
+        stamp[seed] = id;
+        while (!frontier.empty() && m.count < MESHLET_MAX_TRIANGLES) {
+            Vec3f dir = axis;
+            float len = dir.norm();
+            if (len > 0.f) dir = dir / len;
+            Vec3f mid = m.count ? sum / (float)m.count : centroid[seed];
+            size_t best = 0;
+            float best_score = -1e30f;
+            float best_dp = 1.f;
+            for (size_t q = 0; q < frontier.size(); q++) {
+                float dp = len > 0.f ? normal[frontier[q]] * dir : 1.f;
+                float score = dp - (centroid[frontier[q]] - mid).norm() / expected_radius;
+                if (score > best_score) {
+                    best_score = score;
+                    best_dp = dp;
+                    best = q;
+                }
+            }
+            if (m.count >= MESHLET_MIN_TRIANGLES && best_dp < min_alignment) break;
+
+            int f = frontier[best];
+            frontier[best] = frontier.back();
+            frontier.pop_back();
+            taken[f] = 1;
+            order.push_back(f);
+            m.count++;
+            axis = axis + normal[f];
+            sum = sum + centroid[f];
+
+            for (int j = 0; j < 3; j++) {
+                int v = faces[f][j];
+                for (int k = start[v]; k < start[v + 1]; k++) {
+                    int g = adj[k];
+                    if (taken[g] || stamp[g] == id) continue;
+                    stamp[g] = id;
+                    frontier.push_back(g);
+                }
+            }
+        }
+
+        std::sort(order.begin() + m.first, order.end());
+        meshlet_bounds(verts, faces, &order[m.first], m.count, m);
+        meshlets.push_back(m);
+    }
+}
+
+
+ClusterCuller::ClusterCuller(const Matrix& MV_, const Matrix& Projection, const Matrix& Viewport,
+    int width, int height, bool cull_backfaces)
+    : MV(MV_), MIT(MV_.invert_transpose()), scale(0.f), eye(0.f, 0.f, 0.f), backfaces(cull_backfaces) {
+    Matrix F = Viewport * Projection;
+    for (int i = 0; i < 4; i++) {
+        planes[0][i] = F[0][i];
+        planes[1][i] = width * F[3][i] - F[0][i];
+        planes[2][i] = F[1][i];
+        planes[3][i] = height * F[3][i] - F[1][i];
+        planes[4][i] = F[3][i];
+    }
+    for (int p = 0; p < 5; p++) {
+        float len = std::sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+        if (len > 0.f)
+            for (int i = 0; i < 4; i++) planes[p][i] /= len;
+    }
+
+    for (int j = 0; j < 3; j++) {
+        Vec3f col(MV[0][j], MV[1][j], MV[2][j]);
+        scale = std::max(scale, col.norm());
+    }
+
+    // The projection eye is where w vanishes on the view axis.
+    if (Projection[3][2] != 0.f) eye.z = -Projection[3][3] / Projection[3][2];
+    else backfaces = false;
+}
+
+bool ClusterCuller::visible(const Meshlet& m) const {
+    Vec3f c = proj<3>(MV * embed<4>(m.center, 1.f));
+    float r = m.radius * scale;
+
+    for (int p = 0; p < 5; p++) {
+        float d = planes[p][0] * c.x + planes[p][1] * c.y + planes[p][2] * c.z + planes[p][3];
+        if (d < -r) return false;
+    }
+
+    if (backfaces && m.cone_cutoff < 1.f) {
+        Vec3f axis = proj<3>(MIT * embed<4>(m.cone_axis, 0.f)).normalize();
+        Vec3f d = c - eye;
+        if (d * axis >= m.cone_cutoff * d.norm() + r) return false;
+    }
+    return true;
+}
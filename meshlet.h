@@ -0,0 +1,55 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+
+#include <vector>
+#include "geometry.h"
+
+// A cluster of neighbouring faces, MESHLET_MIN_TRIANGLES to
+// MESHLET_MAX_TRIANGLES of them where the mesh allows. Faces are
+// referenced through Model::meshlet_faces()[first .. first + count).
+// The bounding sphere and normal cone are in model space; cone_cutoff is
+// the sine of the cone half-angle, >= 1 if the faces spread too much for
+// the cluster to ever be back-facing as a whole.
+struct Meshlet {
+    int   first;
+    int   count;
+    Vec3f center;
+    float radius;
+    Vec3f cone_axis;
+    float cone_cutoff;
+};
+
+const int MESHLET_MIN_TRIANGLES = 64;
+const int MESHLET_MAX_TRIANGLES = 128;
+
+// Greedily grows clusters over faces that share vertices, preferring faces
+// whose normals agree so the cones stay narrow. Clusters are cut short of
+// MESHLET_MIN_TRIANGLES only where the surface runs out.
+// order receives the face indices grouped by meshlet (ascending within
+// each meshlet, so a single-meshlet model keeps its OBJ draw order).
+void build_meshlets(const std::vector<Vec3f>& verts, const std::vector<std::vector<int>>& faces,
+    std::vector<Meshlet>& meshlets, std::vector<int>& order);
+
+
+// Cluster culling for one draw, done in view space before vertex shading:
+// the bounding sphere against the side planes of the screen rectangle and
+// the plane through the projection eye, and the normal cone against the
+// eye. MV must be a similarity transform (rotation, uniform scale,
+// translation) for the cone and radius to carry over.
+class ClusterCuller {
+public:
+    ClusterCuller(const Matrix& MV, const Matrix& Projection, const Matrix& Viewport,
+        int width, int height, bool cull_backfaces);
+
+    bool visible(const Meshlet& m) const;
+
+private:
+    float  planes[5][4];
+    Matrix MV;
+    Matrix MIT;
+    float  scale;
+    Vec3f  eye;
+    bool   backfaces;
+};
+
+#endif // __MESHLET_H__
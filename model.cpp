@@ -1,231 +1,556 @@
 #include "model.h"
+#include "arena.h"
+#include "trace.h"
 #include <fstream>
-#include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <cstdlib>
+#include <map>
 
-Model::Model(const char* filename)
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Reads up to n blank-separated floats from the current line; missing
+// ones are left alone.
+static const char* parse_floats(const char* p, float* out, int n) {
+    for (int i = 0; i < n; i++) {
+        while (is_blank(*p)) p++;
+        char* end;
+        float f = strtof(p, &end);
+        if (end == p) break;
+        out[i] = f;
+        p = end;
+    }
+    return p;
+}
+
+// Past the keyword if the line starts with it, leading blanks allowed;
+// NULL otherwise.
+static const char* keyword(const char* p, const char* eol, const char* kw) {
+    while (p < eol && is_blank(*p)) p++;
+    for (; *kw; kw++, p++) {
+        if (p >= eol || *p != *kw) return NULL;
+    }
+    return p < eol && is_blank(*p) ? p : NULL;
+}
+
+// The rest of the line without surrounding blanks.
+static std::string line_text(const char* p, const char* eol) {
+    while (p < eol && is_blank(*p)) p++;
+    while (eol > p && is_blank(eol[-1])) eol--;
+    return std::string(p, eol);
+}
+
+// The last blank-separated token; map statements put their options first.
+static std::string last_token(const char* p, const char* eol) {
+    while (eol > p && is_blank(eol[-1])) eol--;
+    const char* s = eol;
+    while (s > p && !is_blank(s[-1])) s--;
+    return std::string(s, eol);
+}
+
+static std::string directory_of(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+static std::string resolve(const std::string& dir, const std::string& path) {
+    bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+    return absolute ? path : dir + path;
+}
+
+static bool read_file(const std::string& path, Arena& arena, char*& text) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in.is_open()) return false;
+    in.seekg(0, std::ios::end);
+    size_t size = (size_t)in.tellg();
+    in.seekg(0, std::ios::beg);
+    text = arena.alloc_array<char>(size + 1);
+    in.read(text, size);
+    text[in.gcount()] = '\0';
+    return true;
+}
+
+namespace {
+
+// Map paths of the materials named so far, by index into the materials.
+struct MaterialMaps {
+    std::string diffuse, normal, specular;
+};
+
+struct MaterialTable {
+    std::vector<Material>      materials;
+    std::vector<MaterialMaps>  maps;
+    std::map<std::string, int> index;
+
+    int find_or_add(const std::string& name) {
+        std::map<std::string, int>::iterator it = index.find(name);
+        if (it != index.end()) return it->second;
+        Material m;
+        m.name = name;
+        materials.push_back(m);
+        maps.push_back(MaterialMaps());
+        index[name] = (int)materials.size() - 1;
+        return (int)materials.size() - 1;
+    }
+};
+
+} // namespace
+
+// Only the texture maps are read; colors and the other statements are
+// ignored.
+static void parse_mtl(const std::string& path, Arena& arena, MaterialTable& table) {
+    char* text;
+    if (!read_file(path, arena, text)) {
+        std::cerr << "Cannot open MTL file: " << path << std::endl;
+        return;
+    }
+    std::string dir = directory_of(path);
+    int current = -1;
+    const char* p = text;
+    while (*p) {
+        const char* eol = p;
+        while (*eol && *eol != '\n') eol++;
+
+        const char* arg;
+        if ((arg = keyword(p, eol, "newmtl"))) {
+            current = table.find_or_add(line_text(arg, eol));
+        }
+        else if (current >= 0) {
+            MaterialMaps& maps = table.maps[current];
+            if ((arg = keyword(p, eol, "map_Kd"))) {
+                maps.diffuse = resolve(dir, last_token(arg, eol));
+            }
+            else if ((arg = keyword(p, eol, "norm")) || (arg = keyword(p, eol, "map_Bump")) ||
+                (arg = keyword(p, eol, "map_bump")) || (arg = keyword(p, eol, "bump"))) {
+                maps.normal = resolve(dir, last_token(arg, eol));
+            }
+            else if ((arg = keyword(p, eol, "map_Ns"))) {
+                maps.specular = resolve(dir, last_token(arg, eol));
+            }
+            else if ((arg = keyword(p, eol, "map_Ks")) && maps.specular.empty()) {
+                maps.specular = resolve(dir, last_token(arg, eol));
+            }
+        }
+
+        p = eol;
+        if (*p) p++;
+    }
+}
+
+Model::Model(const char* filename, bool compress_textures, bool compact_vertices)
     : verts_(), norms_(), uv_(),
     faces_(), uv_idx_(), norm_idx_(),
-    diffusemap_(), normalmap_(), specularmap_() {
+    meshlets_(), meshlet_faces_(), bounds_(),
+    materials_(1), ngroups_(0), ao_() {
+    TRACE_SCOPE("load_model");
+    TRACE_BEGIN(parse, "parse_obj");
+    materials_[0].name = "default";
 
-    std::ifstream in(filename);
-    if (!in.is_open()) {
+    // The file and all parsing scratch live in this arena, freed on return.
+    Arena arena(256 << 10);
+    char* text;
+    if (!read_file(filename, arena, text)) {
         std::cerr << "Cannot open OBJ file: " << filename << std::endl;
         return;
     }
 
-    std::string line;
-    while (std::getline(in, line)) {
-        std::istringstream iss(line);
-        char trash;
+    // Material 0 takes the faces before any usemtl.
+    std::string dir = directory_of(filename);
+    MaterialTable table;
+    table.find_or_add("default");
+    std::map<std::string, int> groups;
+    std::vector<int> face_material, face_group;
+    int material = 0, group = 0;
 
-        
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash; 
-            Vec3f v;
-            iss >> v.x >> v.y >> v.z;
-            verts_.push_back(v);
+    const char* p = text;
+    while (*p) {
+        const char* eol = p;
+        while (*eol && *eol != '\n') eol++;
+
+        const char* arg;
+        if (p[0] == 'v' && p[1] == ' ') {
+            float v[3] = { 0.f, 0.f, 0.f };
+            p = parse_floats(p + 2, v, 3);
+            verts_.push_back(Vec3f(v[0], v[1], v[2]));
         }
-        
-        else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash; 
-            Vec3f n;
-            iss >> n.x >> n.y >> n.z;
-            norms_.push_back(n);
-        }
-       
-        else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash; 
-            Vec2f t;
-            iss >> t.x >> t.y;
-            uv_.push_back(t);
+        else if (p[0] == 'v' && p[1] == 'n' && p[2] == ' ') {
+            float n[3] = { 0.f, 0.f, 0.f };
+            p = parse_floats(p + 3, n, 3);
+            norms_.push_back(Vec3f(n[0], n[1], n[2]));
         }
-        
-        else if (!line.compare(0, 2, "f ")) {
-            iss >> trash; 
-
-            std::vector<int> v_idx;
-            std::vector<int> t_idx;
-            std::vector<int> n_idx;
-
-            std::string token;
-            while (iss >> token) {
-                int vi = 0, ti = -1, ni = -1;
+        else if (p[0] == 'v' && p[1] == 't' && p[2] == ' ') {
+            float t[2] = { 0.f, 0.f };
+            p = parse_floats(p + 3, t, 2);
+            uv_.push_back(Vec2f(t[0], t[1]));
+        }
+        else if (p[0] == 'f' && p[1] == ' ') {
+            // At most one corner per two characters of the line.
+            size_t max_corners = (size_t)(eol - p) / 2 + 1;
+            int* v_idx = arena.alloc_array<int>(max_corners * 3);
+            int* t_idx = v_idx + max_corners;
+            int* n_idx = t_idx + max_corners;
 
-                
-                size_t p1 = token.find('/');
-                if (p1 == std::string::npos) {
-                    
-                    vi = std::stoi(token);
-                }
-                else {
-                    
-                    vi = std::stoi(token.substr(0, p1));
-                    size_t p2 = token.find('/', p1 + 1);
+            int nv = 0;
+            p += 2;
+            for (;;) {
+                while (p < eol && is_blank(*p)) p++;
+                if (p >= eol) break;
 
-                    if (p2 == std::string::npos) {
-                        
-                        std::string tstr = token.substr(p1 + 1);
-                        if (!tstr.empty())
-                            ti = std::stoi(tstr);
+                // v, v/t, v//n or v/t/n
+                char* end;
+                int vi = (int)strtol(p, &end, 10);
+                int ti = -1, ni = -1;
+                if (end == p) break;
+                p = end;
+                if (*p == '/') {
+                    p++;
+                    if (*p != '/') {
+                        int t = (int)strtol(p, &end, 10);
+                        if (end != p) ti = t;
+                        p = end;
                     }
-                    else {
-                        
-                        if (p2 > p1 + 1) {
-                            
-                            std::string tstr = token.substr(p1 + 1, p2 - p1 - 1);
-                            if (!tstr.empty())
-                                ti = std::stoi(tstr);
-                        }
-                        
-                        if (p2 + 1 < token.size()) {
-                            std::string nstr = token.substr(p2 + 1);
-                            if (!nstr.empty())
-                                ni = std::stoi(nstr);
-                        }
+                    if (*p == '/') {
+                        p++;
+                        int n = (int)strtol(p, &end, 10);
+                        if (end != p) ni = n;
+                        p = end;
                     }
                 }
+                while (p < eol && !is_blank(*p)) p++;
 
-                
                 vi = vi - 1;
                 if (ti > 0) ti = ti - 1;
                 if (ni > 0) ni = ni - 1;
 
-                v_idx.push_back(vi);
-                t_idx.push_back(ti);
-                n_idx.push_back(ni);
+                v_idx[nv] = vi;
+                t_idx[nv] = ti;
+                n_idx[nv] = ni;
+                nv++;
             }
 
             
-            int nv = (int)v_idx.size();
-            if (nv < 3) continue;
-
-            
-            if (uv_.empty()) {
-                uv_.push_back(Vec2f(0.f, 0.f)); 
-            }
-
-            auto add_triangle = [&](int a, int b, int c) {
-                std::vector<int> f(3), fu(3), fn(3);
-                f[0] = v_idx[a]; f[1] = v_idx[b]; f[2] = v_idx[c];
-
-                for (int k = 0; k < 3; ++k) {
-                    int idxU = t_idx[(k == 0 ? a : (k == 1 ? b : c))];
-                    int idxN = n_idx[(k == 0 ? a : (k == 1 ? b : c))];
-                    
-                    fu[k] = (idxU >= 0 ? idxU : 0);
-                    fn[k] = idxN; 
+            if (nv >= 3) {
+                
+                if (uv_.empty()) {
+                    uv_.push_back(Vec2f(0.f, 0.f)); 
                 }
 
-                faces_.push_back(f);
-                uv_idx_.push_back(fu);
-                norm_idx_.push_back(fn);
-                };
+                auto add_triangle = [&](int a, int b, int c) {
+                    std::vector<int> f(3), fu(3), fn(3);
+                    int k3[3] = { a, b, c };
+                    for (int k = 0; k < 3; ++k) {
+                        f[k] = v_idx[k3[k]];
+                        int idxU = t_idx[k3[k]];
+                        
+                        fu[k] = (idxU >= 0 ? idxU : 0);
+                        fn[k] = n_idx[k3[k]]; 
+                    }
+
+                    faces_.push_back(f);
+                    uv_idx_.push_back(fu);
+                    norm_idx_.push_back(fn);
+                    face_material.push_back(material);
+                    face_group.push_back(group);
+                    };
 
-            if (nv == 3) {
-                add_triangle(0, 1, 2);
-            }
-            else if (nv == 4) {
-                
-                add_triangle(0, 1, 2);
-                add_triangle(0, 2, 3);
-            }
-            else {
                 
                 for (int i = 1; i < nv - 1; ++i) {
                     add_triangle(0, i, i + 1);
                 }
             }
         }
+        else if ((arg = keyword(p, eol, "mtllib"))) {
+            // Several files may follow; names with blanks are not supported.
+            const char* s = arg;
+            for (;;) {
+                while (s < eol && is_blank(*s)) s++;
+                if (s >= eol) break;
+                const char* e = s;
+                while (e < eol && !is_blank(*e)) e++;
+                parse_mtl(resolve(dir, std::string(s, e)), arena, table);
+                s = e;
+            }
+        }
+        else if ((arg = keyword(p, eol, "usemtl"))) {
+            material = table.find_or_add(line_text(arg, eol));
+        }
+        else if ((arg = keyword(p, eol, "g")) || (arg = keyword(p, eol, "o"))) {
+            std::string name = line_text(arg, eol);
+            std::map<std::string, int>::iterator it = groups.find(name);
+            if (it == groups.end()) it = groups.insert(std::make_pair(name, (int)groups.size() + 1)).first;
+            group = it->second;
+        }
+
+        p = eol;
+        if (*p) p++;
+    }
+
+    TRACE_END(parse);
+
+    // Unless an MTL file defines it, the default material takes the maps
+    // named after the OBJ.
+    MaterialMaps& derived = table.maps[0];
+    std::string stem(filename);
+    size_t dot = stem.find_last_of(".");
+    if (dot != std::string::npos && derived.diffuse.empty() && derived.normal.empty() && derived.specular.empty()) {
+        stem = stem.substr(0, dot);
+        derived.diffuse = stem + "_diffuse.tga";
+        derived.normal = stem + "_nm.tga";
+        derived.specular = stem + "_spec.tga";
+    }
+
+    materials_.swap(table.materials);
+    ngroups_ = (int)groups.size();
+    sort_faces(face_material, face_group);
+
+    // Clusters never straddle materials, so a draw of one material culls
+    // and shades only its own.
+    for (size_t i = 0; i < materials_.size(); i++) {
+        Material& mat = materials_[i];
+        std::vector<Meshlet> ms;
+        std::vector<int> order;
+        if (materials_.size() == 1) {
+            build_meshlets(verts_, faces_, ms, order);
+        }
+        else {
+            std::vector<std::vector<int>> subset(faces_.begin() + mat.first_face,
+                faces_.begin() + mat.first_face + mat.nfaces);
+            build_meshlets(verts_, subset, ms, order);
+            for (size_t k = 0; k < order.size(); k++) order[k] += mat.first_face;
+        }
+        mat.first_meshlet = (int)meshlets_.size();
+        mat.nmeshlets = (int)ms.size();
+        for (size_t k = 0; k < ms.size(); k++) {
+            ms[k].first += (int)meshlet_faces_.size();
+            meshlets_.push_back(ms[k]);
+        }
+        meshlet_faces_.insert(meshlet_faces_.end(), order.begin(), order.end());
+    }
+
+    Vec3f lo(0.f, 0.f, 0.f), hi(0.f, 0.f, 0.f);
+    for (size_t i = 0; i < verts_.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = i ? std::min(lo[k], verts_[i][k]) : verts_[i][k];
+            hi[k] = i ? std::max(hi[k], verts_[i][k]) : verts_[i][k];
+        }
     }
+    bounds_.first = 0;
+    bounds_.count = (int)faces_.size();
+    bounds_.center = (lo + hi) * 0.5f;
+    bounds_.radius = 0.f;
+    for (size_t i = 0; i < verts_.size(); i++)
+        bounds_.radius = std::max(bounds_.radius, (verts_[i] - bounds_.center).norm());
+    bounds_.cone_axis = Vec3f(0.f, 0.f, 1.f);
+    bounds_.cone_cutoff = 2.f;
 
-    
-    load_texture(filename, "_diffuse.tga", diffusemap_);
-    load_texture(filename, "_nm.tga", normalmap_);
-    load_texture(filename, "_spec.tga", specularmap_);
+    // Maps of the materials dropped by sort_faces are never loaded; maps
+    // named twice, here or by another model, are loaded once.
+    for (size_t i = 0; i < materials_.size(); i++) {
+        Material& mat = materials_[i];
+        const MaterialMaps& maps = table.maps[table.index[mat.name]];
+        if (!maps.diffuse.empty()) mat.diffuse = load_texture(maps.diffuse, TGAImage::RGBA, compress_textures);
+        if (!maps.normal.empty()) mat.normal = load_texture(maps.normal, TGAImage::RGBA, compress_textures);
+        if (!maps.specular.empty()) mat.specular = load_texture(maps.specular, TGAImage::GRAYSCALE, compress_textures);
+    }
+    if (dot != std::string::npos) {
+        ao_ = load_texture(std::string(filename).substr(0, dot) + "_ao.tga", TGAImage::GRAYSCALE, compress_textures);
+    }
+
+    if (compress_textures) {
+        std::vector<const Texture*> maps = textures();
+        size_t before = 0, after = 0;
+        for (size_t i = 0; i < maps.size(); i++) {
+            before += (size_t)maps[i]->width() * maps[i]->height() * maps[i]->bytespp();
+            after += maps[i]->bytes();
+        }
+        if (before) std::cerr << "textures compressed " << (before >> 10) << " KB -> " << (after >> 10) << " KB\n";
+    }
 
     std::cerr << "# v " << verts_.size()
         << " f " << faces_.size()
         << " vt " << uv_.size()
-        << " vn " << norms_.size() << std::endl;
+        << " vn " << norms_.size()
+        << " meshlets " << meshlets_.size()
+        << " materials " << materials_.size()
+        << " groups " << ngroups_ << std::endl;
+
+    if (compact_vertices) {
+        TRACE_SCOPE("compact_vertices");
+        size_t before = geometry_bytes();
+        compact_.build(verts_, norms_, uv_, faces_, uv_idx_, norm_idx_);
+        std::vector<Vec3f>().swap(verts_);
+        std::vector<Vec3f>().swap(norms_);
+        std::vector<Vec2f>().swap(uv_);
+        std::vector<std::vector<int>>().swap(faces_);
+        std::vector<std::vector<int>>().swap(uv_idx_);
+        std::vector<std::vector<int>>().swap(norm_idx_);
+        const QuantizationError& e = compact_.error();
+        std::cerr << "vertices quantized " << (before >> 10) << " KB -> " << (compact_.bytes() >> 10)
+            << " KB, max error position " << e.position << " (" << 100.f * e.position / e.bbox_diag
+            << "% of the bbox), normal " << e.normal_deg << " deg, uv " << e.uv << "\n";
+    }
 }
 
 Model::~Model() {}
 
-int Model::nverts() { return (int)verts_.size(); }
-int Model::nfaces() { return (int)faces_.size(); }
+void Model::sort_faces(const std::vector<int>& material, const std::vector<int>& group) {
+    int nf = (int)faces_.size();
+    std::vector<int> order(nf);
+    for (int i = 0; i < nf; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (material[a] != material[b]) return material[a] < material[b];
+        return group[a] < group[b];
+    });
+
+    std::vector<std::vector<int>> f(nf), fu(nf), fn(nf);
+    for (int i = 0; i < nf; i++) {
+        f[i].swap(faces_[order[i]]);
+        fu[i].swap(uv_idx_[order[i]]);
+        fn[i].swap(norm_idx_[order[i]]);
+    }
+    faces_.swap(f);
+    uv_idx_.swap(fu);
+    norm_idx_.swap(fn);
+
+    std::vector<int> count(materials_.size(), 0);
+    for (int i = 0; i < nf; i++) count[material[i]]++;
+    std::vector<Material> used;
+    int first = 0;
+    for (size_t m = 0; m < materials_.size(); m++) {
+        if (!count[m]) continue;
+        materials_[m].first_face = first;
+        materials_[m].nfaces = count[m];
+        first += count[m];
+        used.push_back(materials_[m]);
+    }
+    // A model without faces keeps the default material for its maps.
+    if (used.empty()) used.push_back(materials_[0]);
+    materials_.swap(used);
+}
+
+std::vector<const Texture*> Model::textures() const {
+    std::vector<const Texture*> maps;
+    for (size_t i = 0; i <= materials_.size(); i++) {
+        const Texture* t[3] = { ao_.get(), NULL, NULL };
+        if (i < materials_.size()) {
+            t[0] = materials_[i].diffuse.get();
+            t[1] = materials_[i].normal.get();
+            t[2] = materials_[i].specular.get();
+        }
+        for (int k = 0; k < 3; k++) {
+            if (t[k] && std::find(maps.begin(), maps.end(), t[k]) == maps.end()) maps.push_back(t[k]);
+        }
+    }
+    return maps;
+}
+
+int Model::nverts() { return compact_.empty() ? (int)verts_.size() : compact_.nverts(); }
+int Model::nfaces() { return compact_.empty() ? (int)faces_.size() : compact_.nfaces(); }
 
 Vec3f Model::vert(int i) {
+    if (!compact_.empty()) return compact_.position(i);
     return verts_[i];
 }
 
 Vec3f Model::vert(int iface, int nthvert) {
+    if (!compact_.empty()) return compact_.position(compact_.corner(iface, nthvert));
     return verts_[faces_[iface][nthvert]];
 }
 
 std::vector<int> Model::face(int idx) {
+    if (!compact_.empty()) {
+        std::vector<int> f(3);
+        for (int j = 0; j < 3; j++) f[j] = compact_.corner(idx, j);
+        return f;
+    }
     return faces_[idx];
 }
 
+void Model::fetch_faces(const int* faces, int n, Vec3f* pos, Vec3f* nrm, Vec2f* uvs) {
+    if (!compact_.empty()) {
+        compact_.decode_faces(faces, n, pos, nrm, uvs);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            pos[i * 3 + j] = vert(faces[i], j);
+            nrm[i * 3 + j] = normal(faces[i], j);
+            uvs[i * 3 + j] = uv(faces[i], j);
+        }
+    }
+}
+
+size_t Model::geometry_bytes() {
+    size_t bytes = verts_.capacity() * sizeof(Vec3f);
+    bytes += norms_.capacity() * sizeof(Vec3f);
+    bytes += uv_.capacity() * sizeof(Vec2f);
+    bytes += 3 * faces_.capacity() * sizeof(std::vector<int>);
+    for (size_t i = 0; i < faces_.size(); i++) {
+        bytes += (faces_[i].capacity() + uv_idx_[i].capacity() + norm_idx_[i].capacity()) * sizeof(int);
+    }
+    return bytes + compact_.bytes();
+}
+
+size_t Model::memory_bytes() {
+    size_t bytes = sizeof(Model) + geometry_bytes();
+    bytes += meshlets_.capacity() * sizeof(Meshlet) + meshlet_faces_.capacity() * sizeof(int);
+    bytes += materials_.capacity() * sizeof(Material);
+    std::vector<const Texture*> maps = textures();
+    for (size_t i = 0; i < maps.size(); i++) bytes += maps[i]->bytes();
+    return bytes;
+}
+
 Vec2f Model::uv(int iface, int nthvert) {
+    if (!compact_.empty()) return compact_.uv(compact_.corner(iface, nthvert));
     int idx = uv_idx_[iface][nthvert];
     if (idx < 0 || idx >= (int)uv_.size()) return Vec2f(0.f, 0.f);
     return uv_[idx];
 }
 
 Vec3f Model::normal(int iface, int nthvert) {
+    if (!compact_.empty()) return compact_.normal(compact_.corner(iface, nthvert));
     int idx = norm_idx_[iface][nthvert];
     if (idx < 0 || idx >= (int)norms_.size()) return Vec3f(0.f, 0.f, 1.f);
     return norms_[idx];
 }
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
-    std::string texfile(filename);
-    size_t dot = texfile.find_last_of(".");
-    if (dot != std::string::npos) {
-        texfile = texfile.substr(0, dot) + std::string(suffix);
-        if (img.read_tga_file(texfile.c_str())) {
-            img.flip_vertically();
-            std::cerr << "texture file " << texfile << " loading ok\n";
-        }
-        else {
-            std::cerr << "texture file " << texfile << " loading failed\n";
-        }
-    }
-}
-
-TGAColor Model::diffuse(Vec2f uvf) {
-    if (diffusemap_.get_width() == 0 || diffusemap_.get_height() == 0) {
+TGAColor Model::diffuse(Vec2f uvf, int material) {
+    const Texture* t = materials_[material].diffuse.get();
+    if (!t) {
         
         return TGAColor(255, 255, 255);
     }
-    Vec2i uv(
-        int(uvf.x * diffusemap_.get_width()),
-        int(uvf.y * diffusemap_.get_height()));
-    return diffusemap_.get(uv.x, uv.y);
+    const unsigned char* p = t->texel(uvf);
+    return p ? TGAColor(p[2], p[1], p[0], p[3]) : TGAColor();
 }
 
-Vec3f Model::normal(Vec2f uvf) {
-    if (normalmap_.get_width() == 0 || normalmap_.get_height() == 0) {
+Vec3f Model::normal(Vec2f uvf, int material) {
+    const Texture* t = materials_[material].normal.get();
+    if (!t) {
         return Vec3f(0.f, 0.f, 1.f);
     }
-    Vec2i uv(
-        int(uvf.x * normalmap_.get_width()),
-        int(uvf.y * normalmap_.get_height()));
-    TGAColor c = normalmap_.get(uv.x, uv.y);
+    const unsigned char* p = t->texel(uvf);
     Vec3f res;
     for (int i = 0; i < 3; i++)
-        res[2 - i] = (float)c[i] / 255.f * 2.f - 1.f;
+        res[2 - i] = (p ? p[i] : 0) / 255.f * 2.f - 1.f;
     return res;
 }
 
-float Model::specular(Vec2f uvf) {
-    if (specularmap_.get_width() == 0 || specularmap_.get_height() == 0) {
+float Model::specular(Vec2f uvf, int material) {
+    const Texture* t = materials_[material].specular.get();
+    if (!t) {
         return 0.f;
     }
-    Vec2i uv(
-        int(uvf.x * specularmap_.get_width()),
-        int(uvf.y * specularmap_.get_height()));
-    return specularmap_.get(uv.x, uv.y)[0] / 1.f;
+    const unsigned char* p = t->texel(uvf);
+    return p ? p[0] / 1.f : 0.f;
+}
+
+float Model::ambient_occlusion(Vec2f uvf) {
+    if (!ao_) {
+        return 1.f;
+    }
+    const unsigned char* p = ao_->texel(uvf);
+    return p ? p[0] / 255.f : 0.f;
 }
@@ -3,8 +3,30 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "meshlet.h"
+#include "texture_cache.h"
+#include "compact_mesh.h"
+
+// A material of the OBJ's mtllib files and the faces that use it. Faces
+// are stored grouped by material (and by g/o group within it), so its
+// faces are [first_face, first_face + nfaces) and its clusters
+// [first_meshlet, first_meshlet + nmeshlets). Maps come from the shared
+// texture cache; missing ones are null. Faces before any usemtl, and OBJs
+// without materials, get "default" with the <obj>_diffuse/_nm/_spec.tga
+// maps next to the OBJ.
+struct Material {
+    std::string name;
+    int first_face = 0;
+    int nfaces = 0;
+    int first_meshlet = 0;
+    int nmeshlets = 0;
+    std::shared_ptr<const Texture> diffuse;      // map_Kd
+    std::shared_ptr<const Texture> normal;       // norm, map_Bump or bump
+    std::shared_ptr<const Texture> specular;     // map_Ns, else map_Ks
+};
 
 class Model {
 private:
@@ -18,15 +40,33 @@ private:
     std::vector<std::vector<int>> uv_idx_;        
     std::vector<std::vector<int>> norm_idx_;     
 
-    
-    TGAImage diffusemap_;
-    TGAImage normalmap_;
-    TGAImage specularmap_;
+    std::vector<Meshlet> meshlets_;
+    std::vector<int>     meshlet_faces_;
+    Meshlet              bounds_;
+
+    // Quantized corners; when built the float arrays and index vectors
+    // above are released.
+    CompactMesh compact_;
 
-    void load_texture(std::string filename, const char* suffix, TGAImage& img);
+    std::vector<Material>          materials_;
+    int                            ngroups_;
+    // Baked for the whole model, <obj>_ao.tga.
+    std::shared_ptr<const Texture> ao_;
+
+    // Stable-sorts the faces by material and group and sets the material
+    // face ranges.
+    void sort_faces(const std::vector<int>& material, const std::vector<int>& group);
+    // Every map of the model once, AO included.
+    std::vector<const Texture*> textures() const;
+    // Vertex data and indices, float or quantized.
+    size_t geometry_bytes();
 
 public:
-    Model(const char* filename);
+    // compress_textures loads the maps block-compressed (see
+    // block_texture.h) instead of as decoded images; compact_vertices
+    // keeps the geometry quantized (see compact_mesh.h). With compact
+    // vertices, vert(i) and face() index the welded corners.
+    Model(const char* filename, bool compress_textures = false, bool compact_vertices = false);
     ~Model();
 
     int nverts();
@@ -39,13 +79,36 @@ public:
     Vec3f vert(int iface, int nthvert);
     Vec3f normal(int iface, int nthvert);
     Vec2f uv(int iface, int nthvert);
+    // The three corners of each of n faces (3n entries per array). Normals
+    // are not necessarily unit length.
+    void fetch_faces(const int* faces, int n, Vec3f* pos, Vec3f* nrm, Vec2f* uv);
 
     
-    Vec3f normal(Vec2f uv);
-    TGAColor diffuse(Vec2f uv);
-    float specular(Vec2f uv);
+    Vec3f normal(Vec2f uv, int material = 0);
+    TGAColor diffuse(Vec2f uv, int material = 0);
+    float specular(Vec2f uv, int material = 0);
+    // Baked ambient occlusion (see ao_bake.h), 1 where no map was found.
+    float ambient_occlusion(Vec2f uv);
+    bool  has_ambient_occlusion() const { return ao_ != nullptr; }
 
     std::vector<int> face(int idx);
+
+    // Face clusters built at load time, see meshlet.h.
+    const std::vector<Meshlet>& meshlets() const { return meshlets_; }
+    const std::vector<int>& meshlet_faces() const { return meshlet_faces_; }
+    // Bounding sphere of the whole model as a meshlet over every face, with
+    // a cone that never culls; for culling instances.
+    const Meshlet& bounds() const { return bounds_; }
+    // At least one; the samplers above take an index into these.
+    int nmaterials() const { return (int)materials_.size(); }
+    const Material& material(int i) const { return materials_[i]; }
+
+    // Empty unless loaded with compact_vertices.
+    const CompactMesh& compact() const { return compact_; }
+
+    // Approximate resident size: geometry arrays plus textures, each
+    // shared texture counted once per model.
+    size_t memory_bytes();
 };
 
 #endif // __MODEL_H__
@@ -0,0 +1,80 @@
+#include <iostream>
+#include "model_cache.h"
+
+ModelCache::ModelCache(size_t budget_bytes, bool compress_textures, bool compact_vertices)
+    : budget_(budget_bytes), compress_(compress_textures), compact_(compact_vertices) {
+}
+
+std::shared_ptr<Model> ModelCache::get(const std::string& path, bool* hit) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        ModelFuture f = it->second.model;
+        lock.unlock();
+        if (hit) *hit = true;
+        return f.get();
+    }
+
+    misses_++;
+    if (hit) *hit = false;
+    std::promise<std::shared_ptr<Model>> promise;
+    lru_.push_front(path);
+    Entry e = { promise.get_future().share(), 0, lru_.begin() };
+    entries[path] = e;
+    lock.unlock();
+
+    std::shared_ptr<Model> model = std::make_shared<Model>(path.c_str(), compress_, compact_);
+    if (model->nfaces() == 0) model.reset();
+    size_t bytes = model ? model->memory_bytes() : 0;
+    promise.set_value(model);
+
+    lock.lock();
+    it = entries.find(path);
+    if (!model) {
+        lru_.erase(it->second.lru);
+        entries.erase(it);
+        return model;
+    }
+    it->second.bytes = bytes;
+    used_ += bytes;
+    evict_locked(path);
+    return model;
+}
+
+size_t ModelCache::resident_bytes() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return used_;
+}
+
+int ModelCache::hits() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return hits_;
+}
+
+int ModelCache::misses() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return misses_;
+}
+
+int ModelCache::evictions() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return evictions_;
+}
+
+void ModelCache::evict_locked(const std::string& keep) {
+    auto it = lru_.end();
+    while (used_ > budget_ && it != lru_.begin()) {
+        --it;
+        if (*it == keep) continue;
+        auto e = entries.find(*it);
+        if (e->second.bytes == 0) continue;    // still loading
+
+        std::cerr << "cache: evict " << *it << " (" << e->second.bytes / 1024 << " KiB)\n";
+        used_ -= e->second.bytes;
+        evictions_++;
+        entries.erase(e);
+        it = lru_.erase(it);
+    }
+}
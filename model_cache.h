@@ -0,0 +1,57 @@
+#ifndef __MODEL_CACHE_H__
+#define __MODEL_CACHE_H__
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <unordered_map>
+#include "model.h"
+
+// Resident set of parsed models (geometry and decoded textures), keyed by
+// OBJ path and evicted least-recently-used once their total size exceeds
+// the byte budget. Models handed out stay alive while a job still holds
+// them, even after eviction. With compress_textures and compact_vertices,
+// models are loaded with block-compressed textures and quantized
+// vertices, so more of them fit the budget.
+class ModelCache {
+public:
+    explicit ModelCache(size_t budget_bytes, bool compress_textures = false,
+        bool compact_vertices = false);
+
+    // Returns nullptr when the OBJ can't be loaded. Concurrent requests for
+    // a path that is still loading wait for that one load.
+    std::shared_ptr<Model> get(const std::string& path, bool* hit = nullptr);
+
+    // Counters are updated by the workers, so these take the lock too.
+    size_t resident_bytes();
+    size_t budget() const { return budget_; }
+    int    hits();
+    int    misses();
+    int    evictions();
+
+private:
+    typedef std::shared_future<std::shared_ptr<Model>> ModelFuture;
+
+    struct Entry {
+        ModelFuture                      model;
+        size_t                           bytes;
+        std::list<std::string>::iterator lru;
+    };
+
+    void evict_locked(const std::string& keep);
+
+    std::mutex                             mtx;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string>                 lru_;    // front = most recent
+    size_t                                 budget_;
+    bool                                   compress_;
+    bool                                   compact_;
+    size_t                                 used_ = 0;
+    int                                    hits_ = 0;
+    int                                    misses_ = 0;
+    int                                    evictions_ = 0;
+};
+
+#endif // __MODEL_CACHE_H__
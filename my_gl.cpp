@@ -1,81 +1,477 @@
 #include <cmath>
 #include <limits>
+#include <algorithm>
 #include "my_gl.h"
+#include "pipeline_stats.h"
+#include "trace.h"
 
 
-static Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P) {
-    Vec3f s[2];
-    for (int i = 2; i--; ) {
-        s[i][0] = C[i] - A[i];
-        s[i][1] = B[i] - A[i];
-        s[i][2] = A[i] - P[i];
+TriangleSetup::TriangleSetup(const Vec4f* pts, const float* varyings, int nvaryings_)
+    : nvaryings(nvaryings_) {
+    for (int i = 0; i < 3; i++) screen[i] = proj<2>(pts[i] / pts[i][3]);
+    const Vec2f& A = screen[0];
+    const Vec2f& B = screen[1];
+    const Vec2f& C = screen[2];
+
+    float area = (C.x - A.x) * (B.y - A.y) - (B.x - A.x) * (C.y - A.y);
+    valid = std::abs(area) > 1e-2f;
+    if (!valid) return;
+
+
+    edge[1].a = -(C.y - A.y) / area;
+    edge[1].b = (C.x - A.x) / area;
+    edge[1].c = (A.x * (C.y - A.y) - (C.x - A.x) * A.y) / area;
+    edge[2].a = (B.y - A.y) / area;
+    edge[2].b = -(B.x - A.x) / area;
+    edge[2].c = ((B.x - A.x) * A.y - A.x * (B.y - A.y)) / area;
+    edge[0].a = -edge[1].a - edge[2].a;
+    edge[0].b = -edge[1].b - edge[2].b;
+    edge[0].c = 1.f - edge[1].c - edge[2].c;
+
+    auto plane = [this](float q0, float q1, float q2) {
+        Plane p;
+        p.a = edge[0].a * q0 + edge[1].a * q1 + edge[2].a * q2;
+        p.b = edge[0].b * q0 + edge[1].b * q1 + edge[2].b * q2;
+        p.c = edge[0].c * q0 + edge[1].c * q1 + edge[2].c * q2;
+        return p;
+    };
+
+    float iw[3];
+    for (int i = 0; i < 3; i++) iw[i] = 1.f / pts[i][3];
+    depth = plane(pts[0][2], pts[1][2], pts[2][2]);
+    w = plane(pts[0][3], pts[1][3], pts[2][3]);
+    inv_w = plane(iw[0], iw[1], iw[2]);
+    bar[0] = plane(iw[0], 0.f, 0.f);
+    bar[1] = plane(0.f, iw[1], 0.f);
+    bar[2] = plane(0.f, 0.f, iw[2]);
+    for (int k = 0; k < nvaryings; k++) {
+        vary[k] = plane(varyings[k] * iw[0], varyings[nvaryings + k] * iw[1], varyings[2 * nvaryings + k] * iw[2]);
     }
-    Vec3f u = cross(s[0], s[1]);
-    if (std::abs(u.z) > 1e-2f)
-        return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-    return Vec3f(-1, 1, 1); 
 }
 
-void triangle(Vec4f* pts, IShader& shader, TGAImage& image, TGAImage& zbuffer) {
-    Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+void TriangleSetup::interpolate(float x, float y, Vec3f& bc, float* out) const {
+    float w = 1.f / inv_w.at(x, y);
+    for (int i = 0; i < 3; i++) bc[i] = bar[i].at(x, y) * w;
+    for (int k = 0; k < nvaryings; k++) out[k] = vary[k].at(x, y) * w;
+}
+
 
-    
+bool IShader::fragment_hdr(Vec2i pixel, Vec3f bar, const float* vary, float* color) const {
+    TGAColor c;
+    if (fragment(pixel, bar, vary, c)) return true;
+    for (int i = 0; i < 4; i++) color[i] = c[i] / 255.f;
+    return false;
+}
+
+
+ScreenRect triangle_bounds(const Vec4f* pts, const ScreenRect& clip) {
+    float minx = std::numeric_limits<float>::max(), miny = minx;
+    float maxx = -minx, maxy = -minx;
     for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 2; j++) {
-            bboxmin[j] = std::min(bboxmin[j], pts[i][j] / pts[i][3]);
-            bboxmax[j] = std::max(bboxmax[j], pts[i][j] / pts[i][3]);
-        }
+        float x = pts[i][0] / pts[i][3], y = pts[i][1] / pts[i][3];
+        minx = std::min(minx, x);
+        maxx = std::max(maxx, x);
+        miny = std::min(miny, y);
+        maxy = std::max(maxy, y);
     }
+    // Compared as floats first so far off-screen vertices cannot overflow
+    // the int conversion.
+    ScreenRect r;
+    r.x0 = minx > clip.x0 ? (int)minx : clip.x0;
+    r.y0 = miny > clip.y0 ? (int)miny : clip.y0;
+    r.x1 = maxx < clip.x1 ? (int)maxx : clip.x1;
+    r.y1 = maxy < clip.y1 ? (int)maxy : clip.y1;
+    return r;
+}
+
+void triangle(const Vec4f* pts, const float* varyings, const IShader& shader, Framebuffer& fb) {
+    triangle(pts, varyings, shader, fb,
+        ScreenRect(0, fb.y0(), fb.width() - 1, fb.y0() + fb.height() - 1));
+}
+
+void triangle(const Vec4f* pts, const float* varyings, const IShader& shader, Framebuffer& fb,
+    const ScreenRect& clip) {
+    PipelineStats st;
+    st.triangles = 1;
+    TriangleSetup ts(pts, varyings, shader.nvaryings);
+    if (!ts.valid) {
+        st.degenerate = 1;
+        GL_STATS_ADD(st);
+        return;
+    }
+
+    ScreenRect r = triangle_bounds(pts, clip);
+    int x0 = r.x0, x1 = r.x1, y0 = r.y0, y1 = r.y1;
 
-    Vec2i P;
     TGAColor color;
+    float hcolor[4];
+    HDRBuffer* hdr = fb.hdr();
+    OverdrawMap* od = overdraw_map();
+    const int nv = ts.nvaryings;
+    float vq[MAX_VARYINGS];
+    float vary[MAX_VARYINGS];
 
-    for (P.x = (int)bboxmin.x; P.x <= (int)bboxmax.x; P.x++) {
-        for (P.y = (int)bboxmin.y; P.y <= (int)bboxmax.y; P.y++) {
-            Vec3f bc_screen = barycentric(
-                proj<2>(pts[0] / pts[0][3]),
-                proj<2>(pts[1] / pts[1][3]),
-                proj<2>(pts[2] / pts[2][3]),
-                proj<2>(P)
-            );
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0)
-                continue;
+    const int kSpan = 64;
+    uint32_t span[kSpan];
+    int span_x = 0, span_n = 0;
+    // Clamped once so the HDR blend matches blend_span and the MSAA path.
+    float alpha = std::max(0.f, std::min(1.f, shader.alpha));
 
-            float z = pts[0][2] * bc_screen.x +
-                pts[1][2] * bc_screen.y +
-                pts[2][2] * bc_screen.z;
-            float w = pts[0][3] * bc_screen.x +
-                pts[1][3] * bc_screen.y +
-                pts[2][3] * bc_screen.z;
+    for (int y = y0; y <= y1; y++) {
+        uint32_t* crow = fb.row(y);
+        unsigned char* zrow = fb.depth_row(y);
+        float* hrow = hdr ? hdr->row(y - fb.y0()) : NULL;
+        float fy = (float)y;
+
+
+        float l[3];
+        for (int i = 0; i < 3; i++) l[i] = ts.edge[i].at((float)x0, fy);
+        int x = x0;
+        for (; x <= x1; x++) {
+            if (l[0] >= 0 && l[1] >= 0 && l[2] >= 0) break;
+            for (int i = 0; i < 3; i++) l[i] += ts.edge[i].a;
+        }
+        st.pixels_tested += x - x0;
+        st.outside += x - x0;
+        if (x > x1) continue;
 
-            int frag_depth = int(z / w + 0.5f);
+
+        float fx = (float)x;
+        float z = ts.depth.at(fx, fy);
+        float cw = ts.w.at(fx, fy);
+        float iw = ts.inv_w.at(fx, fy);
+        float bq[3];
+        for (int i = 0; i < 3; i++) bq[i] = ts.bar[i].at(fx, fy);
+        for (int k = 0; k < nv; k++) vq[k] = ts.vary[k].at(fx, fy);
+
+        for (; x <= x1; x++) {
+            st.pixels_tested++;
+            if (l[0] < 0 || l[1] < 0 || l[2] < 0) {
+                st.pixels_tested += x1 - x;
+                st.outside += x1 - x + 1;
+                break;
+            }
+
+            int frag_depth = int(z / cw + 0.5f);
             frag_depth = std::max(0, std::min(255, frag_depth));
 
-            
-            if (zbuffer.get(P.x, P.y)[0] > frag_depth)
-                continue;
+            if (od) od->covered[x + y * od->width]++;
 
-            bool discard = shader.fragment(bc_screen, color);
-            if (discard) continue;
+            if (zrow[x] > frag_depth) {
+                st.depth_failed++;
+            }
+            else {
+                st.fragments++;
+                if (od) od->shaded[x + y * od->width]++;
 
-            if (shader.is_transparent) {
-                
-                float a = std::max(0.f, std::min(1.f, shader.alpha));
+                float w = 1.f / iw;
+                Vec3f bc(bq[0] * w, bq[1] * w, bq[2] * w);
+                for (int k = 0; k < nv; k++) vary[k] = vq[k] * w;
 
-                TGAColor under = image.get(P.x, P.y);
-                TGAColor out;
-                for (int k = 0; k < 3; k++) {
-                    float v = under[k] * (1.f - a) + color[k] * a;
-                    out[k] = (unsigned char)std::max(0.f, std::min(255.f, v));
+                bool discard = hrow ? shader.fragment_hdr(Vec2i(x, y), bc, vary, hcolor)
+                    : shader.fragment(Vec2i(x, y), bc, vary, color);
+                if (discard) {
+                    st.discarded++;
+                }
+                else if (hrow) {
+                    st.written++;
+                    float* dst = hrow + 4 * x;
+                    if (shader.is_transparent) {
+                        for (int i = 0; i < 3; i++) dst[i] += (hcolor[i] - dst[i]) * alpha;
+                    }
+                    else {
+                        zrow[x] = (unsigned char)frag_depth;
+                        for (int i = 0; i < 3; i++) dst[i] = hcolor[i];
+                        dst[3] = 1.f;
+                    }
+                }
+                else {
+                    st.written++;
+                    if (shader.is_transparent) {
+                        if (span_n == kSpan || (span_n && span_x + span_n != x)) {
+                            fb.blend_span(span_x, y, span, span_n, alpha);
+                            span_n = 0;
+                        }
+                        if (!span_n) span_x = x;
+                        span[span_n++] = pack_color(color);
+                    }
+                    else {
+                        zrow[x] = (unsigned char)frag_depth;
+                        crow[x] = pack_color(color) | 0xff000000u;
+                    }
                 }
-                image.set(P.x, P.y, out);
             }
-            else {
-                
-                zbuffer.set(P.x, P.y, TGAColor(frag_depth));
-                image.set(P.x, P.y, color);
+
+
+            for (int i = 0; i < 3; i++) l[i] += ts.edge[i].a;
+            z += ts.depth.a;
+            cw += ts.w.a;
+            iw += ts.inv_w.a;
+            for (int i = 0; i < 3; i++) bq[i] += ts.bar[i].a;
+            for (int k = 0; k < nv; k++) vq[k] += ts.vary[k].a;
+        }
+        if (span_n) {
+            fb.blend_span(span_x, y, span, span_n, alpha);
+            span_n = 0;
+        }
+    }
+    GL_STATS_ADD(st);
+}
+
+
+void triangle_depth(const Vec4f* pts, Framebuffer& fb) {
+    TriangleSetup ts(pts, NULL, 0);
+    if (!ts.valid) return;
+
+    ScreenRect r = triangle_bounds(pts,
+        ScreenRect(0, fb.y0(), fb.width() - 1, fb.y0() + fb.height() - 1));
+    int x0 = r.x0, x1 = r.x1, y0 = r.y0, y1 = r.y1;
+
+    for (int y = y0; y <= y1; y++) {
+        unsigned char* zrow = fb.depth_row(y);
+        float fy = (float)y;
+        float l[3];
+        for (int i = 0; i < 3; i++) l[i] = ts.edge[i].at((float)x0, fy);
+        float z = ts.depth.at((float)x0, fy);
+        float cw = ts.w.at((float)x0, fy);
+        bool inside = false;
+        for (int x = x0; x <= x1; x++) {
+            if (l[0] >= 0 && l[1] >= 0 && l[2] >= 0) {
+                inside = true;
+                int d = std::max(0, std::min(255, int(z / cw + 0.5f)));
+                if (zrow[x] < d) zrow[x] = (unsigned char)d;
+            }
+            else if (inside) {
+                break;
+            }
+            for (int i = 0; i < 3; i++) l[i] += ts.edge[i].a;
+            z += ts.depth.a;
+            cw += ts.w.a;
+        }
+    }
+}
+
+
+GBuffer::GBuffer(int w, int h)
+    : width(w), height(h), object((size_t)w * h, NONE), face((size_t)w * h, 0),
+    bar((size_t)w * h * 3, 0.f) {
+}
+
+void GBuffer::clear(const ScreenRect& r) {
+    for (int y = r.y0; y <= r.y1; y++) {
+        std::fill(&object[(size_t)y * width + r.x0], &object[(size_t)y * width + r.x1] + 1, NONE);
+    }
+}
+
+// Walks the pixels of clip the triangle covers, with their 8-bit depth and
+// perspective-correct barycentrics, and calls visit(x, y, depth, bar) for
+// those that pass the depth test against fb.
+template <typename Visit>
+static void raster_barycentrics(const Vec4f* pts, const Framebuffer& fb, const ScreenRect& clip,
+    Visit visit) {
+    TriangleSetup ts(pts, NULL, 0);
+    if (!ts.valid) return;
+    ScreenRect r = triangle_bounds(pts, clip);
+
+    for (int y = r.y0; y <= r.y1; y++) {
+        const unsigned char* zrow = fb.depth_row(y);
+        float fx = (float)r.x0, fy = (float)y;
+        float l[3], bq[3];
+        for (int i = 0; i < 3; i++) {
+            l[i] = ts.edge[i].at(fx, fy);
+            bq[i] = ts.bar[i].at(fx, fy);
+        }
+        float z = ts.depth.at(fx, fy);
+        float cw = ts.w.at(fx, fy);
+        float iw = ts.inv_w.at(fx, fy);
+        bool inside = false;
+        for (int x = r.x0; x <= r.x1; x++) {
+            if (l[0] >= 0 && l[1] >= 0 && l[2] >= 0) {
+                inside = true;
+                int d = std::max(0, std::min(255, int(z / cw + 0.5f)));
+                if (zrow[x] <= d) {
+                    float w = 1.f / iw;
+                    float bc[3] = { bq[0] * w, bq[1] * w, bq[2] * w };
+                    visit(x, y, d, bc);
+                }
+            }
+            else if (inside) {
+                break;
+            }
+            for (int i = 0; i < 3; i++) {
+                l[i] += ts.edge[i].a;
+                bq[i] += ts.bar[i].a;
+            }
+            z += ts.depth.a;
+            cw += ts.w.a;
+            iw += ts.inv_w.a;
+        }
+    }
+}
+
+void triangle_gbuffer(const Vec4f* pts, int object, int face, Framebuffer& fb, GBuffer& gbuf,
+    const ScreenRect& clip) {
+    raster_barycentrics(pts, fb, clip, [&](int x, int y, int depth, const float* bc) {
+        size_t i = (size_t)y * gbuf.width + x;
+        fb.depth_row(y)[x] = (unsigned char)depth;
+        gbuf.object[i] = (unsigned short)object;
+        gbuf.face[i] = face;
+        std::copy(bc, bc + 3, &gbuf.bar[i * 3]);
+    });
+}
+
+void triangle_fragments(const Vec4f* pts, int object, int face, const Framebuffer& fb,
+    const ScreenRect& clip, std::vector<GFragment>& out) {
+    raster_barycentrics(pts, fb, clip, [&](int x, int y, int, const float* bc) {
+        GFragment f;
+        f.pixel = y * fb.width() + x;
+        f.object = (unsigned short)object;
+        f.face = face;
+        std::copy(bc, bc + 3, f.bar);
+        out.push_back(f);
+    });
+}
+
+
+static const float msaa4_pattern[8] = {
+    -2 / 16.f, -6 / 16.f,   6 / 16.f, -2 / 16.f,
+    -6 / 16.f,  2 / 16.f,   2 / 16.f,  6 / 16.f,
+};
+
+static const float msaa8_pattern[16] = {
+     1 / 16.f, -3 / 16.f,  -1 / 16.f,  3 / 16.f,
+     5 / 16.f,  1 / 16.f,  -3 / 16.f, -5 / 16.f,
+    -5 / 16.f,  5 / 16.f,  -7 / 16.f, -1 / 16.f,
+     3 / 16.f,  7 / 16.f,   7 / 16.f, -7 / 16.f,
+};
+
+MSAATarget::MSAATarget(int w, int h, int samples)
+    : width(w), height(h), nsamples(samples > 4 ? 8 : 4),
+    color((size_t)w * h * nsamples * 3), depth((size_t)w * h * nsamples) {
+    clear();
+}
+
+void MSAATarget::clear() {
+    std::fill(color.begin(), color.end(), (unsigned char)0);
+    std::fill(depth.begin(), depth.end(), -std::numeric_limits<float>::max());
+}
+
+const float* MSAATarget::pattern() const {
+    return nsamples == 8 ? msaa8_pattern : msaa4_pattern;
+}
+
+void MSAATarget::resolve(Framebuffer& out) const {
+    TRACE_SCOPE("resolve_msaa");
+    for (int y = 0; y < height; y++) {
+        uint32_t* dst = out.row(y);
+        for (int x = 0; x < width; x++) {
+            const unsigned char* s = &color[((size_t)y * width + x) * nsamples * 3];
+            int sum[3] = { 0, 0, 0 };
+            for (int k = 0; k < nsamples; k++) {
+                for (int c = 0; c < 3; c++) sum[c] += s[k * 3 + c];
+            }
+            uint32_t px = 0xff000000u;
+            for (int c = 0; c < 3; c++) {
+                px |= (uint32_t)((sum[c] + nsamples / 2) / nsamples) << (8 * c);
+            }
+            dst[x] = px;
+        }
+    }
+}
+
+void triangle_msaa(const Vec4f* pts, const float* varyings, const IShader& shader, MSAATarget& target) {
+    PipelineStats st;
+    st.triangles = 1;
+    TriangleSetup ts(pts, varyings, shader.nvaryings);
+    if (!ts.valid) {
+        st.degenerate = 1;
+        GL_STATS_ADD(st);
+        return;
+    }
+    const Vec2f* s = ts.screen;
+
+    float minx = std::min(s[0].x, std::min(s[1].x, s[2].x));
+    float maxx = std::max(s[0].x, std::max(s[1].x, s[2].x));
+    float miny = std::min(s[0].y, std::min(s[1].y, s[2].y));
+    float maxy = std::max(s[0].y, std::max(s[1].y, s[2].y));
+    int x0 = std::max(0, (int)std::floor(minx - 0.5f));
+    int x1 = std::min(target.width - 1, (int)std::ceil(maxx + 0.5f));
+    int y0 = std::max(0, (int)std::floor(miny - 0.5f));
+    int y1 = std::min(target.height - 1, (int)std::ceil(maxy + 0.5f));
+
+    const int n = target.nsamples;
+    const float* offs = target.pattern();
+    float a = std::max(0.f, std::min(1.f, shader.alpha));
+    TGAColor color;
+    float vary[MAX_VARYINGS];
+    OverdrawMap* od = overdraw_map();
+
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            size_t base = ((size_t)y * target.width + x) * n;
+            unsigned mask = 0;
+            bool covered = false;
+            float sample_depth[8];
+            float fx = (float)x, fy = (float)y;
+            st.pixels_tested++;
+
+            for (int k = 0; k < n; k++) {
+                float sx = x + offs[2 * k], sy = y + offs[2 * k + 1];
+                if (ts.edge[0].at(sx, sy) < 0 || ts.edge[1].at(sx, sy) < 0 || ts.edge[2].at(sx, sy) < 0) continue;
+                if (!covered) {
+                    fx = sx;
+                    fy = sy;
+                }
+                covered = true;
+
+                float d = ts.depth.at(sx, sy) / ts.w.at(sx, sy);
+                if (target.depth[base + k] > d) continue;
+
+                mask |= 1u << k;
+                sample_depth[k] = d;
+            }
+            if (!covered) {
+                st.outside++;
+                continue;
+            }
+            if (od) od->covered[(size_t)y * od->width + x]++;
+            if (!mask) {
+                st.depth_failed++;
+                continue;
+            }
+
+
+            float cx = (float)x, cy = (float)y;
+            if (ts.edge[0].at(cx, cy) >= 0 && ts.edge[1].at(cx, cy) >= 0 && ts.edge[2].at(cx, cy) >= 0) {
+                fx = cx;
+                fy = cy;
+            }
+
+            st.fragments++;
+            if (od) od->shaded[(size_t)y * od->width + x]++;
+            Vec3f bc;
+            ts.interpolate(fx, fy, bc, vary);
+            if (shader.fragment(Vec2i(x, y), bc, vary, color)) {
+                st.discarded++;
+                continue;
+            }
+            st.written++;
+
+            for (int k = 0; k < n; k++) {
+                if (!(mask & (1u << k))) continue;
+                unsigned char* dst = &target.color[(base + k) * 3];
+                if (shader.is_transparent) {
+                    for (int c = 0; c < 3; c++) {
+                        float v = dst[c] * (1.f - a) + color[c] * a;
+                        dst[c] = (unsigned char)std::max(0.f, std::min(255.f, v));
+                    }
+                }
+                else {
+                    target.depth[base + k] = sample_depth[k];
+                    for (int c = 0; c < 3; c++) dst[c] = color[c];
+                }
             }
         }
     }
+    GL_STATS_ADD(st);
 }
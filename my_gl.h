@@ -1,26 +1,173 @@
 #ifndef __MY_GL_H__
 #define __MY_GL_H__
 
+#include <vector>
 #include "tgaimage.h"
 #include "geometry.h"
+#include "framebuffer.h"
 
 
+const int MAX_VARYINGS = 16;
+
+// Output of the vertex stage for one vertex: clip-space position and the
+// varyings the rasterizer interpolates.
+struct VertexOut {
+    Vec4f pos;
+    float varying[MAX_VARYINGS];
+};
+
+// Shaders keep only uniforms as members. vertex() and fragment() are const
+// and write nothing but their outputs, so vertices and fragments can be
+// shaded in any order and on any number of threads.
 struct IShader {
     
     bool  is_transparent = false; 
     float alpha = 1.f;   
     
+    // How many floats of VertexOut::varying are used.
+    int   nvaryings = 0;
 
     virtual ~IShader() {}
 
     
-    virtual Vec4f vertex(int iface, int nthvert) = 0;
+    virtual void vertex(int iface, int nthvert, VertexOut& out) const = 0;
 
-    
-    virtual bool fragment(Vec3f bar, TGAColor& color) = 0;
+    // pixel is the framebuffer position being shaded, bar the
+    // perspective-correct barycentric coordinates, vary the interpolated
+    // varyings (nvaryings floats).
+    virtual bool fragment(Vec2i pixel, Vec3f bar, const float* vary, TGAColor& color) const = 0;
+
+    // Used for HDR targets: linear B, G, R, A, not clamped. The default
+    // runs fragment() and scales its 8-bit result to [0, 1].
+    virtual bool fragment_hdr(Vec2i pixel, Vec3f bar, const float* vary, float* color) const;
 };
 
 
-void triangle(Vec4f* pts, IShader& shader, TGAImage& image, TGAImage& zbuffer);
+// Per-triangle setup: plane equations f(x, y) = a * x + b * y + c in screen
+// space for the edge functions (screen-space barycentrics), clip z and w
+// (depth is z / w, as before), 1/w, and every varying divided by w. Values
+// are stepped by `a` along a span; dividing by the interpolated 1/w gives
+// perspective-correct attributes.
+struct Plane {
+    float a, b, c;
+    float at(float x, float y) const { return a * x + b * y + c; }
+};
+
+struct TriangleSetup {
+    bool  valid;        // false for degenerate (zero-area) triangles
+    Vec2f screen[3];
+    Plane edge[3];
+    Plane depth;
+    Plane w;
+    Plane inv_w;
+    Plane bar[3];       // lambda_i / w_i
+    Plane vary[MAX_VARYINGS];
+    int   nvaryings;
+
+    // varyings is the triangle's varying block: nvaryings floats per vertex.
+    TriangleSetup(const Vec4f* pts, const float* varyings, int nvaryings);
+
+    // Perspective-correct barycentrics and varyings at (x, y).
+    void interpolate(float x, float y, Vec3f& bc, float* out) const;
+};
+
+// Inclusive pixel rectangle.
+struct ScreenRect {
+    int x0, y0, x1, y1;
+
+    ScreenRect() : x0(0), y0(0), x1(-1), y1(-1) {}
+    ScreenRect(int x0_, int y0_, int x1_, int y1_) : x0(x0_), y0(y0_), x1(x1_), y1(y1_) {}
+
+    bool empty() const { return x1 < x0 || y1 < y0; }
+    bool overlaps(const ScreenRect& o) const {
+        return x0 <= o.x1 && o.x0 <= x1 && y0 <= o.y1 && o.y0 <= y1;
+    }
+};
+
+// Pixels the rasterizers visit for a triangle: the bounding box of its
+// projected vertices, clamped to clip.
+ScreenRect triangle_bounds(const Vec4f* pts, const ScreenRect& clip);
+
+// Rasterizes one triangle of viewport-space vertices and its varying block
+// into the color and depth planes of fb. Opaque fragments write depth;
+// transparent ones are depth-tested only and blended with shader.alpha a
+// span at a time. When fb has an HDR plane, fragments are shaded with
+// fragment_hdr() and written (or blended) there instead.
+void triangle(const Vec4f* pts, const float* varyings, const IShader& shader, Framebuffer& fb);
+// Same, touching only the pixels inside clip.
+void triangle(const Vec4f* pts, const float* varyings, const IShader& shader, Framebuffer& fb,
+    const ScreenRect& clip);
+
+// Depth-only rasterization for a prepass: keeps the closest depth per
+// pixel and leaves color alone. A color pass over the same triangles then
+// shades each covered pixel only for the triangle(s) that end up visible.
+void triangle_depth(const Vec4f* pts, Framebuffer& fb);
+
+
+// Visible opaque surface per pixel: the draw (object) and face that won the
+// depth test and the perspective-correct barycentrics there. Together with
+// the face's varyings that is all a fragment shader reads, so the pixels
+// can be shaded again, e.g. for new lighting, without rasterizing.
+struct GBuffer {
+    static const unsigned short NONE = 0xffff;
+
+    int width;
+    int height;
+    std::vector<unsigned short> object;
+    std::vector<int>            face;
+    std::vector<float>          bar;     // 3 per pixel
+
+    GBuffer(int w, int h);
+
+    // Marks the pixels of r as background.
+    void clear(const ScreenRect& r);
+};
+
+// Depth-tests like an opaque triangle() inside clip and, where the
+// fragment passes, writes its depth to fb and its ids and barycentrics to
+// gbuf instead of shading it.
+void triangle_gbuffer(const Vec4f* pts, int object, int face, Framebuffer& fb, GBuffer& gbuf,
+    const ScreenRect& clip);
+
+// A transparent fragment that passed the depth test: its pixel (y * width
+// + x), draw, face and barycentrics.
+struct GFragment {
+    int            pixel;
+    unsigned short object;
+    int            face;
+    float          bar[3];
+};
+
+// Depth-tests a transparent triangle inside clip like triangle() and
+// appends the fragments that pass to out, in the order triangle() would
+// blend them.
+void triangle_fragments(const Vec4f* pts, int object, int face, const Framebuffer& fb,
+    const ScreenRect& clip, std::vector<GFragment>& out);
+
+
+// Multisampled color + depth target with 4 or 8 samples per pixel.
+// Depth is stored per sample as z/w (larger is closer, like the 8-bit
+// zbuffer), color as BGR bytes per sample.
+struct MSAATarget {
+    int width;
+    int height;
+    int nsamples;
+    std::vector<unsigned char> color;
+    std::vector<float>         depth;
+
+    MSAATarget(int w, int h, int samples);
+
+    void clear();
+    // Sample offsets from the pixel position, nsamples pairs.
+    const float* pattern() const;
+    // Box-filters the samples of every pixel into out's color plane.
+    void resolve(Framebuffer& out) const;
+};
+
+// Coverage and depth are evaluated per sample, shader.fragment() is called
+// once per pixel (at the pixel position, or at the first covered sample if
+// that lies outside the triangle) and its color written to every covered
+// sample that passed the depth test.
+void triangle_msaa(const Vec4f* pts, const float* varyings, const IShader& shader, MSAATarget& target);
 
 #endif // __MY_GL_H__
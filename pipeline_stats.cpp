@@ -0,0 +1,111 @@
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include "pipeline_stats.h"
+#include "tgaimage.h"
+
+PipelineStats& PipelineStats::operator+=(const PipelineStats& o) {
+    instances += o.instances;
+    instances_culled += o.instances_culled;
+    clusters += o.clusters;
+    clusters_culled += o.clusters_culled;
+    triangles += o.triangles;
+    degenerate += o.degenerate;
+    pixels_tested += o.pixels_tested;
+    outside += o.outside;
+    depth_failed += o.depth_failed;
+    fragments += o.fragments;
+    discarded += o.discarded;
+    written += o.written;
+    lights += o.lights;
+    light_tiles += o.light_tiles;
+    light_refs += o.light_refs;
+    return *this;
+}
+
+void PipelineStats::print(std::ostream& out) const {
+    if (instances) out << "instances      " << instances << " (" << instances_culled << " culled)\n";
+    out << "clusters       " << clusters << " (" << clusters_culled << " culled)\n"
+        << "triangles      " << triangles << " (" << degenerate << " degenerate)\n"
+        << "pixels tested  " << pixels_tested << "\n"
+        << "  outside      " << outside << "\n"
+        << "  depth failed " << depth_failed << "\n"
+        << "fragments      " << fragments << " (" << discarded << " discarded)\n"
+        << "pixels written " << written << "\n";
+    if (light_tiles) {
+        out << "lights         " << lights << " (" << (double)light_refs / light_tiles
+            << " per tile on average)\n";
+    }
+    if (pixels_tested) {
+        out << "bbox efficiency " << 100.0 * (pixels_tested - outside) / pixels_tested << "%\n";
+    }
+}
+
+static std::mutex registry_mtx;
+static std::vector<std::shared_ptr<PipelineStats>> registry;
+
+PipelineStats& thread_stats() {
+    static thread_local std::shared_ptr<PipelineStats> local;
+    if (!local) {
+        local = std::make_shared<PipelineStats>();
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        registry.push_back(local);
+    }
+    return *local;
+}
+
+PipelineStats collect_stats() {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    PipelineStats total;
+    for (size_t i = 0; i < registry.size(); i++) {
+        total += *registry[i];
+        *registry[i] = PipelineStats();
+    }
+    return total;
+}
+
+
+OverdrawMap::OverdrawMap(int w, int h)
+    : width(w), height(h), covered((size_t)w * h), shaded((size_t)w * h) {
+}
+
+void OverdrawMap::clear() {
+    std::fill(covered.begin(), covered.end(), (unsigned short)0);
+    std::fill(shaded.begin(), shaded.end(), (unsigned short)0);
+}
+
+bool OverdrawMap::write_heatmap(const char* filename, bool shaded_counts) const {
+    const std::vector<unsigned short>& counts = shaded_counts ? shaded : covered;
+    int maxc = 1;
+    for (size_t i = 0; i < counts.size(); i++) maxc = std::max(maxc, (int)counts[i]);
+
+    TGAImage img(width, height, TGAImage::RGB);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int c = counts[(size_t)y * width + x];
+            if (!c) continue;
+            float t = float(c) / maxc;
+            float r = std::min(1.f, std::max(0.f, 3.f * t - 1.f));
+            float g = std::min(1.f, std::max(0.f, t < 2.f / 3 ? 3.f * t : 3.f - 3.f * t));
+            float b = std::min(1.f, std::max(0.f, 1.f - 3.f * t));
+            img.set(x, height - 1 - y, TGAColor(
+                (unsigned char)(255 * r), (unsigned char)(255 * g), (unsigned char)(255 * b)));
+        }
+    }
+    std::cerr << filename << ": max " << maxc << (shaded_counts ? " fragments" : " layers") << " per pixel\n";
+    return img.write_tga_file(filename);
+}
+
+static thread_local OverdrawMap* tls_overdraw = nullptr;
+
+void set_overdraw_map(OverdrawMap* map) {
+    tls_overdraw = map;
+}
+
+OverdrawMap* overdraw_map() {
+#if MY_GL_STATS
+    return tls_overdraw;
+#else
+    return nullptr;
+#endif
+}
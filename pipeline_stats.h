@@ -0,0 +1,69 @@
+#ifndef __PIPELINE_STATS_H__
+#define __PIPELINE_STATS_H__
+
+#include <vector>
+#include <iostream>
+
+// Pipeline statistics are on unless the build defines MY_GL_STATS=0, in
+// which case GL_STATS_ADD and the overdraw hooks compile to nothing.
+#ifndef MY_GL_STATS
+#define MY_GL_STATS 1
+#endif
+
+struct PipelineStats {
+    unsigned long long instances = 0;        // instances of instanced draws
+    unsigned long long instances_culled = 0; // rejected by their bounding sphere
+    unsigned long long clusters = 0;         // meshlets tested before shading
+    unsigned long long clusters_culled = 0;  // rejected by frustum or cone
+    unsigned long long triangles = 0;        // calls to triangle()
+    unsigned long long degenerate = 0;       // rejected at setup (zero area)
+    unsigned long long pixels_tested = 0;    // bounding-box pixels visited
+    unsigned long long outside = 0;          // failed the barycentric test
+    unsigned long long depth_failed = 0;     // failed the depth test
+    unsigned long long fragments = 0;        // reached shader.fragment()
+    unsigned long long discarded = 0;        // fragment() returned true
+    unsigned long long written = 0;          // pixels written or blended
+    unsigned long long lights = 0;           // local lights culled per tile
+    unsigned long long light_tiles = 0;      // screen tiles they were culled for
+    unsigned long long light_refs = 0;       // sum of the opaque tile list lengths
+
+    PipelineStats& operator+=(const PipelineStats& o);
+    void print(std::ostream& out) const;
+};
+
+// Counters of the calling thread. Rasterizer loops keep local counts and
+// add them here once per triangle.
+PipelineStats& thread_stats();
+
+// Sums the counters of every thread that has rendered and zeroes them.
+// Call it between frames, when no thread is rasterizing.
+PipelineStats collect_stats();
+
+#if MY_GL_STATS
+#define GL_STATS_ADD(local) (thread_stats() += (local))
+#else
+#define GL_STATS_ADD(local) ((void)0)
+#endif
+
+
+// Per-pixel counts for the overdraw / depth-complexity heatmaps: `covered`
+// counts triangles whose coverage test passed at the pixel, `shaded`
+// counts fragment() calls.
+struct OverdrawMap {
+    int width;
+    int height;
+    std::vector<unsigned short> covered;
+    std::vector<unsigned short> shaded;
+
+    OverdrawMap(int w, int h);
+    void clear();
+    // Writes the counts as a blue-green-yellow-red heatmap TGA scaled to the
+    // largest count, with y flipped like the color output.
+    bool write_heatmap(const char* filename, bool shaded_counts) const;
+};
+
+// The rasterizer records into the calling thread's map while one is set.
+void set_overdraw_map(OverdrawMap* map);
+OverdrawMap* overdraw_map();
+
+#endif // __PIPELINE_STATS_H__
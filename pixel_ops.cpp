@@ -0,0 +1,181 @@
+#include <cstring>
+#include <algorithm>
+#include "pixel_ops.h"
+#include "simd.h"
+
+namespace {
+
+inline unsigned char luma(unsigned char b, unsigned char g, unsigned char r) {
+    return (unsigned char)((29 * b + 150 * g + 77 * r + 128) >> 8);
+}
+
+template <int BPP>
+void transpose_blocked(const unsigned char* src, int w, int h, unsigned char* dst) {
+    const int B = 32;
+    for (int y0 = 0; y0 < h; y0 += B) {
+        int y1 = std::min(h, y0 + B);
+        for (int x0 = 0; x0 < w; x0 += B) {
+            int x1 = std::min(w, x0 + B);
+            for (int y = y0; y < y1; y++) {
+                const unsigned char* s = src + ((size_t)y * w + x0) * BPP;
+                unsigned char* d = dst + ((size_t)x0 * h + y) * BPP;
+                for (int x = x0; x < x1; x++, s += BPP, d += (size_t)h * BPP) memcpy(d, s, BPP);
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+void reverse_pixels(unsigned char* row, int n, int bpp) {
+    int i = 0, j = n - 1;
+#if MY_GL_SSE2
+    if (bpp == 4) {
+        for (; j - i + 1 >= 8; i += 4, j -= 4) {
+            __m128i* a = (__m128i*)(row + 4 * i);
+            __m128i* b = (__m128i*)(row + 4 * (j - 3));
+            __m128i va = _mm_shuffle_epi32(_mm_loadu_si128(a), 0x1B);
+            __m128i vb = _mm_shuffle_epi32(_mm_loadu_si128(b), 0x1B);
+            _mm_storeu_si128(a, vb);
+            _mm_storeu_si128(b, va);
+        }
+    }
+    else if (bpp == 1) {
+        for (; j - i + 1 >= 32; i += 16, j -= 16) {
+            __m128i* a = (__m128i*)(row + i);
+            __m128i* b = (__m128i*)(row + j - 15);
+            __m128i v[2] = { _mm_loadu_si128(a), _mm_loadu_si128(b) };
+            for (int k = 0; k < 2; k++) {
+                // Bytes within words, words within halves, then the halves.
+                __m128i x = _mm_or_si128(_mm_slli_epi16(v[k], 8), _mm_srli_epi16(v[k], 8));
+                x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0x1B), 0x1B);
+                v[k] = _mm_shuffle_epi32(x, 0x4E);
+            }
+            _mm_storeu_si128(a, v[1]);
+            _mm_storeu_si128(b, v[0]);
+        }
+    }
+#endif
+    unsigned char tmp[4];
+    for (; i < j; i++, j--) {
+        memcpy(tmp, row + i * bpp, bpp);
+        memcpy(row + i * bpp, row + j * bpp, bpp);
+        memcpy(row + j * bpp, tmp, bpp);
+    }
+}
+
+void convert_pixels(const unsigned char* src, int sbpp, unsigned char* dst, int dbpp, int n) {
+    int i = 0;
+    if (sbpp == dbpp) {
+        memcpy(dst, src, (size_t)n * sbpp);
+        return;
+    }
+#if MY_GL_SSE2
+    if (sbpp == 1 && dbpp == 4) {
+        const __m128i opaque = _mm_set1_epi8((char)0xff);
+        for (; i + 16 <= n; i += 16) {
+            __m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i gg_lo = _mm_unpacklo_epi8(g, g), gg_hi = _mm_unpackhi_epi8(g, g);
+            __m128i ga_lo = _mm_unpacklo_epi8(g, opaque), ga_hi = _mm_unpackhi_epi8(g, opaque);
+            __m128i* d = (__m128i*)(dst + 4 * i);
+            _mm_storeu_si128(d + 0, _mm_unpacklo_epi16(gg_lo, ga_lo));
+            _mm_storeu_si128(d + 1, _mm_unpackhi_epi16(gg_lo, ga_lo));
+            _mm_storeu_si128(d + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+            _mm_storeu_si128(d + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+        }
+    }
+    else if (sbpp == 4 && dbpp == 1) {
+        const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+        const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(128);
+        for (; i + 4 <= n; i += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+            // Per pixel: (b, g) and (r, a) dot products, then their sum.
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+            lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+            hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+            __m128i sum = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, 0x08), _mm_shuffle_epi32(hi, 0x08));
+            sum = _mm_srli_epi32(_mm_add_epi32(sum, round), 8);
+            sum = _mm_packs_epi32(sum, sum);
+            int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+            memcpy(dst + i, &packed, 4);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        const unsigned char* s = src + i * sbpp;
+        unsigned char* d = dst + i * dbpp;
+        if (sbpp == 1) {
+            d[0] = d[1] = d[2] = s[0];
+            if (dbpp == 4) d[3] = 255;
+        }
+        else if (dbpp == 1) {
+            d[0] = luma(s[0], s[1], s[2]);
+        }
+        else {
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+            if (dbpp == 4) d[3] = 255;
+        }
+    }
+}
+
+void swap_red_blue(unsigned char* row, int n, int bpp) {
+    if (bpp < 3) return;
+    int i = 0;
+    if (bpp == 4) {
+#if MY_GL_SSE2
+        const __m128i keep = _mm_set1_epi32((int)0xff00ff00u);
+        const __m128i low = _mm_set1_epi32(0xff);
+        for (; i + 4 <= n; i += 4) {
+            __m128i* p = (__m128i*)(row + 4 * i);
+            __m128i v = _mm_loadu_si128(p);
+            __m128i r = _mm_or_si128(_mm_and_si128(v, keep),
+                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low),
+                    _mm_slli_epi32(_mm_and_si128(v, low), 16)));
+            _mm_storeu_si128(p, r);
+        }
+#endif
+    }
+    for (; i < n; i++) std::swap(row[i * bpp], row[i * bpp + 2]);
+}
+
+void premultiply_alpha(unsigned char* row, int n) {
+    int i = 0;
+#if MY_GL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    // Alpha words are multiplied by 255 so they come out unchanged.
+    const __m128i alpha_lane = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+    for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*)(row + 4 * i);
+        __m128i v = _mm_loadu_si128(p);
+        __m128i halves[2] = { _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero) };
+        for (int k = 0; k < 2; k++) {
+            __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[k], 0xFF), 0xFF);
+            a = _mm_or_si128(_mm_andnot_si128(alpha_lane, a), _mm_and_si128(alpha_lane, _mm_set1_epi16(255)));
+            // x * a / 255, rounded: (t + (t >> 8)) >> 8 with t = x * a + 128.
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(halves[k], a), bias);
+            halves[k] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        }
+        _mm_storeu_si128(p, _mm_packus_epi16(halves[0], halves[1]));
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned char* p = row + 4 * i;
+        for (int c = 0; c < 3; c++) {
+            int t = p[c] * p[3] + 128;
+            p[c] = (unsigned char)((t + (t >> 8)) >> 8);
+        }
+    }
+}
+
+void transpose_pixels(const unsigned char* src, int w, int h, int bpp, unsigned char* dst) {
+    switch (bpp) {
+    case 1: transpose_blocked<1>(src, w, h, dst); break;
+    case 3: transpose_blocked<3>(src, w, h, dst); break;
+    default: transpose_blocked<4>(src, w, h, dst); break;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef __PIXEL_OPS_H__
+#define __PIXEL_OPS_H__
+
+// Row kernels on tightly packed 8-bit pixels of 1 (gray), 3 (B G R) or
+// 4 (B G R A) bytes, the layouts TGAImage uses. SSE2 handles 16 bytes per
+// step where the layout allows it; 3-byte pixels and the rest of a row go
+// through the scalar loop.
+
+// Reverses the order of n pixels in place.
+void reverse_pixels(unsigned char* row, int n, int bpp);
+
+// Converts n pixels between formats. Gray expands to equal channels,
+// missing alpha becomes 255, color goes to gray as Rec. 601 luma.
+// src and dst must not overlap.
+void convert_pixels(const unsigned char* src, int sbpp, unsigned char* dst, int dbpp, int n);
+
+// B G R (A) <-> R G B (A) in place; a no-op for gray.
+void swap_red_blue(unsigned char* row, int n, int bpp);
+
+// Scales the color channels of n B G R A pixels by their alpha.
+void premultiply_alpha(unsigned char* row, int n);
+
+// dst (h pixels wide, w rows) becomes the transpose of src (w x h),
+// copied in cache-sized blocks.
+void transpose_pixels(const unsigned char* src, int w, int h, int bpp, unsigned char* dst);
+
+#endif // __PIXEL_OPS_H__
@@ -0,0 +1,282 @@
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "post.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace {
+
+// One pixel, B G R A, in a register where SSE2 is available.
+#if MY_GL_SSE2
+struct Px {
+    __m128 v;
+};
+
+inline Px load(const float* p) { Px r = { _mm_loadu_ps(p) }; return r; }
+inline void store(float* p, Px a) { _mm_storeu_ps(p, a.v); }
+inline Px splat(float f) { Px r = { _mm_set1_ps(f) }; return r; }
+inline Px operator+(Px a, Px b) { Px r = { _mm_add_ps(a.v, b.v) }; return r; }
+inline Px operator-(Px a, Px b) { Px r = { _mm_sub_ps(a.v, b.v) }; return r; }
+inline Px operator*(Px a, Px b) { Px r = { _mm_mul_ps(a.v, b.v) }; return r; }
+inline Px operator/(Px a, Px b) { Px r = { _mm_div_ps(a.v, b.v) }; return r; }
+inline Px max(Px a, Px b) { Px r = { _mm_max_ps(a.v, b.v) }; return r; }
+inline Px min(Px a, Px b) { Px r = { _mm_min_ps(a.v, b.v) }; return r; }
+// Color channels of c with the alpha of a.
+inline Px with_alpha(Px c, Px a) {
+    const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    Px r = { _mm_or_ps(_mm_and_ps(mask, c.v), _mm_andnot_ps(mask, a.v)) };
+    return r;
+}
+#else
+struct Px {
+    float v[4];
+};
+
+inline Px load(const float* p) { Px r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+inline void store(float* p, Px a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+inline Px splat(float f) { Px r; for (int i = 0; i < 4; i++) r.v[i] = f; return r; }
+#define PX_OP(op, expr) \
+    inline Px op(Px a, Px b) { Px r; for (int i = 0; i < 4; i++) r.v[i] = expr; return r; }
+PX_OP(operator+, a.v[i] + b.v[i])
+PX_OP(operator-, a.v[i] - b.v[i])
+PX_OP(operator*, a.v[i] * b.v[i])
+PX_OP(operator/, a.v[i] / b.v[i])
+PX_OP(max, std::max(a.v[i], b.v[i]))
+PX_OP(min, std::min(a.v[i], b.v[i]))
+#undef PX_OP
+inline Px with_alpha(Px c, Px a) { c.v[3] = a.v[3]; return c; }
+#endif
+
+inline Px color_only(Px c) { return with_alpha(c, splat(0.f)); }
+
+typedef std::chrono::steady_clock Clock;
+
+double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+void ensure_size(std::unique_ptr<HDRBuffer>& buf, int w, int h) {
+    if (!buf || buf->width() != w || buf->height() != h) buf.reset(new HDRBuffer(w, h));
+}
+
+} // namespace
+
+
+void ToneMapPass::apply_row(float* px, int n) const {
+    Px e = splat(exposure);
+    Px zero = splat(0.f), one = splat(1.f);
+    if (op == REINHARD) {
+        for (int x = 0; x < n; x++, px += 4) {
+            Px c = load(px);
+            Px v = max(c * e, zero);
+            store(px, with_alpha(v / (v + one), c));
+        }
+        return;
+    }
+    // Narkowicz's fit of the ACES filmic curve.
+    Px a = splat(2.51f), b = splat(0.03f), c2 = splat(2.43f), d = splat(0.59f), f = splat(0.14f);
+    for (int x = 0; x < n; x++, px += 4) {
+        Px c = load(px);
+        Px v = max(c * e, zero);
+        Px y = (v * (a * v + b)) / (v * (c2 * v + d) + f);
+        store(px, with_alpha(min(y, one), c));
+    }
+}
+
+
+BlurPass::BlurPass(float sigma) {
+    int radius = std::max(1, (int)std::ceil(3.f * sigma));
+    weights.resize(2 * radius + 1);
+    float sum = 0.f;
+    for (int k = -radius; k <= radius; k++) {
+        weights[k + radius] = std::exp(-0.5f * k * k / (sigma * sigma));
+        sum += weights[k + radius];
+    }
+    for (size_t k = 0; k < weights.size(); k++) weights[k] /= sum;
+}
+
+void BlurPass::apply(HDRBuffer& image) {
+    int w = image.width(), h = image.height();
+    int radius = (int)weights.size() / 2;
+    int ntaps = (int)weights.size();
+    ensure_size(scratch, w, h);
+    HDRBuffer& tmp = *scratch;
+    const float* wt = weights.data();
+
+    // Horizontal: each row is copied into a line with replicated edges so
+    // the tap loop has no bounds checks.
+    parallel_for(0, h, 8, [&](int lo, int hi) {
+        std::vector<float> line((size_t)(w + 2 * radius) * 4);
+        for (int y = lo; y < hi; y++) {
+            const float* src = image.row(y);
+            for (int x = -radius; x < w + radius; x++) {
+                int sx = std::max(0, std::min(w - 1, x));
+                std::copy(src + 4 * sx, src + 4 * sx + 4, &line[(size_t)(x + radius) * 4]);
+            }
+            float* dst = tmp.row(y);
+            for (int x = 0; x < w; x++) {
+                const float* p = &line[(size_t)x * 4];
+                Px acc = load(p) * splat(wt[0]);
+                for (int k = 1; k < ntaps; k++) acc = acc + load(p + 4 * k) * splat(wt[k]);
+                store(dst + 4 * x, acc);
+            }
+        }
+    });
+
+    // Vertical: accumulate whole source rows into the output row.
+    parallel_for(0, h, 8, [&](int lo, int hi) {
+        for (int y = lo; y < hi; y++) {
+            float* dst = image.row(y);
+            for (int k = 0; k < ntaps; k++) {
+                const float* src = tmp.row(std::max(0, std::min(h - 1, y + k - radius)));
+                Px wk = splat(wt[k]);
+                if (k == 0) {
+                    for (int x = 0; x < w; x++) store(dst + 4 * x, load(src + 4 * x) * wk);
+                }
+                else {
+                    for (int x = 0; x < w; x++)
+                        store(dst + 4 * x, load(dst + 4 * x) + load(src + 4 * x) * wk);
+                }
+            }
+        }
+    });
+}
+
+
+BloomPass::BloomPass(float threshold, float strength, float sigma)
+    : threshold(threshold), strength(strength), blur(sigma) {
+}
+
+void BloomPass::apply(HDRBuffer& image) {
+    int w = image.width(), h = image.height();
+    int hw = (w + 1) / 2, hh = (h + 1) / 2;
+    ensure_size(half, hw, hh);
+    HDRBuffer& low = *half;
+
+    parallel_for(0, hh, 8, [&](int lo, int hi) {
+        Px t = splat(threshold), zero = splat(0.f), quarter = splat(0.25f);
+        for (int y = lo; y < hi; y++) {
+            const float* r0 = image.row(2 * y);
+            const float* r1 = image.row(std::min(h - 1, 2 * y + 1));
+            float* dst = low.row(y);
+            for (int x = 0; x < hw; x++) {
+                int x0 = 2 * x, x1 = std::min(w - 1, 2 * x + 1);
+                Px avg = (load(r0 + 4 * x0) + load(r0 + 4 * x1) + load(r1 + 4 * x0) + load(r1 + 4 * x1)) * quarter;
+                store(dst + 4 * x, color_only(max(avg - t, zero)));
+            }
+        }
+    });
+
+    blur.apply(low);
+
+    parallel_for(0, h, 8, [&](int lo, int hi) {
+        Px s = splat(strength);
+        for (int y = lo; y < hi; y++) {
+            float fy = std::max(0.f, (y + 0.5f) * 0.5f - 0.5f);
+            int y0 = std::min(hh - 1, (int)fy), y1 = std::min(hh - 1, y0 + 1);
+            Px ty = splat(fy - y0);
+            const float* r0 = low.row(y0);
+            const float* r1 = low.row(y1);
+            float* dst = image.row(y);
+            for (int x = 0; x < w; x++) {
+                float fx = std::max(0.f, (x + 0.5f) * 0.5f - 0.5f);
+                int x0 = std::min(hw - 1, (int)fx), x1 = std::min(hw - 1, x0 + 1);
+                Px tx = splat(fx - x0);
+                Px a = load(r0 + 4 * x0), b = load(r0 + 4 * x1);
+                Px c = load(r1 + 4 * x0), d = load(r1 + 4 * x1);
+                Px top = a + (b - a) * tx;
+                Px bottom = c + (d - c) * tx;
+                Px v = top + (bottom - top) * ty;
+                store(dst + 4 * x, load(dst + 4 * x) + v * s);
+            }
+        }
+    });
+}
+
+
+static const int ENCODE_SIZE = 4096;
+
+PostChain::PostChain(float gamma) : encode(ENCODE_SIZE) {
+    for (int i = 0; i < ENCODE_SIZE; i++) {
+        float v = std::pow(i / (ENCODE_SIZE - 1.f), 1.f / gamma);
+        encode[i] = (unsigned char)(v * 255.f + 0.5f);
+    }
+}
+
+void PostChain::run(HDRBuffer& image, Framebuffer& out) {
+    TRACE_SCOPE("post");
+    int w = image.width(), h = image.height();
+    timings.clear();
+
+    size_t i = 0, n = passes.size();
+    while (i < n) {
+        Clock::time_point t0 = Clock::now();
+        if (!passes[i]->pointwise()) {
+            TRACE_SCOPE(passes[i]->name());
+            passes[i]->apply(image);
+            timings.push_back(std::make_pair(std::string(passes[i]->name()), ms_since(t0)));
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < n && passes[j]->pointwise()) j++;
+        if (j == n) break;
+
+        std::string label;
+        for (size_t k = i; k < j; k++) label += (k > i ? "+" : "") + std::string(passes[k]->name());
+        parallel_for(0, h, 8, [&](int lo, int hi) {
+            for (int y = lo; y < hi; y++)
+                for (size_t k = i; k < j; k++) passes[k]->apply_row(image.row(y), w);
+        });
+        timings.push_back(std::make_pair(label, ms_since(t0)));
+        i = j;
+    }
+
+    // Whatever pointwise passes are left, then gamma and quantization.
+    Clock::time_point t0 = Clock::now();
+    std::string label;
+    for (size_t k = i; k < n; k++) label += std::string(passes[k]->name()) + "+";
+    label += "gamma+encode";
+    const unsigned char* lut = encode.data();
+    parallel_for(0, h, 8, [&](int lo, int hi) {
+        for (int y = lo; y < hi; y++) {
+            float* src = image.row(y);
+            for (size_t k = i; k < n; k++) passes[k]->apply_row(src, w);
+            uint32_t* dst = out.row(y);
+#if MY_GL_SSE2
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+            const __m128 scale = _mm_setr_ps(ENCODE_SIZE - 1.f, ENCODE_SIZE - 1.f, ENCODE_SIZE - 1.f, 255.f);
+            int idx[4];
+            for (int x = 0; x < w; x++) {
+                __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 4 * x), zero), one);
+                _mm_storeu_si128((__m128i*)idx, _mm_cvtps_epi32(_mm_mul_ps(v, scale)));
+                dst[x] = (uint32_t)lut[idx[0]] | (uint32_t)lut[idx[1]] << 8 |
+                    (uint32_t)lut[idx[2]] << 16 | (uint32_t)idx[3] << 24;
+            }
+#else
+            for (int x = 0; x < w; x++) {
+                const float* p = src + 4 * x;
+                uint32_t c = 0;
+                for (int k = 0; k < 3; k++) {
+                    float v = std::max(0.f, std::min(1.f, p[k]));
+                    c |= (uint32_t)lut[(int)(v * (ENCODE_SIZE - 1) + 0.5f)] << (8 * k);
+                }
+                float a = std::max(0.f, std::min(1.f, p[3]));
+                dst[x] = c | (uint32_t)(a * 255.f + 0.5f) << 24;
+            }
+#endif
+        }
+    });
+    timings.push_back(std::make_pair(label, ms_since(t0)));
+}
+
+void PostChain::print_timings(std::ostream& out) const {
+    double total = 0.0;
+    for (size_t i = 0; i < timings.size(); i++) {
+        out << "post " << timings[i].first << " " << timings[i].second << " ms\n";
+        total += timings[i].second;
+    }
+    out << "post total " << total << " ms\n";
+}
@@ -0,0 +1,96 @@
+#ifndef __POST_H__
+#define __POST_H__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+#include "framebuffer.h"
+
+// One step of the post-processing chain, working in place on linear HDR
+// color. Pointwise passes only look at the pixel they write; the chain
+// runs consecutive ones back to back on each row while it is in cache
+// instead of sweeping the whole image once per pass.
+class PostPass {
+public:
+    virtual ~PostPass() {}
+    virtual const char* name() const = 0;
+
+    virtual bool pointwise() const { return false; }
+    // Pointwise passes: n pixels (4 floats each) of one row.
+    virtual void apply_row(float* /*px*/, int /*n*/) const {}
+    // The others: the whole image, parallel over rows inside.
+    virtual void apply(HDRBuffer& /*image*/) {}
+};
+
+class ToneMapPass : public PostPass {
+public:
+    enum Operator { REINHARD, ACES };
+
+    explicit ToneMapPass(Operator op = ACES, float exposure = 1.f) : op(op), exposure(exposure) {}
+
+    const char* name() const { return "tonemap"; }
+    bool pointwise() const { return true; }
+    void apply_row(float* px, int n) const;
+
+private:
+    Operator op;
+    float    exposure;
+};
+
+// Separable Gaussian: a horizontal pass into a scratch image, then a
+// vertical one back. Edges are clamped.
+class BlurPass : public PostPass {
+public:
+    explicit BlurPass(float sigma);
+
+    const char* name() const { return "blur"; }
+    void apply(HDRBuffer& image);
+
+private:
+    std::vector<float>         weights;   // 2 * radius + 1 taps
+    std::unique_ptr<HDRBuffer> scratch;
+};
+
+// Adds a blurred copy of everything brighter than threshold. The bright
+// pass and the 2x downsample are one sweep; the blur runs at half
+// resolution and is upsampled bilinearly while it is added back.
+class BloomPass : public PostPass {
+public:
+    BloomPass(float threshold, float strength, float sigma);
+
+    const char* name() const { return "bloom"; }
+    void apply(HDRBuffer& image);
+
+private:
+    float                      threshold;
+    float                      strength;
+    BlurPass                   blur;
+    std::unique_ptr<HDRBuffer> half;
+};
+
+
+// Passes run in order on the HDR image, then the result is gamma encoded
+// to 8 bits into a Framebuffer's color plane. Gamma is a table lookup done
+// in the same sweep as the quantization, and trailing pointwise passes are
+// fused into that sweep as well, so a plain tone map + gamma reads the
+// HDR image once and writes the output once.
+class PostChain {
+public:
+    explicit PostChain(float gamma = 2.2f);
+
+    void add(std::unique_ptr<PostPass> pass) { passes.push_back(std::move(pass)); }
+
+    // image is modified by the passes. out must be the same size.
+    void run(HDRBuffer& image, Framebuffer& out);
+
+    // Milliseconds of the last run, per pass or fused group.
+    void print_timings(std::ostream& out) const;
+
+private:
+    std::vector<std::unique_ptr<PostPass>> passes;
+    std::vector<unsigned char>             encode;   // linear [0, 1] -> 8 bits
+    std::vector<std::pair<std::string, double>> timings;
+};
+
+#endif // __POST_H__
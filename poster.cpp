@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "poster.h"
+#include "image_sink.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace {
+
+struct FaceRef {
+    int draw;
+    int face;
+};
+
+// Rows per parallel task inside a band; strips only touch their own rows.
+const int STRIP = 16;
+
+} // namespace
+
+bool render_poster(const Camera& cam, const Vec3f& light_dir, const std::vector<DrawCall>& draws,
+    int w, int h, int band_rows, const std::string& filename, PosterInfo* info) {
+    TRACE_SCOPE("render_poster");
+    band_rows = std::max(1, std::min(band_rows, h));
+    int nbands = (h + band_rows - 1) / band_rows;
+
+    ScanlineWriter out;
+    if (!out.open(filename, w, h)) return false;
+
+    FrameGeometry geo;
+    vertex_stage(cam, light_dir, w, h, draws, geo);
+
+    // All bins in one array, band b at bin_start[b] .. bin_start[b + 1]:
+    // a counting pass, then the faces are placed in draw order.
+    TRACE_BEGIN(binning, "bin_faces");
+    ScreenRect screen(0, 0, w - 1, h - 1);
+    std::vector<size_t> bin_start(nbands + 1, 0);
+    std::vector<FaceRef> bins;
+    std::vector<size_t> fill;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t d = 0; d < draws.size(); d++) {
+            const DrawGeometry& g = geo.draws[d];
+            for (size_t i = 0; i < g.nfaces(); i++) {
+                ScreenRect r = triangle_bounds(g.face_pts(i), screen);
+                if (r.empty()) continue;
+                for (int b = r.y0 / band_rows; b <= r.y1 / band_rows; b++) {
+                    if (pass == 0) {
+                        bin_start[b + 1]++;
+                        continue;
+                    }
+                    FaceRef f = { (int)d, (int)i };
+                    bins[fill[b]++] = f;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int b = 0; b < nbands; b++) bin_start[b + 1] += bin_start[b];
+            bins.resize(bin_start[nbands]);
+            fill.assign(bin_start.begin(), bin_start.end() - 1);
+        }
+    }
+    TRACE_END(binning);
+
+    std::vector<GouraudPhongShader> shaders(draws.size());
+    for (size_t d = 0; d < draws.size(); d++) {
+        shaders[d].uniform_model = draws[d].model;
+        shaders[d].uniform_material = draws[d].shading_material();
+        shaders[d].is_transparent = draws[d].is_transparent;
+        shaders[d].alpha = draws[d].alpha;
+        shaders[d].nvaryings = geo.draws[d].nvaryings;
+    }
+
+    // Bands go out in the order the file stores its rows.
+    Framebuffer band(w, band_rows);
+    bool ok = true;
+    for (int k = 0; k < nbands && ok; k++) {
+        int b = out.top_down() ? nbands - 1 - k : k;
+        int y0 = b * band_rows;
+        int rows = std::min(band_rows, h - y0);
+        TRACE_SCOPE("poster_band", nullptr, b);
+        band.set_y0(y0);
+        band.clear();
+
+        const FaceRef* bin = bins.data() + bin_start[b];
+        size_t nbin = bin_start[b + 1] - bin_start[b];
+        int nstrips = (rows + STRIP - 1) / STRIP;
+        parallel_for(0, nstrips, 1, [&](int lo, int hi) {
+            for (int s = lo; s < hi; s++) {
+                ScreenRect clip(0, y0 + s * STRIP, w - 1, std::min(y0 + rows, y0 + (s + 1) * STRIP) - 1);
+                for (size_t i = 0; i < nbin; i++) {
+                    const DrawGeometry& g = geo.draws[bin[i].draw];
+                    triangle(g.face_pts(bin[i].face), g.face_varyings(bin[i].face), shaders[bin[i].draw],
+                        band, clip);
+                }
+            }
+        });
+
+        for (int r = 0; r < rows && ok; r++) {
+            int y = out.top_down() ? y0 + rows - 1 - r : y0 + r;
+            ok = out.write_row(band.row(y));
+        }
+    }
+    ok = out.close() && ok;
+
+    if (info) {
+        info->bands = nbands;
+        info->band_bytes = (size_t)w * band_rows * 5;
+        info->bin_bytes = bins.size() * sizeof(FaceRef) + bin_start.size() * sizeof(size_t);
+        info->frame_bytes = (size_t)w * h * 5;
+    }
+    return ok;
+}
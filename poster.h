@@ -0,0 +1,28 @@
+#ifndef __POSTER_H__
+#define __POSTER_H__
+
+#include <string>
+#include <vector>
+#include "renderer.h"
+
+// What render_poster() kept in memory: the band framebuffer (color and
+// depth) and the binned face references, against the color and depth
+// planes a whole frame would need.
+struct PosterInfo {
+    int    bands = 0;
+    size_t band_bytes = 0;
+    size_t bin_bytes = 0;
+    size_t frame_bytes = 0;
+};
+
+// Renders draws at w x h without ever holding the frame: the vertex stage
+// runs once for the full frame, every face is binned into the bands of
+// band_rows rows its bounds overlap, and then each band is rasterized from
+// its bin into one band-sized Framebuffer and streamed to filename (.tga
+// or .ppm, see ScanlineWriter) before the next one reuses it. Faces keep
+// their draw order within a band, so the pixels match a full-frame render.
+// Sun only, like IncrementalRenderer: no local lights, HDR or MSAA.
+bool render_poster(const Camera& cam, const Vec3f& light_dir, const std::vector<DrawCall>& draws,
+    int w, int h, int band_rows, const std::string& filename, PosterInfo* info = nullptr);
+
+#endif // __POSTER_H__
@@ -0,0 +1,245 @@
+#include <sstream>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include "render_server.h"
+#include "renderer.h"
+#include "Camera.h"
+#include "image_sink.h"
+#include "arena.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+RenderJob::RenderJob()
+    : model(), eye(1.0f, 0.3f, 2.0f), center(0.f, 0.f, 0.f), up(0.f, 1.f, 0.f),
+    light(1.0f, 2.0f, 1.0f), width(800), height(800), out() {
+}
+
+// "a<sep>b<sep>c..." with exactly n numbers.
+static bool parse_floats(const std::string& s, char sep, float* out, int n) {
+    const char* p = s.c_str();
+    for (int i = 0; i < n; i++) {
+        char* end;
+        out[i] = strtof(p, &end);
+        if (end == p) return false;
+        if (i + 1 < n && *end != sep) return false;
+        p = end + (i + 1 < n ? 1 : 0);
+    }
+    return *p == '\0';
+}
+
+static bool parse_vec3(const std::string& s, Vec3f& v) {
+    float f[3];
+    if (!parse_floats(s, ',', f, 3)) return false;
+    v = Vec3f(f[0], f[1], f[2]);
+    return true;
+}
+
+bool parse_job(const std::string& line, RenderJob& job, std::string& err) {
+    std::istringstream iss(line);
+    std::string token;
+    while (iss >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos) {
+            err = "expected key=value, got " + token;
+            return false;
+        }
+        std::string key = token.substr(0, eq);
+        std::string val = token.substr(eq + 1);
+        bool ok = true;
+        if (key == "model") job.model = val;
+        else if (key == "out") job.out = val;
+        else if (key == "eye") ok = parse_vec3(val, job.eye);
+        else if (key == "center") ok = parse_vec3(val, job.center);
+        else if (key == "up") ok = parse_vec3(val, job.up);
+        else if (key == "light") ok = parse_vec3(val, job.light);
+        else if (key == "size") {
+            float wh[2] = { 0.f, 0.f };
+            ok = parse_floats(val, 'x', wh, 2) && wh[0] >= 1 && wh[1] >= 1;
+            job.width = (int)wh[0];
+            job.height = (int)wh[1];
+        }
+        else ok = false;
+        if (!ok) {
+            err = "bad value for " + key;
+            return false;
+        }
+    }
+    if (job.model.empty() || job.out.empty()) {
+        err = "model= and out= are required";
+        return false;
+    }
+    return true;
+}
+
+
+RenderServer::RenderServer(size_t cache_bytes, int nworkers, bool compress_textures,
+    bool compact_vertices)
+    : cache(cache_bytes, compress_textures, compact_vertices), pool(nworkers) {
+}
+
+std::string RenderServer::run_job(const RenderJob& job, double queue_ms) {
+    TRACE_SCOPE("render_job");
+    Clock::time_point t0 = Clock::now();
+    bool hit = false;
+    std::shared_ptr<Model> model = cache.get(job.model, &hit);
+    if (!model) return "error cannot load " + job.model;
+    double load_ms = ms_since(t0);
+
+    Clock::time_point t1 = Clock::now();
+    std::vector<DrawCall> draws(1);
+    draws[0].model = model.get();
+    draws[0].view_xform = Matrix::identity();
+    draws[0].is_transparent = false;
+    draws[0].alpha = 1.f;
+    draws = split_materials(draws);
+
+    Framebuffer frame(job.width, job.height);
+    FrameGeometry geo;
+    vertex_stage(Camera(job.eye, job.center, job.up), job.light, job.width, job.height, draws, geo);
+    raster_stage(geo, draws, frame);
+    double render_ms = ms_since(t1);
+    // Jobs run whole on this worker (nested parallel_for is inline), so
+    // only this thread's frame arena holds the job's scratch.
+    frame_arena().reset();
+
+    Clock::time_point t2 = Clock::now();
+    TGAImage image;
+    frame.to_tga(image);
+    if (!write_image(image, job.out, true)) return "error cannot write " + job.out;
+    double write_ms = ms_since(t2);
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "total=%.2fms queue=%.2fms load=%.2fms render=%.2fms write=%.2fms cache=%s",
+        queue_ms + ms_since(t0), queue_ms, load_ms, render_ms, write_ms, hit ? "hit" : "miss");
+    return "ok " + job.out + " " + buf;
+}
+
+void RenderServer::handle_line(const std::string& line, Reply reply) {
+    if (line.empty() || line[0] == '#') return;
+    if (line == "stats") {
+        std::ostringstream oss;
+        oss << "stats resident=" << cache.resident_bytes() << " budget=" << cache.budget()
+            << " hits=" << cache.hits() << " misses=" << cache.misses()
+            << " evictions=" << cache.evictions();
+        TextureCacheStats tex = texture_cache_stats();
+        oss << " textures=" << tex.resident << " texture_hits=" << tex.hits
+            << " texture_misses=" << tex.misses;
+        reply(oss.str());
+        return;
+    }
+
+    RenderJob job;
+    std::string err;
+    if (!parse_job(line, job, err)) {
+        reply("error " + err);
+        return;
+    }
+    Clock::time_point queued = Clock::now();
+    pool.submit([this, job, queued, reply] {
+        reply(run_job(job, ms_since(queued)));
+    });
+}
+
+void RenderServer::serve_stream(std::istream& in, std::ostream& out) {
+    std::mutex out_mtx;
+    Reply reply = [&out, &out_mtx](const std::string& msg) {
+        std::lock_guard<std::mutex> lock(out_mtx);
+        out << msg << std::endl;
+    };
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        handle_line(line, reply);
+    }
+    pool.wait();
+}
+
+#ifndef _WIN32
+
+// Client connection; the socket is closed once the reader and all of the
+// client's jobs are done with it.
+struct Connection {
+    int        fd;
+    std::mutex mtx;
+
+    explicit Connection(int fd_) : fd(fd_) {}
+    ~Connection() { close(fd); }
+
+    void send_line(const std::string& msg) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::string s = msg + "\n";
+        const char* p = s.data();
+        size_t left = s.size();
+        while (left > 0) {
+            ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+            if (n <= 0) return;
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+};
+
+bool RenderServer::serve_socket(const char* path) {
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "can't create socket\n";
+        return false;
+    }
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+        std::cerr << "can't listen on " << path << "\n";
+        close(listen_fd);
+        return false;
+    }
+    std::cerr << "listening on " << path << "\n";
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        std::shared_ptr<Connection> conn = std::make_shared<Connection>(fd);
+        std::thread([this, conn] {
+            Reply reply = [conn](const std::string& msg) { conn->send_line(msg); };
+            std::string pending;
+            char buf[4096];
+            ssize_t n;
+            while ((n = recv(conn->fd, buf, sizeof(buf), 0)) > 0) {
+                pending.append(buf, (size_t)n);
+                size_t nl;
+                while ((nl = pending.find('\n')) != std::string::npos) {
+                    std::string line = pending.substr(0, nl);
+                    pending.erase(0, nl + 1);
+                    if (!line.empty() && line.back() == '\r') line.pop_back();
+                    handle_line(line, reply);
+                }
+            }
+        }).detach();
+    }
+}
+
+#else
+
+bool RenderServer::serve_socket(const char* path) {
+    std::cerr << "Unix socket mode is not supported on this platform (" << path << ")\n";
+    return false;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __RENDER_SERVER_H__
+#define __RENDER_SERVER_H__
+
+#include <string>
+#include <iostream>
+#include "geometry.h"
+#include "model_cache.h"
+#include "thread_pool.h"
+
+// One render request. Jobs are single text lines of key=value pairs:
+//   model=obj/head.obj eye=1,0.3,2 center=0,0,0 up=0,1,0 light=1,2,1
+//   size=800x800 out=head.tga
+// Only model and out are required; the out extension picks the encoder.
+struct RenderJob {
+    std::string model;
+    Vec3f       eye;
+    Vec3f       center;
+    Vec3f       up;
+    Vec3f       light;
+    int         width;
+    int         height;
+    std::string out;
+
+    RenderJob();
+};
+
+bool parse_job(const std::string& line, RenderJob& job, std::string& err);
+
+
+// Long-running renderer. Models stay resident in a ModelCache between jobs
+// and jobs run on a worker pool. Every job is answered with one line:
+//   ok <out> total=..ms queue=..ms load=..ms render=..ms write=..ms cache=hit|miss
+//   error <message>
+// A "stats" line is answered with the model cache counters and those of
+// the shared texture cache (see texture_cache.h).
+class RenderServer {
+public:
+    RenderServer(size_t cache_bytes, int nworkers, bool compress_textures = false,
+        bool compact_vertices = false);
+
+    // Reads jobs from `in` until EOF and waits for all of them to finish.
+    void serve_stream(std::istream& in, std::ostream& out);
+    // Accepts connections on a Unix domain socket, one reader thread per
+    // client. Returns false if the socket can't be set up.
+    bool serve_socket(const char* path);
+
+private:
+    typedef std::function<void(const std::string&)> Reply;
+
+    void handle_line(const std::string& line, Reply reply);
+    std::string run_job(const RenderJob& job, double queue_ms);
+
+    ModelCache cache;
+    ThreadPool pool;
+};
+
+#endif // __RENDER_SERVER_H__
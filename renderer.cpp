@@ -0,0 +1,502 @@
+#include <cmath>
+#include <algorithm>
+#include <tuple>
+#include "renderer.h"
+#include "thread_pool.h"
+#include "pipeline_stats.h"
+#include "arena.h"
+#include "trace.h"
+
+VertexInput fetch_vertex(Model& m, int iface, int nthvert, int material) {
+    VertexInput in;
+    in.v = m.vert(iface, nthvert);
+    in.n = m.normal(iface, nthvert);
+    in.uv = m.uv(iface, nthvert);
+    in.spec_pow = m.specular(in.uv, material);
+    return in;
+}
+
+void fetch_faces(Model& m, int material, const int* faces, int n, VertexInput* out) {
+    Vec3f pos[FETCH_BATCH * 3], nrm[FETCH_BATCH * 3];
+    Vec2f uv[FETCH_BATCH * 3];
+    m.fetch_faces(faces, n, pos, nrm, uv);
+    for (int k = 0; k < n * 3; k++) {
+        out[k].v = pos[k];
+        out[k].n = nrm[k];
+        out[k].uv = uv[k];
+        out[k].spec_pow = m.specular(uv[k], material);
+    }
+}
+
+
+void GouraudPhongShader::vertex(int iface, int nthvert, VertexOut& out) const {
+    shade(fetch_vertex(*uniform_model, iface, nthvert, uniform_material), out);
+}
+
+void GouraudPhongShader::shade(const VertexInput& in, VertexOut& out) const {
+    out.varying[0] = in.uv.x;
+    out.varying[1] = in.uv.y;
+
+    Vec4f v_cam4 = uniform_M * embed<4>(in.v, 1.f);
+    Vec3f v_cam = proj<3>(v_cam4);
+
+
+    Vec3f n = proj<3>(uniform_MIT * embed<4>(in.n, 0.f)).normalize();
+
+
+    Vec3f l = uniform_light_dir;
+    Vec3f v = (v_cam * -1.0f).normalize();
+
+
+    float diff = std::max(0.0f, n * l);
+
+
+    Vec3f r = (n * (2.0f * (n * l)) - l).normalize();
+    float spec = std::pow(std::max(0.0f, r * v), in.spec_pow);
+
+
+    float kd = 0.9f;
+    float ks = 0.5f;
+
+    // Without an AO map the ambient term is constant and is added here,
+    // per vertex as before baked AO, so those renders stay identical.
+    float ambient = uniform_model->has_ambient_occlusion() ? 0.f : uniform_ambient;
+    float I = ambient + kd * diff + ks * spec;
+    out.varying[2] = I;
+
+    if (nvaryings == NVARYINGS_LIT) {
+        for (int i = 0; i < 3; i++) {
+            out.varying[3 + i] = v_cam[i];
+            out.varying[6 + i] = n[i];
+        }
+    }
+
+
+    out.pos = uniform_P * v_cam4;
+}
+
+// Sum of the local lights of the pixel's tile at the interpolated
+// position, as linear RGB.
+Vec3f GouraudPhongShader::local_light(Vec2i pixel, const float* vary) const {
+    Vec3f lit(0.f, 0.f, 0.f);
+    int n;
+    const int* ids = uniform_tiles->lights_at(pixel.x, pixel.y, is_transparent, n);
+    if (!n) return lit;
+
+    Vec3f p(vary[3], vary[4], vary[5]);
+    Vec3f nrm(vary[6], vary[7], vary[8]);
+    nrm.normalize();
+    for (int k = 0; k < n; k++) {
+        const ViewLight& l = uniform_lights[ids[k]];
+        Vec3f d = l.position - p;
+        float d2 = d * d;
+        float r2 = l.range * l.range;
+        if (d2 >= r2) continue;
+        d = d / std::sqrt(std::max(d2, 1e-12f));
+        float ndl = nrm * d;
+        if (ndl <= 0.f) continue;
+        float falloff = 1.f - d2 / r2;
+        float att = falloff * falloff * ndl;
+        if (l.spot) {
+            float cd = -(d * l.direction);
+            if (cd <= l.cos_outer) continue;
+            float t = std::min(1.f, (cd - l.cos_outer) / std::max(l.cos_inner - l.cos_outer, 1e-6f));
+            att *= t * t * (3.f - 2.f * t);
+        }
+        lit = lit + l.color * att;
+    }
+    return lit;
+}
+
+// Light arriving at the fragment per channel, in B, G, R order: the sun
+// term from the vertices, ambient scaled by the baked occlusion, and the
+// local lights of the pixel's tile if there are any.
+void GouraudPhongShader::irradiance(Vec2i pixel, const float* vary, float* light) const {
+    Vec2f uv(vary[0], vary[1]);
+    float I = vary[2];
+    if (uniform_model->has_ambient_occlusion()) I += uniform_ambient * uniform_model->ambient_occlusion(uv);
+    Vec3f lit(0.f, 0.f, 0.f);
+    if (uniform_tiles) lit = local_light(pixel, vary);
+    for (int i = 0; i < 3; i++) light[i] = I + lit[2 - i];
+}
+
+bool GouraudPhongShader::fragment(Vec2i pixel, Vec3f /*bar*/, const float* vary, TGAColor& color) const {
+    float light[3];
+    irradiance(pixel, vary, light);
+
+    TGAColor c = uniform_model->diffuse(Vec2f(vary[0], vary[1]), uniform_material);
+
+    for (int i = 0; i < 3; i++) {
+        float v = c[i] * light[i];
+        c[i] = (unsigned char)std::min(255.f, v);
+    }
+    color = c;
+    return false;
+}
+
+// sRGB texels to linear, for shading in HDR.
+static const float* srgb_to_linear() {
+    static float table[256];
+    static bool init = [] {
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.f;
+            table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return true;
+    }();
+    (void)init;
+    return table;
+}
+
+bool GouraudPhongShader::fragment_hdr(Vec2i pixel, Vec3f /*bar*/, const float* vary, float* color) const {
+    float light[3];
+    irradiance(pixel, vary, light);
+
+    TGAColor c = uniform_model->diffuse(Vec2f(vary[0], vary[1]), uniform_material);
+    const float* lin = srgb_to_linear();
+
+    for (int i = 0; i < 3; i++) color[i] = lin[c[i]] * light[i];
+    color[3] = 1.f;
+    return false;
+}
+
+
+// Writes one shaded vertex into a face's slot of the varying buffer.
+static void emit(const VertexOut& out, const Matrix& viewport, int nvary, int j,
+    Vec4f* pts, float* varyings) {
+    pts[j] = viewport * out.pos;
+    std::copy(out.varying, out.varying + nvary, varyings + j * nvary);
+}
+
+
+ViewParams::ViewParams(const Camera& cam, const Vec3f& light_dir, int w, int h)
+    : width(w), height(h) {
+    ModelView = cam.getModelView();
+    Projection = cam.getProjection();
+    Viewport = cam.getViewport(w / 8, h / 8, w * 3 / 4, h * 3 / 4);
+
+    Vec3f l = light_dir;
+    l.normalize();
+    light_cam = proj<3>(ModelView * embed<4>(l, 0.f)).normalize();
+}
+
+Matrix ViewParams::model_view(const DrawCall& draw, int instance) const {
+    Matrix MV = draw.view_xform * ModelView;
+    return draw.instances ? MV * draw.instances[instance] : MV;
+}
+
+void ViewParams::bind(GouraudPhongShader& shader, const DrawCall& draw, bool lit, int instance) const {
+    Matrix MV = model_view(draw, instance);
+    shader.nvaryings = lit ? GouraudPhongShader::NVARYINGS_LIT : GouraudPhongShader::NVARYINGS;
+    shader.uniform_model = draw.model;
+    shader.uniform_material = draw.shading_material();
+    shader.uniform_P = Projection;
+    shader.uniform_light_dir = light_cam;
+    shader.uniform_M = MV;
+    shader.uniform_MIT = MV.invert_transpose();
+}
+
+
+ClusterCuller ViewParams::culler(const DrawCall& draw, int instance) const {
+    return ClusterCuller(model_view(draw, instance), Projection, Viewport, width, height,
+        !draw.is_transparent);
+}
+
+
+std::vector<DrawCall> expand_instances(const std::vector<DrawCall>& draws) {
+    std::vector<DrawCall> out;
+    for (size_t d = 0; d < draws.size(); d++) {
+        if (!draws[d].instances) {
+            out.push_back(draws[d]);
+            continue;
+        }
+        for (int i = 0; i < draws[d].ninstances; i++) {
+            DrawCall one = draws[d];
+            one.instances = &draws[d].instances[i];
+            one.ninstances = 1;
+            out.push_back(one);
+        }
+    }
+    return out;
+}
+
+std::vector<DrawCall> split_materials(const std::vector<DrawCall>& draws) {
+    std::vector<DrawCall> opaque, transparent;
+    for (size_t d = 0; d < draws.size(); d++) {
+        std::vector<DrawCall>& out = draws[d].is_transparent ? transparent : opaque;
+        int nmat = draws[d].model->nmaterials();
+        if (draws[d].material >= 0 || nmat == 1) {
+            out.push_back(draws[d]);
+            continue;
+        }
+        for (int k = 0; k < nmat; k++) {
+            DrawCall one = draws[d];
+            one.material = k;
+            out.push_back(one);
+        }
+    }
+
+    // Missing maps sort first.
+    auto path = [](const std::shared_ptr<const Texture>& t) {
+        return t ? t->path() : std::string();
+    };
+    auto maps = [&](const DrawCall& dc) {
+        const Material& m = dc.model->material(dc.shading_material());
+        return std::make_tuple(path(m.diffuse), path(m.normal), path(m.specular));
+    };
+    std::stable_sort(opaque.begin(), opaque.end(), [&](const DrawCall& a, const DrawCall& b) {
+        return maps(a) < maps(b);
+    });
+    opaque.insert(opaque.end(), transparent.begin(), transparent.end());
+    return opaque;
+}
+
+// The clusters a draw culls and shades: its material's, or all of them.
+static void draw_clusters(const DrawCall& draw, int& first, int& count) {
+    if (draw.material < 0) {
+        first = 0;
+        count = (int)draw.model->meshlets().size();
+    }
+    else {
+        first = draw.model->material(draw.material).first_meshlet;
+        count = draw.model->material(draw.material).nmeshlets;
+    }
+}
+
+
+void vertex_stage(const Camera& cam, const Vec3f& light_dir, int w, int h,
+    const std::vector<DrawCall>& draws, FrameGeometry& out,
+    const std::vector<Light>* lights) {
+    TRACE_SCOPE("vertex_stage");
+    ViewParams view(cam, light_dir, w, h);
+    PipelineStats st;
+
+    out.lights.clear();
+    if (lights) lights_to_view(*lights, view.ModelView, out.lights);
+    out.view_to_screen = view.Viewport * view.Projection;
+    bool lit = lights != nullptr;
+
+    out.draws.resize(draws.size());
+    for (size_t d = 0; d < draws.size(); d++) {
+        Model& m = *draws[d].model;
+        int material = draws[d].shading_material();
+        int first, nclusters;
+        draw_clusters(draws[d], first, nclusters);
+        const Meshlet* meshlets = m.meshlets().data() + first;
+        const std::vector<int>& ids = m.meshlet_faces();
+        int ninst = draws[d].instance_count();
+        GouraudPhongShader* shaders = frame_arena().make_array<GouraudPhongShader>(ninst);
+
+        // (instance, cluster) pairs that survive culling.
+        int* visible = frame_arena().alloc_array<int>((size_t)ninst * nclusters * 2);
+        int nvisible = 0;
+        size_t nfaces = 0;
+        for (int inst = 0; inst < ninst; inst++) {
+            view.bind(shaders[inst], draws[d], lit, inst);
+            ClusterCuller culler = view.culler(draws[d], inst);
+            if (draws[d].instances) {
+                st.instances++;
+                if (!culler.visible(m.bounds())) {
+                    st.instances_culled++;
+                    continue;
+                }
+            }
+            for (int c = 0; c < nclusters; c++) {
+                st.clusters++;
+                if (!culler.visible(meshlets[c])) {
+                    st.clusters_culled++;
+                    continue;
+                }
+                visible[2 * nvisible] = inst;
+                visible[2 * nvisible + 1] = c;
+                nvisible++;
+                nfaces += meshlets[c].count;
+            }
+        }
+
+        // Flat list of the faces to shade and their instances, so the
+        // shading loop can split anywhere.
+        int* face_ids = frame_arena().alloc_array<int>(nfaces);
+        int* face_inst = frame_arena().alloc_array<int>(nfaces);
+        size_t n = 0;
+        for (int k = 0; k < nvisible; k++) {
+            const Meshlet& ml = meshlets[visible[2 * k + 1]];
+            for (int f = ml.first; f < ml.first + ml.count; f++) {
+                face_inst[n] = visible[2 * k];
+                face_ids[n++] = ids[f];
+            }
+        }
+
+        DrawGeometry& g = out.draws[d];
+        g.resize(nfaces, shaders[0].nvaryings);
+        parallel_for(0, (int)nfaces, 256, [&](int lo, int hi) {
+            TRACE_SCOPE("shade_vertices", nullptr, hi - lo);
+            VertexInput in[FETCH_BATCH * 3];
+            VertexOut vo;
+            for (int b = lo; b < hi; b += FETCH_BATCH) {
+                int n = std::min(FETCH_BATCH, hi - b);
+                fetch_faces(m, material, face_ids + b, n, in);
+                for (int k = 0; k < n; k++) {
+                    int i = b + k;
+                    const GouraudPhongShader& sh = shaders[face_inst[i]];
+                    for (int j = 0; j < 3; j++) {
+                        sh.shade(in[k * 3 + j], vo);
+                        emit(vo, view.Viewport, g.nvaryings, j, g.face_pts(i), g.face_varyings(i));
+                    }
+                }
+            }
+        });
+    }
+    GL_STATS_ADD(st);
+}
+
+template <typename DrawTriangle>
+static void raster_faces(const FrameGeometry& geo, const std::vector<DrawCall>& draws,
+    const TileLightGrid* tiles, DrawTriangle draw_triangle) {
+    GouraudPhongShader shader;
+    if (tiles) {
+        shader.uniform_lights = geo.lights.data();
+        shader.uniform_tiles = tiles;
+    }
+    for (size_t d = 0; d < draws.size(); d++) {
+        TRACE_SCOPE("raster_draw", draws[d].is_transparent ? "transparent" : "opaque", (long long)d);
+        shader.uniform_model = draws[d].model;
+        shader.uniform_material = draws[d].shading_material();
+        shader.is_transparent = draws[d].is_transparent;
+        shader.alpha = draws[d].alpha;
+
+        const DrawGeometry& g = geo.draws[d];
+        shader.nvaryings = g.nvaryings;
+        for (size_t i = 0; i < g.nfaces(); i++) {
+            draw_triangle(g.face_pts(i), g.face_varyings(i), shader);
+        }
+    }
+}
+
+static void add_light_stats(const TileLightGrid& tiles, int nlights) {
+    PipelineStats st;
+    st.light_tiles = tiles.ntiles();
+    st.light_refs = tiles.opaque_refs();
+    st.lights = nlights;
+    GL_STATS_ADD(st);
+}
+
+void raster_stage(const FrameGeometry& geo, const std::vector<DrawCall>& draws,
+    Framebuffer& frame) {
+    TRACE_SCOPE("raster_stage");
+    TileLightGrid tiles;
+    if (!geo.lights.empty()) {
+        // Depth prepass: the opaque depth both bounds the tiles and lets
+        // the color pass below shade only the visible surface.
+        TRACE_BEGIN(prepass, "depth_prepass");
+        for (size_t d = 0; d < draws.size(); d++) {
+            if (draws[d].is_transparent) continue;
+            const DrawGeometry& g = geo.draws[d];
+            for (size_t i = 0; i < g.nfaces(); i++) triangle_depth(g.face_pts(i), frame);
+        }
+        TRACE_END(prepass);
+        tiles.build(geo.lights, geo.view_to_screen, frame.width(), frame.height(), &frame,
+            geo.tile_culling);
+        add_light_stats(tiles, (int)geo.lights.size());
+    }
+    raster_faces(geo, draws, geo.lights.empty() ? nullptr : &tiles,
+        [&](const Vec4f* pts, const float* vary, const IShader& shader) {
+        triangle(pts, vary, shader, frame);
+    });
+}
+
+void raster_stage(const FrameGeometry& geo, const std::vector<DrawCall>& draws,
+    MSAATarget& target) {
+    TRACE_SCOPE("raster_stage", "msaa");
+    TileLightGrid tiles;
+    if (!geo.lights.empty()) {
+        tiles.build(geo.lights, geo.view_to_screen, target.width, target.height, nullptr,
+            geo.tile_culling);
+        add_light_stats(tiles, (int)geo.lights.size());
+    }
+    raster_faces(geo, draws, geo.lights.empty() ? nullptr : &tiles, [&](const Vec4f* pts, const float* vary, const IShader& shader) {
+        triangle_msaa(pts, vary, shader, target);
+    });
+}
+
+void render_multiview(const std::vector<Camera>& cams, const Vec3f& light_dir,
+    const std::vector<DrawCall>& scene_draws, std::vector<Framebuffer>& frames) {
+    // Instances are handled as separate draws here, so each gets its own
+    // shader per view.
+    std::vector<DrawCall> draws = expand_instances(scene_draws);
+    int nviews = (int)cams.size();
+    std::vector<ViewParams> views;
+    std::vector<FrameGeometry> geo(nviews);
+    for (int v = 0; v < nviews; v++) {
+        views.push_back(ViewParams(cams[v], light_dir, frames[v].width(), frames[v].height()));
+        geo[v].draws.resize(draws.size());
+    }
+
+    PipelineStats st;
+    for (size_t d = 0; d < draws.size(); d++) {
+        Model& m = *draws[d].model;
+        int material = draws[d].shading_material();
+        int first, nclusters;
+        draw_clusters(draws[d], first, nclusters);
+        const Meshlet* meshlets = m.meshlets().data() + first;
+        const std::vector<int>& ids = m.meshlet_faces();
+
+        // Cull per view, then give every visible cluster its slot in each
+        // view's face list so the parallel pass below writes in draw order.
+        int* offset = frame_arena().alloc_array<int>((size_t)nviews * nclusters);
+        GouraudPhongShader* shaders = frame_arena().make_array<GouraudPhongShader>(nviews);
+        for (int v = 0; v < nviews; v++) views[v].bind(shaders[v], draws[d]);
+        for (int v = 0; v < nviews; v++) {
+            ClusterCuller culler = views[v].culler(draws[d]);
+            int n = 0;
+            for (int c = 0; c < nclusters; c++) {
+                st.clusters++;
+                if (!culler.visible(meshlets[c])) {
+                    st.clusters_culled++;
+                    offset[v * nclusters + c] = -1;
+                    continue;
+                }
+                offset[v * nclusters + c] = n;
+                n += meshlets[c].count;
+            }
+            geo[v].draws[d].resize(n, GouraudPhongShader::NVARYINGS);
+        }
+
+        parallel_for(0, nclusters, 4, [&](int lo, int hi) {
+            TRACE_SCOPE("shade_vertices", "multiview", hi - lo);
+            VertexInput in[FETCH_BATCH * 3];
+            VertexOut vo;
+            for (int c = lo; c < hi; c++) {
+                bool any = false;
+                for (int v = 0; v < nviews; v++) any = any || offset[v * nclusters + c] >= 0;
+                if (!any) continue;
+
+                for (int b = 0; b < meshlets[c].count; b += FETCH_BATCH) {
+                    int n = std::min(FETCH_BATCH, meshlets[c].count - b);
+                    fetch_faces(m, material, &ids[meshlets[c].first + b], n, in);
+
+                    for (int v = 0; v < nviews; v++) {
+                        int slot = offset[v * nclusters + c];
+                        if (slot < 0) continue;
+                        DrawGeometry& g = geo[v].draws[d];
+                        for (int k = b; k < b + n; k++) {
+                            for (int j = 0; j < 3; j++) {
+                                shaders[v].shade(in[(k - b) * 3 + j], vo);
+                                emit(vo, views[v].Viewport, g.nvaryings, j, g.face_pts(slot + k),
+                                    g.face_varyings(slot + k));
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+    GL_STATS_ADD(st);
+
+    parallel_for(0, nviews, 1, [&](int lo, int hi) {
+        for (int v = lo; v < hi; v++) {
+            frames[v].clear();
+            raster_stage(geo[v], draws, frames[v]);
+        }
+    });
+}
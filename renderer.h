@@ -0,0 +1,184 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include <vector>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "my_gl.h"
+#include "Camera.h"
+#include "lights.h"
+
+// Per-vertex data that does not depend on the camera. Fetched once per
+// face vertex and shared by every view of a multi-view draw.
+struct VertexInput {
+    Vec3f v;
+    Vec3f n;
+    Vec2f uv;
+    float spec_pow;
+};
+
+// spec_pow is sampled from the given material's specular map.
+VertexInput fetch_vertex(Model& m, int iface, int nthvert, int material = 0);
+
+// Fetches the vertices of n <= FETCH_BATCH faces into out, three per face,
+// with one Model::fetch_faces call so compact models decode a batch at a
+// time.
+const int FETCH_BATCH = 32;
+void fetch_faces(Model& m, int material, const int* faces, int n, VertexInput* out);
+
+
+// Varyings: u, v, diffuse + specular intensity of the sun. With local
+// lights also the view-space position and normal, which the fragment stage
+// lights per pixel from its tile's light list.
+struct GouraudPhongShader : public IShader {
+    static const int NVARYINGS = 3;
+    static const int NVARYINGS_LIT = 9;
+
+    Model* uniform_model = nullptr;
+    // Whose maps are sampled, see Model::material().
+    int    uniform_material = 0;
+    Matrix uniform_M;
+    Matrix uniform_MIT;
+    Matrix uniform_P;
+    Vec3f  uniform_light_dir;
+    // Scaled by the model's baked ambient occlusion per fragment.
+    float  uniform_ambient = 0.1f;
+    // Local lights in view space and their per-tile lists; both null when
+    // the scene only has the sun.
+    const ViewLight*     uniform_lights = nullptr;
+    const TileLightGrid* uniform_tiles = nullptr;
+
+    GouraudPhongShader() { nvaryings = NVARYINGS; }
+
+    virtual void vertex(int iface, int nthvert, VertexOut& out) const;
+    // Shades an already fetched vertex (shared between views).
+    void shade(const VertexInput& in, VertexOut& out) const;
+
+    virtual bool fragment(Vec2i pixel, Vec3f bar, const float* vary, TGAColor& color) const;
+    // Same lighting on the linearized diffuse texture, without the clamp.
+    virtual bool fragment_hdr(Vec2i pixel, Vec3f bar, const float* vary, float* color) const;
+
+private:
+    void  irradiance(Vec2i pixel, const float* vary, float* light) const;
+    Vec3f local_light(Vec2i pixel, const float* vary) const;
+};
+
+
+// One draw of the scene. view_xform is applied on top of the camera
+// ModelView (the cube is scaled and shifted in view space). An instanced
+// draw renders the model once per world transform in instances, as
+// view_xform * ModelView * instances[i], all into one DrawGeometry; the
+// transforms must be similarities for the culling (see meshlet.h). The
+// array is not owned (see Scene). material >= 0 draws only that
+// material's clusters; -1 draws every face with material 0's maps, which
+// is only right for single-material models (see split_materials).
+struct DrawCall {
+    Model* model;
+    Matrix view_xform;
+    bool   is_transparent;
+    float  alpha;
+    const Matrix* instances = nullptr;
+    int           ninstances = 0;
+    int           material = -1;
+
+    int instance_count() const { return instances ? ninstances : 1; }
+    int shading_material() const { return std::max(0, material); }
+};
+
+// The draws with every instanced draw split into one draw per instance.
+std::vector<DrawCall> expand_instances(const std::vector<DrawCall>& draws);
+
+// The draws with every multi-material model split into one draw per
+// material, then the opaque draws stable-sorted by the paths of their
+// diffuse, normal and specular maps so draws sampling the same textures
+// run back to back and the texel working set changes once per map set
+// rather than once per model. Paths rather than addresses keep the order,
+// and so which draw wins a depth tie, independent of load order.
+// Transparent draws keep their order after the opaque ones, since they
+// blend in draw order.
+std::vector<DrawCall> split_materials(const std::vector<DrawCall>& draws);
+
+// Output of the vertex stage for one draw: viewport-space vertices and the
+// varying block of every face that survived culling, three vertices per
+// face, in draw order.
+struct DrawGeometry {
+    int                nvaryings = 0;
+    std::vector<Vec4f> pts;
+    std::vector<float> varyings;
+
+    void resize(size_t nfaces, int nvary) {
+        nvaryings = nvary;
+        pts.resize(nfaces * 3);
+        varyings.resize(nfaces * 3 * nvary);
+    }
+    size_t nfaces() const { return pts.size() / 3; }
+    Vec4f* face_pts(size_t i) { return &pts[i * 3]; }
+    const Vec4f* face_pts(size_t i) const { return &pts[i * 3]; }
+    float* face_varyings(size_t i) { return varyings.data() + i * 3 * nvaryings; }
+    const float* face_varyings(size_t i) const { return varyings.data() + i * 3 * nvaryings; }
+};
+
+// lights is empty unless the vertex stage was given local lights;
+// view_to_screen (Viewport * Projection) is what the tile culling needs to
+// go from view space to pixels. tile_culling false gives every tile every
+// light, for checking the culling against brute force.
+struct FrameGeometry {
+    std::vector<DrawGeometry> draws;
+    std::vector<ViewLight>    lights;
+    Matrix                    view_to_screen;
+    bool                      tile_culling = true;
+};
+
+
+// Camera-dependent state of one view.
+struct ViewParams {
+    Matrix ModelView;
+    Matrix Projection;
+    Matrix Viewport;
+    Vec3f  light_cam;
+    int    width;
+    int    height;
+
+    ViewParams(const Camera& cam, const Vec3f& light_dir, int w, int h);
+
+    Matrix model_view(const DrawCall& draw, int instance = 0) const;
+    // lit selects the varying layout with position and normal for local
+    // lights.
+    void bind(GouraudPhongShader& shader, const DrawCall& draw, bool lit = false,
+        int instance = 0) const;
+    // Meshlet culling for one instance of draw in this view. Back-facing
+    // clusters are only rejected for opaque draws; transparent ones show
+    // their back faces.
+    ClusterCuller culler(const DrawCall& draw, int instance = 0) const;
+};
+
+
+// Vertex stage of a whole frame. Only reads the models, so it can run on a
+// separate thread while the previous frame is being rasterized. Instances
+// are culled by the model's bounding sphere and meshlets before any of
+// their vertices are shaded; the faces of the surviving clusters of all
+// instances of a draw are then shaded with one parallel_for straight into
+// the varying buffer. lights, when given, are moved into view space for
+// the raster stage.
+void vertex_stage(const Camera& cam, const Vec3f& light_dir, int w, int h,
+    const std::vector<DrawCall>& draws, FrameGeometry& out,
+    const std::vector<Light>* lights = nullptr);
+
+// With local lights the Framebuffer overload first lays down the depth of
+// the opaque draws, culls the lights per tile against it and then shades;
+// the MSAA overload culls against the tile sides only.
+void raster_stage(const FrameGeometry& geo, const std::vector<DrawCall>& draws,
+    Framebuffer& frame);
+void raster_stage(const FrameGeometry& geo, const std::vector<DrawCall>& draws,
+    MSAATarget& target);
+
+// Renders the same draws from several cameras in one pass. Each face vertex
+// is fetched once (model lookups, uv/normal gathers, specular sample) and
+// shaded for every view; then the views are rasterized in parallel, one
+// view per task. frames must hold one render target per camera.
+void render_multiview(const std::vector<Camera>& cams, const Vec3f& light_dir,
+    const std::vector<DrawCall>& draws, std::vector<Framebuffer>& frames);
+
+#endif // __RENDERER_H__
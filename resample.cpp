@@ -0,0 +1,183 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "resample.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace {
+
+const float PI = 3.14159265f;
+
+float filter_radius(ResampleFilter f) {
+    switch (f) {
+    case RESAMPLE_BOX:      return 0.5f;
+    case RESAMPLE_BILINEAR: return 1.f;
+    case RESAMPLE_MITCHELL: return 2.f;
+    default:                return 3.f;
+    }
+}
+
+float sinc(float x) {
+    if (std::fabs(x) < 1e-6f) return 1.f;
+    x *= PI;
+    return std::sin(x) / x;
+}
+
+float filter_weight(ResampleFilter f, float x) {
+    x = std::fabs(x);
+    switch (f) {
+    case RESAMPLE_BOX:
+        return x <= 0.5f ? 1.f : 0.f;
+    case RESAMPLE_BILINEAR:
+        return x < 1.f ? 1.f - x : 0.f;
+    case RESAMPLE_MITCHELL: {
+        const float B = 1.f / 3.f, C = 1.f / 3.f;
+        if (x < 1.f)
+            return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.f;
+        if (x < 2.f)
+            return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.f;
+        return 0.f;
+    }
+    default:
+        return x < 3.f ? sinc(x) * sinc(x / 3.f) : 0.f;
+    }
+}
+
+// Taps of every output position along one axis: output i reads source
+// pixels [first[i], first[i] + ntaps) with weights[i * ntaps ..], padded
+// with zero weights so all outputs have the same tap count.
+struct WeightTable {
+    int                ntaps;
+    std::vector<int>   first;
+    std::vector<float> weights;
+
+    WeightTable(int src, int dst, ResampleFilter f) {
+        float scale = (float)src / dst;
+        float stretch = std::max(1.f, scale);
+        float support = filter_radius(f) * stretch;
+        ntaps = std::min(src, (int)std::ceil(support) * 2 + 1);
+        first.resize(dst);
+        weights.assign((size_t)dst * ntaps, 0.f);
+
+        for (int i = 0; i < dst; i++) {
+            float center = (i + 0.5f) * scale;
+            int lo = std::max(0, (int)std::floor(center - support));
+            int hi = std::min(src, (int)std::ceil(center + support));
+            lo = std::max(0, std::min(lo, src - ntaps));
+            first[i] = lo;
+            float* w = &weights[(size_t)i * ntaps];
+            float sum = 0.f;
+            for (int k = 0; k < ntaps && lo + k < hi; k++) {
+                w[k] = filter_weight(f, (lo + k + 0.5f - center) / stretch);
+                sum += w[k];
+            }
+            if (sum != 0.f) {
+                for (int k = 0; k < ntaps; k++) w[k] /= sum;
+            }
+            else {
+                // The box can miss every sample center when upscaling.
+                int nearest = std::max(0, std::min(src - 1, (int)center)) - lo;
+                w[nearest] = 1.f;
+            }
+        }
+    }
+};
+
+// Source row as 4 floats per pixel, so every format filters one pixel per
+// SSE register.
+void expand_row(const unsigned char* src, int w, int bpp, float* out) {
+    for (int x = 0; x < w; x++, src += bpp, out += 4) {
+        out[0] = src[0];
+        out[1] = bpp > 1 ? src[1] : 0.f;
+        out[2] = bpp > 2 ? src[2] : 0.f;
+        out[3] = bpp > 3 ? src[3] : 0.f;
+    }
+}
+
+void store_pixel(const float* p, int bpp, unsigned char* dst) {
+#if MY_GL_SSE2
+    __m128i i = _mm_cvtps_epi32(_mm_loadu_ps(p));
+    i = _mm_packs_epi32(i, i);
+    i = _mm_packus_epi16(i, i);
+    int packed = _mm_cvtsi128_si32(i);
+    memcpy(dst, &packed, bpp);
+#else
+    for (int c = 0; c < bpp; c++) {
+        float v = std::floor(p[c] + 0.5f);
+        dst[c] = (unsigned char)std::max(0.f, std::min(255.f, v));
+    }
+#endif
+}
+
+} // namespace
+
+
+bool parse_resample_filter(const char* name, ResampleFilter& filter) {
+    if (!strcmp(name, "box")) filter = RESAMPLE_BOX;
+    else if (!strcmp(name, "bilinear")) filter = RESAMPLE_BILINEAR;
+    else if (!strcmp(name, "mitchell")) filter = RESAMPLE_MITCHELL;
+    else if (!strcmp(name, "lanczos")) filter = RESAMPLE_LANCZOS3;
+    else return false;
+    return true;
+}
+
+void resample(const unsigned char* src, int sw, int sh, int bpp,
+    unsigned char* dst, int dw, int dh, ResampleFilter filter) {
+    TRACE_SCOPE("resample");
+    WeightTable cols(sw, dw, filter);
+    WeightTable rows(sh, dh, filter);
+
+    // Horizontal pass over only the source rows the vertical pass reads.
+    int row_lo = rows.first[0];
+    int row_hi = rows.first[dh - 1] + rows.ntaps;
+    std::vector<float> mid((size_t)(row_hi - row_lo) * dw * 4);
+
+    parallel_for(row_lo, row_hi, 16, [&](int lo, int hi) {
+        std::vector<float> line((size_t)sw * 4);
+        for (int y = lo; y < hi; y++) {
+            expand_row(src + (size_t)y * sw * bpp, sw, bpp, line.data());
+            float* out = &mid[(size_t)(y - row_lo) * dw * 4];
+            for (int x = 0; x < dw; x++, out += 4) {
+                const float* p = &line[(size_t)cols.first[x] * 4];
+                const float* w = &cols.weights[(size_t)x * cols.ntaps];
+#if MY_GL_SSE2
+                __m128 acc = _mm_setzero_ps();
+                for (int k = 0; k < cols.ntaps; k++)
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(p + 4 * k), _mm_set1_ps(w[k])));
+                _mm_storeu_ps(out, acc);
+#else
+                float acc[4] = { 0.f, 0.f, 0.f, 0.f };
+                for (int k = 0; k < cols.ntaps; k++)
+                    for (int c = 0; c < 4; c++) acc[c] += p[4 * k + c] * w[k];
+                memcpy(out, acc, sizeof(acc));
+#endif
+            }
+        }
+    });
+
+    // Vertical pass: whole rows scaled and summed, four floats at a time.
+    int n = dw * 4;
+    parallel_for(0, dh, 8, [&](int lo, int hi) {
+        std::vector<float> acc(n);
+        for (int y = lo; y < hi; y++) {
+            std::fill(acc.begin(), acc.end(), 0.f);
+            const float* w = &rows.weights[(size_t)y * rows.ntaps];
+            for (int k = 0; k < rows.ntaps; k++) {
+                if (w[k] == 0.f) continue;
+                const float* r = &mid[(size_t)(rows.first[y] + k - row_lo) * n];
+                int i = 0;
+#if MY_GL_SSE2
+                __m128 wk = _mm_set1_ps(w[k]);
+                for (; i < n; i += 4)
+                    _mm_storeu_ps(&acc[i], _mm_add_ps(_mm_loadu_ps(&acc[i]), _mm_mul_ps(_mm_loadu_ps(r + i), wk)));
+#endif
+                for (; i < n; i++) acc[i] += r[i] * w[k];
+            }
+            unsigned char* out = dst + (size_t)y * dw * bpp;
+            for (int x = 0; x < dw; x++) store_pixel(&acc[(size_t)x * 4], bpp, out + x * bpp);
+        }
+    });
+}
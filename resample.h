@@ -0,0 +1,23 @@
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+enum ResampleFilter {
+    RESAMPLE_BOX,
+    RESAMPLE_BILINEAR,
+    RESAMPLE_MITCHELL,   // B = C = 1/3
+    RESAMPLE_LANCZOS3
+};
+
+// Parses "box", "bilinear", "mitchell" or "lanczos".
+bool parse_resample_filter(const char* name, ResampleFilter& filter);
+
+// Separable resize of a tightly packed 8-bit image with bpp 1, 3 or 4
+// channels. The filter is widened by the reduction factor when
+// downsampling, so any reduction is a single pass with every source pixel
+// contributing. Weights are computed once per output column and row; rows
+// are filtered horizontally into a float buffer, then vertically, both
+// parallel over rows.
+void resample(const unsigned char* src, int sw, int sh, int bpp,
+    unsigned char* dst, int dw, int dh, ResampleFilter filter);
+
+#endif // __RESAMPLE_H__
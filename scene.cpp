@@ -0,0 +1,65 @@
+#include "scene.h"
+
+int Scene::add_node(int parent, const Matrix& local, Model* model, bool transparent, float alpha) {
+    Node n;
+    n.parent = parent;
+    n.local = local;
+    n.world = local;
+    n.in_view = parent == VIEW || (parent >= 0 && nodes[parent].in_view);
+    n.model = model;
+    n.transparent = transparent;
+    n.alpha = alpha;
+    nodes.push_back(n);
+    return (int)nodes.size() - 1;
+}
+
+void Scene::set_local(int node, const Matrix& local) {
+    nodes[node].local = local;
+}
+
+void Scene::build_draws(std::vector<DrawCall>& draws) {
+    // Parents come before their children, so one pass composes the tree.
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Node& n = nodes[i];
+        n.world = n.parent >= 0 ? nodes[n.parent].world * n.local : n.local;
+    }
+
+    draws.clear();
+    batches.clear();
+    std::vector<int> batch_of;    // draw index -> batch, -1 for view-space draws
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const Node& n = nodes[i];
+        if (!n.model) continue;
+
+        size_t d = 0;
+        if (!n.in_view) {
+            for (; d < draws.size(); d++) {
+                if (batch_of[d] >= 0 && draws[d].model == n.model &&
+                    draws[d].is_transparent == n.transparent && draws[d].alpha == n.alpha) break;
+            }
+        }
+        else {
+            d = draws.size();
+        }
+        if (d == draws.size()) {
+            DrawCall dc;
+            dc.model = n.model;
+            dc.view_xform = n.in_view ? n.world : Matrix::identity();
+            dc.is_transparent = n.transparent;
+            dc.alpha = n.alpha;
+            draws.push_back(dc);
+            batch_of.push_back(n.in_view ? -1 : (int)batches.size());
+            if (!n.in_view) batches.push_back(std::vector<Matrix>());
+        }
+        if (batch_of[d] >= 0) batches[batch_of[d]].push_back(n.world);
+    }
+
+    // Pointers only once the batches have stopped growing.
+    for (size_t d = 0; d < draws.size(); d++) {
+        if (batch_of[d] < 0) continue;
+        const std::vector<Matrix>& b = batches[batch_of[d]];
+        draws[d].instances = b.data();
+        draws[d].ninstances = (int)b.size();
+    }
+    draws = split_materials(draws);
+}
@@ -0,0 +1,52 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "renderer.h"
+
+// Scene graph: nodes with a transform relative to their parent, some of
+// them instances of a Model. Models are only referenced, so any number of
+// nodes share one model's vertices and textures.
+//
+// Nodes under ROOT live in world space. Nodes under VIEW are attached to
+// the camera: their transform is applied in view space, on top of the
+// camera's ModelView, like the cube around the head.
+class Scene {
+public:
+    static const int ROOT = -1;
+    static const int VIEW = -2;
+
+    // parent must be ROOT, VIEW or an earlier node. Nodes without a model
+    // only group their children.
+    int add_node(int parent, const Matrix& local, Model* model = nullptr,
+        bool transparent = false, float alpha = 1.f);
+    void set_local(int node, const Matrix& local);
+
+    int nnodes() const { return (int)nodes.size(); }
+
+    // Composes the transforms down the tree and batches the world-space
+    // instances of each (model, transparency, alpha) into one instanced
+    // draw; view-space nodes get a plain draw each. Draws come in the
+    // order their first node was added, then go through split_materials.
+    // The instance arrays belong to the scene and stay valid until the
+    // next call.
+    void build_draws(std::vector<DrawCall>& draws);
+
+private:
+    struct Node {
+        int    parent;
+        Matrix local;
+        Matrix world;      // or view-space, under VIEW
+        bool   in_view;
+        Model* model;
+        bool   transparent;
+        float  alpha;
+    };
+
+    std::vector<Node>                nodes;
+    std::vector<std::vector<Matrix>> batches;
+};
+
+#endif // __SCENE_H__
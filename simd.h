@@ -0,0 +1,13 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+// SSE2 is baseline on x86-64 and on 32-bit MSVC builds with /arch:SSE2 or
+// higher. Code using it keeps a scalar path for everything else.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MY_GL_SSE2 1
+#include <emmintrin.h>
+#else
+#define MY_GL_SSE2 0
+#endif
+
+#endif // __SIMD_H__
@@ -0,0 +1,99 @@
+#include <map>
+#include <mutex>
+#include <iostream>
+#include "texture_cache.h"
+#include "trace.h"
+
+Texture::Texture() : path_(), image(), bc(), width_(0), height_(0), bpp(0), pixels(NULL) {
+}
+
+bool Texture::load(const std::string& path, int bpp_, bool compress) {
+    TRACE_SCOPE("load_texture", compress ? "compressed" : nullptr);
+    if (!image.read_tga_file(path.c_str())) {
+        std::cerr << "texture file " << path << " loading failed\n";
+        return false;
+    }
+    path_ = path;
+    image.flip_vertically();
+    image.convert(bpp_);
+    std::cerr << "texture file " << path << " loading ok\n";
+
+    width_ = image.get_width();
+    height_ = image.get_height();
+    bpp = bpp_;
+    if (compress) {
+        bc.compress(image);
+        image = TGAImage();
+        pixels = NULL;
+    }
+    else {
+        pixels = image.buffer();
+    }
+    return true;
+}
+
+size_t Texture::bytes() const {
+    return pixels ? (size_t)width_ * height_ * bpp : bc.bytes();
+}
+
+const unsigned char* Texture::texel(Vec2f uv) const {
+    int x = int(uv.x * width_), y = int(uv.y * height_);
+    if (x < 0 || y < 0 || x >= width_ || y >= height_) return NULL;
+    if (!pixels) return bc.texel(x, y);
+    return pixels + ((size_t)y * width_ + x) * bpp;
+}
+
+
+namespace {
+
+std::mutex cache_mtx;
+std::map<std::string, std::weak_ptr<const Texture>> cache;
+int cache_hits = 0;
+int cache_misses = 0;
+
+} // namespace
+
+// Loaded outside the lock so different files load in parallel; if two
+// threads race on one file, the first to finish wins and the other copy is
+// dropped. Entries of freed textures are erased when next looked up, and
+// all of them whenever the stats are read, so a long-running server does
+// not keep one per path ever loaded.
+std::shared_ptr<const Texture> load_texture(const std::string& path, int bpp, bool compress) {
+    std::string key = path + (compress ? "|bc|" : "|") + std::to_string(bpp);
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            std::shared_ptr<const Texture> t = it->second.lock();
+            if (t) {
+                cache_hits++;
+                return t;
+            }
+            cache.erase(it);
+        }
+        cache_misses++;
+    }
+
+    std::shared_ptr<Texture> loaded = std::make_shared<Texture>();
+    if (!loaded->load(path, bpp, compress)) return nullptr;
+
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    std::weak_ptr<const Texture>& slot = cache[key];
+    std::shared_ptr<const Texture> t = slot.lock();
+    if (t) return t;
+    slot = loaded;
+    return loaded;
+}
+
+TextureCacheStats texture_cache_stats() {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (it->second.expired()) it = cache.erase(it);
+        else ++it;
+    }
+    TextureCacheStats st;
+    st.hits = cache_hits;
+    st.misses = cache_misses;
+    st.resident = (int)cache.size();
+    return st;
+}
@@ -0,0 +1,56 @@
+#ifndef __TEXTURE_CACHE_H__
+#define __TEXTURE_CACHE_H__
+
+#include <string>
+#include <memory>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "block_texture.h"
+
+// A texture map as the samplers read it: flipped so v grows upward,
+// converted to one fixed layout, and optionally block-compressed (the
+// decoded image is then released).
+class Texture {
+public:
+    Texture();
+
+    // False if the file can't be read.
+    bool load(const std::string& path, int bpp, bool compress);
+
+    int    width() const { return width_; }
+    int    height() const { return height_; }
+    int    bytespp() const { return bpp; }
+    // As given to load().
+    const std::string& path() const { return path_; }
+    size_t bytes() const;
+
+    // Texel under uv, from the compressed copy if there is one; NULL
+    // outside the map.
+    const unsigned char* texel(Vec2f uv) const;
+
+private:
+    std::string    path_;
+    TGAImage       image;
+    BlockTexture   bc;
+    int            width_;
+    int            height_;
+    int            bpp;
+    unsigned char* pixels;    // image's buffer, NULL when compressed
+};
+
+// Process-wide cache of loaded textures keyed by path, layout and
+// compression, so materials and models that name the same file share one
+// decoded copy. Entries are weak: a texture is freed with the last model
+// using it. Returns nullptr for files that can't be loaded; safe to call
+// from several threads.
+std::shared_ptr<const Texture> load_texture(const std::string& path, int bpp, bool compress);
+
+struct TextureCacheStats {
+    int hits;
+    int misses;
+    int resident;    // textures alive now
+};
+
+TextureCacheStats texture_cache_stats();
+
+#endif // __TEXTURE_CACHE_H__
@@ -3,7 +3,10 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <algorithm>
 #include "tgaimage.h"
+#include "pixel_ops.h"
+#include "trace.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -26,18 +29,21 @@ TGAImage::~TGAImage() {
 
 TGAImage& TGAImage::operator =(const TGAImage& img) {
     if (this != &img) {
-        if (data) delete[] data;
+        unsigned long nbytes = img.width * img.height * img.bytespp;
+        if (!data || nbytes != (unsigned long)(width * height * bytespp)) {
+            if (data) delete[] data;
+            data = new unsigned char[nbytes];
+        }
         width = img.width;
         height = img.height;
         bytespp = img.bytespp;
-        unsigned long nbytes = width * height * bytespp;
-        data = new unsigned char[nbytes];
         memcpy(data, img.data, nbytes);
     }
     return *this;
 }
 
 bool TGAImage::read_tga_file(const char* filename) {
+    TRACE_SCOPE("read_tga_file");
     if (data) delete[] data;
     data = NULL;
     std::ifstream in;
@@ -145,7 +151,8 @@ bool TGAImage::load_rle_data(std::ifstream& in) {
     return true;
 }
 
-bool TGAImage::write_tga_file(const char* filename, bool rle) {
+bool TGAImage::write_tga_file(const char* filename, bool rle, bool bottom_left) {
+    TRACE_SCOPE("write_tga_file");
     unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
     unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
     unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
@@ -162,7 +169,7 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
     header.width = width;
     header.height = height;
     header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
-    header.imagedescriptor = 0x20; 
+    header.imagedescriptor = bottom_left ? 0x00 : 0x20;
     out.write((char*)&header, sizeof(header));
     if (!out.good()) {
         out.close();
@@ -286,14 +293,8 @@ int TGAImage::get_height() {
 
 bool TGAImage::flip_horizontally() {
     if (!data) return false;
-    int half = width >> 1;
-    for (int i = 0; i < half; i++) {
-        for (int j = 0; j < height; j++) {
-            TGAColor c1 = get(i, j);
-            TGAColor c2 = get(width - 1 - i, j);
-            set(i, j, c2);
-            set(width - 1 - i, j, c1);
-        }
+    for (int j = 0; j < height; j++) {
+        reverse_pixels(data + (size_t)j * width * bytespp, width, bytespp);
     }
     return true;
 }
@@ -314,6 +315,60 @@ bool TGAImage::flip_vertically() {
     return true;
 }
 
+bool TGAImage::transpose() {
+    if (!data) return false;
+    unsigned char* tdata = new unsigned char[width * height * bytespp];
+    transpose_pixels(data, width, height, bytespp, tdata);
+    delete[] data;
+    data = tdata;
+    std::swap(width, height);
+    return true;
+}
+
+bool TGAImage::rotate(int quarter_turns) {
+    if (!data) return false;
+    switch (((quarter_turns % 4) + 4) % 4) {
+    case 1:
+        return transpose() && flip_horizontally();
+    case 2:
+        return flip_horizontally() && flip_vertically();
+    case 3:
+        return transpose() && flip_vertically();
+    default:
+        return true;
+    }
+}
+
+bool TGAImage::convert(int bpp) {
+    if (!data || (bpp != GRAYSCALE && bpp != RGB && bpp != RGBA)) return false;
+    if (bpp == bytespp) return true;
+    unsigned char* tdata = new unsigned char[width * height * bpp];
+    for (int j = 0; j < height; j++) {
+        convert_pixels(data + (size_t)j * width * bytespp, bytespp,
+            tdata + (size_t)j * width * bpp, bpp, width);
+    }
+    delete[] data;
+    data = tdata;
+    bytespp = bpp;
+    return true;
+}
+
+bool TGAImage::swap_red_blue() {
+    if (!data) return false;
+    for (int j = 0; j < height; j++) {
+        ::swap_red_blue(data + (size_t)j * width * bytespp, width, bytespp);
+    }
+    return true;
+}
+
+bool TGAImage::premultiply_alpha() {
+    if (!data || bytespp != RGBA) return false;
+    for (int j = 0; j < height; j++) {
+        ::premultiply_alpha(data + (size_t)j * width * bytespp, width);
+    }
+    return true;
+}
+
 unsigned char* TGAImage::buffer() {
     return data;
 }
@@ -322,36 +377,10 @@ void TGAImage::clear() {
     memset((void*)data, 0, width * height * bytespp);
 }
 
-bool TGAImage::scale(int w, int h) {
+bool TGAImage::scale(int w, int h, ResampleFilter filter) {
     if (w <= 0 || h <= 0 || !data) return false;
     unsigned char* tdata = new unsigned char[w * h * bytespp];
-    int nscanline = 0;
-    int oscanline = 0;
-    int erry = 0;
-    unsigned long nlinebytes = w * bytespp;
-    unsigned long olinebytes = width * bytespp;
-    for (int j = 0; j < height; j++) {
-        int errx = width - w;
-        int nx = -bytespp;
-        int ox = -bytespp;
-        for (int i = 0; i < width; i++) {
-            ox += bytespp;
-            errx += w;
-            while (errx >= (int)width) {
-                errx -= width;
-                nx += bytespp;
-                memcpy(tdata + nscanline + nx, data + oscanline + ox, bytespp);
-            }
-        }
-        erry += h;
-        oscanline += olinebytes;
-        while (erry >= (int)height) {
-            if (erry >= (int)height << 1) 
-                memcpy(tdata + nscanline + nlinebytes, tdata + nscanline, nlinebytes);
-            erry -= height;
-            nscanline += nlinebytes;
-        }
-    }
+    resample(data, width, height, bytespp, tdata, w, h, filter);
     delete[] data;
     data = tdata;
     width = w;
@@ -2,6 +2,7 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include "resample.h"
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -81,10 +82,20 @@ public:
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage& img);
     bool read_tga_file(const char* filename);
-    bool write_tga_file(const char* filename, bool rle = true);
+    bool write_tga_file(const char* filename, bool rle = true, bool bottom_left = false);
     bool flip_horizontally();
     bool flip_vertically();
-    bool scale(int w, int h);
+    // Swaps rows and columns (width and height trade places).
+    bool transpose();
+    // Rotates by quarter_turns * 90 degrees clockwise, row 0 at the top.
+    bool rotate(int quarter_turns);
+    // Changes the format in place, see convert_pixels().
+    bool convert(int bpp);
+    // B G R (A) <-> R G B (A), for handing buffers to RGBA consumers.
+    bool swap_red_blue();
+    bool premultiply_alpha();
+    // Resizes in place with resample().
+    bool scale(int w, int h, ResampleFilter filter = RESAMPLE_MITCHELL);
     TGAColor get(int x, int y);
     bool set(int x, int y, TGAColor& c);
     bool set(int x, int y, const TGAColor& c);
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstdlib>
+#include "thread_pool.h"
+
+static thread_local bool tls_is_worker = false;
+
+static int env_threads() {
+    int n = 0;
+#ifdef _MSC_VER
+    char* v = nullptr;
+    size_t len = 0;
+    if (_dupenv_s(&v, &len, "LAB3_THREADS") == 0 && v) {
+        n = atoi(v);
+        free(v);
+    }
+#else
+    const char* v = getenv("LAB3_THREADS");
+    if (v) n = atoi(v);
+#endif
+    return n;
+}
+
+ThreadPool::ThreadPool(int nthreads) {
+    if (nthreads <= 0) nthreads = (int)std::thread::hardware_concurrency();
+    if (nthreads <= 0) nthreads = 1;
+    for (int i = 0; i < nthreads; i++) {
+        workers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv_job.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        jobs.push_back(std::move(job));
+    }
+    cv_job.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_idle.wait(lock, [this] { return jobs.empty() && running == 0; });
+}
+
+bool ThreadPool::is_worker() {
+    return tls_is_worker;
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool(env_threads());
+    return pool;
+}
+
+void ThreadPool::run() {
+    tls_is_worker = true;
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;) {
+        cv_job.wait(lock, [this] { return stop || !jobs.empty(); });
+        if (jobs.empty()) break;
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        running++;
+        lock.unlock();
+        job();
+        lock.lock();
+        running--;
+        if (jobs.empty() && running == 0) cv_idle.notify_all();
+    }
+}
+
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+    if (end <= begin) return;
+    grain = std::max(1, grain);
+    ThreadPool& pool = ThreadPool::global();
+    int nchunks = std::min((end - begin + grain - 1) / grain, pool.size() * 4);
+    if (nchunks <= 1 || pool.size() <= 1 || ThreadPool::is_worker()) {
+        body(begin, end);
+        return;
+    }
+
+    int step = (end - begin + nchunks - 1) / nchunks;
+    std::mutex done_mtx;
+    std::condition_variable done_cv;
+    int pending = 0;
+
+    for (int lo = begin + step; lo < end; lo += step) {
+        int hi = std::min(end, lo + step);
+        {
+            std::lock_guard<std::mutex> lock(done_mtx);
+            pending++;
+        }
+        pool.submit([&, lo, hi] {
+            body(lo, hi);
+            std::lock_guard<std::mutex> lock(done_mtx);
+            if (--pending == 0) done_cv.notify_all();
+        });
+    }
+    body(begin, std::min(end, begin + step));
+
+    std::unique_lock<std::mutex> lock(done_mtx);
+    done_cv.wait(lock, [&] { return pending == 0; });
+}
@@ -0,0 +1,47 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads pulling jobs from one FIFO queue.
+class ThreadPool {
+public:
+    // nthreads <= 0 uses std::thread::hardware_concurrency().
+    explicit ThreadPool(int nthreads = 0);
+    ~ThreadPool();
+
+    void submit(std::function<void()> job);
+    // Blocks until the queue is empty and no job is running.
+    void wait();
+
+    int size() const { return (int)workers.size(); }
+
+    // True on threads owned by any ThreadPool.
+    static bool is_worker();
+    // Process-wide pool used by parallel_for. Its size can be overridden
+    // with the LAB3_THREADS environment variable.
+    static ThreadPool& global();
+
+private:
+    void run();
+
+    std::vector<std::thread>          workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex                        mtx;
+    std::condition_variable           cv_job;
+    std::condition_variable           cv_idle;
+    int                               running = 0;
+    bool                              stop = false;
+};
+
+// Calls body(lo, hi) over [begin, end) split into chunks of at least `grain`
+// items, on the global pool. The calling thread runs one chunk itself and
+// returns when all chunks are done. Nested calls from a worker run inline.
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+#endif // __THREAD_POOL_H__
@@ -0,0 +1,163 @@
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include "trace.h"
+#include "thread_pool.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct TraceEvent {
+    const char* name;
+    const char* detail;
+    long long   arg;
+    long long   start;
+    long long   dur;
+};
+
+// Written only by its thread. head counts every span ever pushed and is
+// published with release order, so the dump sees complete slots.
+struct TraceRing {
+    int                     tid;
+    std::string             thread_name;
+    std::vector<TraceEvent> events;
+    std::atomic<unsigned long long> head;
+
+    TraceRing() : tid(0), events(TRACE_RING_SIZE), head(0) {}
+};
+
+std::atomic<bool> recording(false);
+Clock::time_point epoch;
+std::thread::id   main_thread;
+
+std::mutex registry_mtx;
+std::vector<std::shared_ptr<TraceRing>> registry;
+int workers_named = 0;
+int others_named = 0;
+
+long long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+// Registered on the thread's first span; the registry keeps the ring alive
+// after the thread exits.
+TraceRing& thread_ring() {
+    static thread_local std::shared_ptr<TraceRing> local;
+    if (!local) {
+        local = std::make_shared<TraceRing>();
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        local->tid = (int)registry.size() + 1;
+        if (std::this_thread::get_id() == main_thread) local->thread_name = "main";
+        else if (ThreadPool::is_worker()) local->thread_name = "worker " + std::to_string(workers_named++);
+        else local->thread_name = "thread " + std::to_string(others_named++);
+        registry.push_back(local);
+    }
+    return *local;
+}
+
+void write_string(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        out << *s;
+    }
+    out << '"';
+}
+
+} // namespace
+
+
+void trace_start() {
+    {
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        for (size_t i = 0; i < registry.size(); i++) registry[i]->head.store(0);
+        main_thread = std::this_thread::get_id();
+        epoch = Clock::now();
+    }
+    recording.store(true, std::memory_order_release);
+}
+
+bool trace_enabled() {
+    return recording.load(std::memory_order_acquire);
+}
+
+TraceSpan::TraceSpan(const char* name, const char* detail, long long arg)
+    : name(name), detail(detail), arg(arg), start(trace_enabled() ? now_ns() : -1) {
+}
+
+void TraceSpan::end() {
+    if (start < 0) return;
+    long long stop = now_ns();
+    TraceRing& ring = thread_ring();
+    unsigned long long h = ring.head.load(std::memory_order_relaxed);
+    TraceEvent& e = ring.events[h & (TRACE_RING_SIZE - 1)];
+    e.name = name;
+    e.detail = detail;
+    e.arg = arg;
+    e.start = start;
+    e.dur = stop - start;
+    ring.head.store(h + 1, std::memory_order_release);
+    start = -1;
+}
+
+bool trace_dump(const std::string& filename) {
+    recording.store(false, std::memory_order_release);
+    std::ofstream out(filename.c_str());
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    unsigned long long spans = 0, dropped = 0;
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < registry.size(); i++) {
+        TraceRing& ring = *registry[i];
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.tid
+            << ",\"args\":{\"name\":";
+        write_string(out, ring.thread_name.c_str());
+        out << "}}";
+        first = false;
+
+        unsigned long long head = ring.head.load(std::memory_order_acquire);
+        unsigned long long n = std::min<unsigned long long>(head, TRACE_RING_SIZE);
+        for (unsigned long long k = head - n; k < head; k++) {
+            const TraceEvent& e = ring.events[k & (TRACE_RING_SIZE - 1)];
+            out << ",\n{\"name\":";
+            write_string(out, e.name);
+            out << ",\"cat\":\"lab3\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.tid
+                << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.dur / 1000.0;
+            if (e.detail || e.arg >= 0) {
+                out << ",\"args\":{";
+                if (e.detail) {
+                    out << "\"detail\":";
+                    write_string(out, e.detail);
+                }
+                if (e.arg >= 0) out << (e.detail ? "," : "") << "\"n\":" << e.arg;
+                out << "}";
+            }
+            out << "}";
+        }
+        spans += n;
+        dropped += head - n;
+        ring.head.store(0);
+    }
+    out << "\n]}\n";
+    if (!out.good()) {
+        std::cerr << "can't write " << filename << "\n";
+        return false;
+    }
+    std::cerr << "trace " << filename << ": " << spans << " spans on " << registry.size() << " threads";
+    if (dropped) std::cerr << " (" << dropped << " oldest overwritten)";
+    std::cerr << "\n";
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <string>
+
+// Timeline of the pipeline as Chrome trace-event JSON, for chrome://tracing
+// or ui.perfetto.dev. Spans are recorded only between trace_start() and
+// trace_dump(), and the macros below compile to nothing when the build
+// defines MY_GL_TRACE=0.
+#ifndef MY_GL_TRACE
+#define MY_GL_TRACE 1
+#endif
+
+// Each thread records into its own ring of this many spans; once it is
+// full the oldest spans are overwritten.
+const int TRACE_RING_SIZE = 1 << 14;
+
+void trace_start();
+bool trace_enabled();
+
+// Writes every thread's spans to filename and stops recording. Call it
+// when no thread is inside a span, like collect_stats().
+bool trace_dump(const std::string& filename);
+
+// Records [construction, end() or destruction) on the calling thread.
+// name and detail are kept as pointers, so they must be string literals.
+// arg is shown in the viewer when it is not negative.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, const char* detail = nullptr, long long arg = -1);
+    ~TraceSpan() { end(); }
+
+    void end();
+
+private:
+    const char* name;
+    const char* detail;
+    long long   arg;
+    long long   start;   // ns since trace_start(), -1 when not recording
+};
+
+#if MY_GL_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Span over the rest of the enclosing scope.
+#define TRACE_SCOPE(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+// Span named var, closed early with TRACE_END(var).
+#define TRACE_BEGIN(var, ...) TraceSpan var(__VA_ARGS__)
+#define TRACE_END(var) var.end()
+#else
+#define TRACE_SCOPE(...) ((void)0)
+#define TRACE_BEGIN(var, ...) ((void)0)
+#define TRACE_END(var) ((void)0)
+#endif
+
+#endif // __TRACE_H__